@@ -0,0 +1,41 @@
+#version 430 core
+layout (local_size_x = 256) in;
+
+// particle state, see GpuNBody: position and scale at the start of the last
+// step, the same now, and the velocity
+layout (std430, binding = 0) buffer Previous { vec4 previous[]; };
+layout (std430, binding = 1) buffer Current { vec4 current[]; };
+layout (std430, binding = 2) buffer Velocity { vec4 velocity[]; };
+// massive bodies as position and GM, at the start (2 * i) and end (2 * i + 1) of the step
+layout (std430, binding = 3) readonly buffer Attractors { vec4 attractors[]; };
+
+uniform int particleCount;
+uniform int attractorCount;
+uniform float dt;
+uniform float softening;
+
+void main()
+{
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= particleCount)
+        return;
+    vec4 p = current[i];
+    vec3 v = velocity[i].xyz;
+    previous[i] = p;
+
+    // drift-kick-drift leapfrog, pulled by the bodies half way through the step
+    vec3 x = p.xyz + v * (0.5 * dt);
+    vec3 a = vec3(0.0);
+    for (int j = 0; j < attractorCount; ++j)
+    {
+        vec4 body = mix(attractors[2 * j], attractors[2 * j + 1], 0.5);
+        vec3 d = body.xyz - x;
+        float r2 = dot(d, d) + softening * softening;
+        a += d * (body.w * inversesqrt(r2 * r2 * r2));
+    }
+    v += a * dt;
+    x += v * (0.5 * dt);
+
+    current[i] = vec4(x, p.w);
+    velocity[i] = vec4(v, 0.0);
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec4 aOrbit; // radius, phase, inclination, angular speed
+layout (location = 4) in vec2 aShape; // ascending node, scale
+
+#ifdef IMPOSTOR
+out vec3 QuadPos;     // on the quad facing the eye, see ImpostorCorner()
+flat out vec4 Sphere; // render space centre, radius
+#else
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out int Layer; // -1: sample material.diffuse, not the body texture array
+#endif
+invariant gl_Position; // the depth pre-pass and the lit pass must agree on depth
+
+layout (std140) uniform Camera
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    vec3 viewFront;
+    vec4 clusterParams;
+    vec4 renderOrigin; // xyz: the world position at the origin of render space
+};
+// the sim time as AsteroidBelt::orbitTime() splits it
+#define TIME_SPAN 256.0 // AsteroidBelt::TIME_SPAN
+uniform uint timeSpans;
+uniform float timeOffset;
+
+// phase + angularSpeed * the sim time, keep in sync with AsteroidBelt::orbitAngle()
+float OrbitAngle(float phase, float angularSpeed)
+{
+    float turnsPerSecond = angularSpeed * (1.0 / 6.28318530718);
+    float spanTurns = turnsPerSecond * TIME_SPAN;
+    uint startTurns = uint(fract(spanTurns) * 4294967296.0) * timeSpans;
+    return phase + 6.28318530718 * fract(float(startTurns) * (1.0 / 4294967296.0) + turnsPerSecond * timeOffset);
+}
+
+#ifdef IMPOSTOR
+// the quad corner around the sphere, as in 6.multiple_lights_instanced.vs
+vec3 ImpostorCorner(vec4 sphere)
+{
+    vec3 toEye = viewPos - sphere.xyz;
+    float d2 = dot(toEye, toEye);
+    vec3 forward = toEye * inversesqrt(d2);
+    vec3 right = normalize(cross(vec3(view[0][1], view[1][1], view[2][1]), forward));
+    vec3 up = cross(forward, right);
+    float extent = sphere.w * sqrt(d2 / max(d2 - sphere.w * sphere.w, 1e-6 * d2));
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    return sphere.xyz + (right * corner.x + up * corner.y) * extent;
+}
+#endif
+
+void main()
+{
+    // circular Keplerian orbit, keep in sync with AsteroidBelt::positionAt()
+    float angle = OrbitAngle(aOrbit.y, aOrbit.w);
+    float x = cos(angle) * aOrbit.x;
+    float z = sin(angle) * aOrbit.x;
+    float y = -z * sin(aOrbit.z);
+    z = z * cos(aOrbit.z);
+    float cn = cos(aShape.x);
+    float sn = sin(aShape.x);
+    vec3 center = vec3(cn * x + sn * z, y, -sn * x + cn * z) - renderOrigin.xyz;
+
+#ifdef IMPOSTOR
+    Sphere = vec4(center, aShape.y);
+    QuadPos = ImpostorCorner(Sphere);
+    gl_Position = projection * view * vec4(QuadPos, 1.0);
+#else
+    // translate + uniform scale only, so the mesh normal is already correct
+    FragPos = center + aPos * aShape.y;
+    Normal = aNormal;
+    TexCoords = aTexCoords;
+    Layer = -1;
+    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+#endif
+}
\ No newline at end of file
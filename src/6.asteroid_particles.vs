@@ -0,0 +1,62 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in vec4 aCurrent;  // position, scale: the particle buffers of 6.asteroid_nbody.cs
+layout (location = 4) in vec4 aPrevious;
+
+#ifdef IMPOSTOR
+out vec3 QuadPos;     // on the quad facing the eye, see ImpostorCorner()
+flat out vec4 Sphere; // render space centre, radius
+#else
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out int Layer; // -1: sample material.diffuse, not the body texture array
+#endif
+invariant gl_Position; // the depth pre-pass and the lit pass must agree on depth
+
+layout (std140) uniform Camera
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    vec3 viewFront;
+    vec4 clusterParams;
+    vec4 renderOrigin; // xyz: the world position at the origin of render space
+};
+uniform float alpha; // how far the frame is into the next simulation step
+
+#ifdef IMPOSTOR
+// the quad corner around the sphere, as in 6.multiple_lights_instanced.vs
+vec3 ImpostorCorner(vec4 sphere)
+{
+    vec3 toEye = viewPos - sphere.xyz;
+    float d2 = dot(toEye, toEye);
+    vec3 forward = toEye * inversesqrt(d2);
+    vec3 right = normalize(cross(vec3(view[0][1], view[1][1], view[2][1]), forward));
+    vec3 up = cross(forward, right);
+    float extent = sphere.w * sqrt(d2 / max(d2 - sphere.w * sphere.w, 1e-6 * d2));
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    return sphere.xyz + (right * corner.x + up * corner.y) * extent;
+}
+#endif
+
+void main()
+{
+    vec3 center = mix(aPrevious.xyz, aCurrent.xyz, alpha) - renderOrigin.xyz;
+
+#ifdef IMPOSTOR
+    Sphere = vec4(center, aCurrent.w);
+    QuadPos = ImpostorCorner(Sphere);
+    gl_Position = projection * view * vec4(QuadPos, 1.0);
+#else
+    // translate + uniform scale only, so the mesh normal is already correct
+    FragPos = center + aPos * aCurrent.w;
+    Normal = aNormal;
+    TexCoords = aTexCoords;
+    Layer = -1;
+    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+#endif
+}
\ No newline at end of file
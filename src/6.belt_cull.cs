@@ -0,0 +1,83 @@
+#version 430 core
+layout (local_size_x = 256) in;
+
+// orbital elements as AsteroidBelt uploads them, 6 tightly packed floats
+struct Elements
+{
+    float radius;
+    float phase;
+    float inclination;
+    float angularSpeed;
+    float ascendingNode;
+    float scale;
+};
+layout (std430, binding = 0) readonly buffer Belt { Elements rocks[]; };
+// surviving rocks as position + scale, read back as instance attributes
+layout (std430, binding = 1) writeonly buffer Visible { vec4 visible[]; };
+// the DrawElementsIndirectCommand of the rocks drawn as meshes, then the
+// DrawArraysIndirectCommand of the impostors, whose instances start at
+// impostorBaseInstance; both instance counts are zero before the dispatch
+layout (std430, binding = 2) buffer Command
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+    uint impostorVertexCount;
+    uint impostorInstanceCount;
+    uint impostorFirst;
+    uint impostorBaseInstance;
+};
+
+uniform int rockCount;
+// the sim time as AsteroidBelt::orbitTime() splits it
+#define TIME_SPAN 256.0 // AsteroidBelt::TIME_SPAN
+uniform uint timeSpans;
+uniform float timeOffset;
+uniform vec4 planes[6]; // Frustum planes, xyz inward normal, w distance
+uniform vec3 cameraPosition;
+uniform float pixelScale;     // viewport height / 2 / tan(fovY / 2)
+uniform float impostorRadius; // SphereLOD::impostorRadius
+
+// phase + angularSpeed * the sim time, keep in sync with AsteroidBelt::orbitAngle()
+float OrbitAngle(float phase, float angularSpeed)
+{
+    float turnsPerSecond = angularSpeed * (1.0 / 6.28318530718);
+    float spanTurns = turnsPerSecond * TIME_SPAN;
+    uint startTurns = uint(fract(spanTurns) * 4294967296.0) * timeSpans;
+    return phase + 6.28318530718 * fract(float(startTurns) * (1.0 / 4294967296.0) + turnsPerSecond * timeOffset);
+}
+
+void main()
+{
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= rockCount)
+        return;
+    Elements e = rocks[i];
+
+    // circular Keplerian orbit, keep in sync with AsteroidBelt::positionAt()
+    float angle = OrbitAngle(e.phase, e.angularSpeed);
+    float x = cos(angle) * e.radius;
+    float z = sin(angle) * e.radius;
+    float y = -z * sin(e.inclination);
+    z = z * cos(e.inclination);
+    float cn = cos(e.ascendingNode);
+    float sn = sin(e.ascendingNode);
+    vec3 center = vec3(cn * x + sn * z, y, -sn * x + cn * z);
+
+    // the unit sphere mesh scaled by e.scale is its own bounding sphere
+    for (int p = 0; p < 6; ++p)
+    {
+        if (dot(planes[p].xyz, center) + planes[p].w < -e.scale)
+            return;
+    }
+    // keep in sync with SphereLOD::selectOrImpostor()
+    float distance = length(center - cameraPosition);
+    uint slot;
+    if (distance > e.scale && e.scale / distance * pixelScale < impostorRadius)
+        slot = impostorBaseInstance + atomicAdd(impostorInstanceCount, 1u);
+    else
+        slot = atomicAdd(instanceCount, 1u);
+    visible[slot] = vec4(center, e.scale);
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#version 430 core
+layout (local_size_x = 64) in;
+
+// one body as GpuSceneRenderer uploads it (GpuBody in gpu_scene.h)
+struct Body
+{
+    mat4 model;
+    vec4 normalMatrix[3]; // columns, w unused
+    vec4 sphere;          // world centre, radius
+    int layer;
+    int padding[3];
+};
+layout (std430, binding = 0) readonly buffer Bodies { Body bodies[]; };
+// surviving bodies as BodyInstance (body_batch.h): model, normal matrix, layer
+// as 26 tightly packed words, grouped by level from level * bodyCount
+layout (std430, binding = 1) writeonly buffer Visible { float visible[]; };
+// one DrawElementsIndirectCommand per sphere level; instanceCount is zero
+// before the dispatch and baseInstance is level * bodyCount
+struct Command
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+layout (std430, binding = 2) buffer Commands { Command commands[]; };
+
+#define LEVEL_COUNT 5
+
+uniform int bodyCount;
+uniform vec4 planes[6];    // Frustum planes, xyz inward normal, w distance
+uniform vec3 cameraPosition;
+uniform float pixelScale;  // viewport height / 2 / tan(fovY / 2)
+uniform float viewportHeight;
+uniform float pixelError;  // SphereLOD::pixelError
+uniform int levelSectors[LEVEL_COUNT];
+
+void main()
+{
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= bodyCount)
+        return;
+    Body body = bodies[i];
+    for (int p = 0; p < 6; ++p)
+    {
+        if (dot(planes[p].xyz, body.sphere.xyz) + planes[p].w < -body.sphere.w)
+            return;
+    }
+
+    // keep in sync with SphereLOD::projectedRadius() and select()
+    float distance = length(body.sphere.xyz - cameraPosition);
+    float screenRadius = distance <= body.sphere.w ? viewportHeight : body.sphere.w / distance * pixelScale;
+    float sectorsNeeded = 6.28318530718 * screenRadius / pixelError;
+    int level = LEVEL_COUNT - 1;
+    for (int l = LEVEL_COUNT - 1; l >= 0; --l)
+    {
+        if (float(levelSectors[l]) >= sectorsNeeded)
+            level = l;
+    }
+
+    uint slot = uint(level * bodyCount) + atomicAdd(commands[level].instanceCount, 1u);
+    uint base = slot * 26u;
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r)
+            visible[base + uint(c * 4 + r)] = body.model[c][r];
+    for (int c = 0; c < 3; ++c)
+        for (int r = 0; r < 3; ++r)
+            visible[base + 16u + uint(c * 3 + r)] = body.normalMatrix[c][r];
+    visible[base + 25u] = intBitsToFloat(body.layer);
+}
\ No newline at end of file
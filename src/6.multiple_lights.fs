@@ -1,5 +1,10 @@
 #version 330 core
+#ifdef GBUFFER
+layout (location = 0) out vec4 FragColor; // albedo, alpha 0 where unlit
+layout (location = 1) out vec4 GNormal;   // world space normal
+#else
 out vec4 FragColor;
+#endif
 
 struct Material {
     sampler2D diffuse;
@@ -15,55 +20,191 @@ struct DirLight {
     vec3 specular;
 };
 
+// members are ordered like the C++ struct in lighting.h, whose 64-byte
+// records FetchPointLight() reads from pointLightData
 struct PointLight {
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;
-	
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
+    float range;
 };
 
+// the flashlight sits at the camera: position/direction are viewPos/viewFront
 struct SpotLight {
-    vec3 position;
-    vec3 direction;
+    vec3 ambient;
     float cutOff;
+    vec3 diffuse;
     float outerCutOff;
-  
+    vec3 specular;
     float constant;
     float linear;
     float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;       
 };
 
-#define NR_POINT_LIGHTS 4
+// permutations (ShaderVariants in shader_variants.h) defined after #version:
+// NO_DIR, NO_SPOT  the directional / spot light is off for this scene
+// N_LIGHTS k       shade the first k point lights, without the cluster lookup
+// UNLIT            emissive bodies: the surface colour as it is
+// DEPTH_ONLY       the depth pre-pass: no shading at all
+// GBUFFER          write albedo and normal for the deferred lighting pass
+// DEFERRED_LIGHTING the lighting pass itself, over 6.texture_copy.vs, reading
+//                  the G-buffer (GBuffer in gbuffer.h) instead of the varyings
+// IMPOSTOR         the belt's far rocks: ray trace the sphere behind a quad of
+//                  the vertex shader's IMPOSTOR variant, combines with the rest
+// REVERSED_Z       depth is 1 at the near plane and 0 at infinity, clip z in
+//                  [0, 1] (DepthMode in depth_mode.h), combines with the rest
+
+#ifdef REVERSED_Z
+#define FAR_DEPTH 0.0
+#else
+#define FAR_DEPTH 1.0
+#endif
+
+// light clusters, keep in sync with LightClusters in light_clusters.h
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
 
+#ifdef DEFERRED_LIGHTING
+in vec2 TexCoords; // of the screen
+vec3 FragPos;      // reconstructed from the G-buffer depth
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform vec2 gBufferScale; // of TexCoords, the part of the G-buffer drawn, GBuffer::usedScale()
+uniform mat4 inverseViewProjection;
+#elif defined(IMPOSTOR)
+in vec3 QuadPos;
+flat in vec4 Sphere; // render space centre, radius
+// where the view ray through QuadPos hits the sphere, set by TraceImpostor()
+vec3 FragPos;
+vec3 Normal;
+vec2 TexCoords;
+const int Layer = -1;
+#else
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+flat in int Layer; // layer of bodyTextures, or -1 for material.diffuse
+#endif
+
+layout (std140) uniform Camera
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    vec3 viewFront;
+    vec4 clusterParams; // tiles per pixel in x and y, slice = log(depth) * z + w
+    vec4 renderOrigin;  // xyz: the world position at the origin of render space,
+                        // where the camera is; everything here is relative to it
+};
+
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    SpotLight spotLight;
+    bool dirLightOn;
+    bool spotLightOn;
+};
+
+// the point lights (4 texels each), each cluster's first index and count
+// into clusterLights, and the light indices of every cluster
+uniform samplerBuffer pointLightData;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLights;
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform SpotLight spotLight;
 uniform Material material;
 
+// every body texture, one layer each (TextureArray in texture_array.h), for
+// the bodies BodyBatch draws in one instanced call
+uniform sampler2DArray bodyTextures;
+
+// virtual texture (VirtualTexture in virtual_texture.h) instead of material.diffuse:
+// the page table has one level per tile level and maps each tile to a cache
+// slot, or to the slot of its nearest resident ancestor
+uniform bool useVirtualTexture;
+uniform sampler2D vtPageTable;
+uniform sampler2D vtTileCache;
+uniform vec4 vtLayout; // tiles x, tiles y at level 0, level count, cache size in tiles
+
+// the surface colour of this fragment, for every light
+vec3 diffuseColor;
+vec3 specularColor;
+
 // function prototypes
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 SampleVirtualTexture(vec2 uv);
+PointLight FetchPointLight(int index);
+void TraceImpostor();
 
 void main()
 {    
+#ifdef IMPOSTOR
+    TraceImpostor();
+#endif
+#ifdef DEPTH_ONLY
+    return;
+#endif
     // properties
+#ifdef DEFERRED_LIGHTING
+    vec2 gBufferCoords = TexCoords * gBufferScale;
+    float depthSample = texture(gDepth, gBufferCoords).r;
+    if (depthSample == FAR_DEPTH)
+        discard; // background
+    gl_FragDepth = depthSample; // for what is drawn forward afterwards
+    vec4 albedo = texture(gAlbedo, gBufferCoords);
+    diffuseColor = albedo.rgb;
+    specularColor = diffuseColor;
+    if (albedo.a < 0.5) {
+        FragColor = vec4(diffuseColor, 1.0);
+        return;
+    }
+#ifdef REVERSED_Z
+    vec4 world = inverseViewProjection * vec4(TexCoords * 2.0 - 1.0, depthSample, 1.0);
+#else
+    vec4 world = inverseViewProjection * vec4(vec3(TexCoords, depthSample) * 2.0 - 1.0, 1.0);
+#endif
+    FragPos = world.xyz / world.w;
+    vec3 norm = normalize(texture(gNormal, gBufferCoords).xyz);
+    vec3 viewDir = normalize(viewPos - FragPos);
+#else
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
+    if (useVirtualTexture) {
+        diffuseColor = SampleVirtualTexture(TexCoords);
+        specularColor = diffuseColor;
+    }
+    else if (Layer >= 0) {
+        diffuseColor = vec3(texture(bodyTextures, vec3(TexCoords, float(Layer))));
+        specularColor = diffuseColor; // same texture for specular
+    }
+    else {
+        diffuseColor = vec3(texture(material.diffuse, TexCoords));
+        specularColor = vec3(texture(material.specular, TexCoords));
+    }
+#endif
+
+#ifdef GBUFFER
+    // the G-buffer keeps one colour, specular is sampled from the same texture anyway
+#ifdef UNLIT
+    FragColor = vec4(diffuseColor, 0.0);
+#else
+    FragColor = vec4(diffuseColor, 1.0);
+#endif
+    GNormal = vec4(norm, 0.0);
+    return;
+#endif
+
+#ifdef UNLIT
+    FragColor = vec4(diffuseColor, 1.0);
+    return;
+#endif
     
     // == =====================================================
     // Our lighting is set up in 3 phases: directional, point lights and an optional flashlight
@@ -72,12 +213,28 @@ void main()
     // this fragment's final color.
     // == =====================================================
     // phase 1: directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
-    // phase 2: point lights
-    for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
+    vec3 result = vec3(0.0);
+#ifndef NO_DIR
+    if (dirLightOn)
+        result += CalcDirLight(dirLight, norm, viewDir);
+#endif
+    // phase 2: point lights, only those binned into this fragment's cluster
+#ifdef N_LIGHTS
+    for(int i = 0; i < N_LIGHTS; i++)
+        result += CalcPointLight(FetchPointLight(i), norm, FragPos, viewDir);
+#else
+    float depth = max(-(view * vec4(FragPos, 1.0)).z, 1e-4);
+    ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterParams.xy), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    int slice = int(clamp(log(depth) * clusterParams.z + clusterParams.w, 0.0, float(CLUSTER_SLICES - 1)));
+    uvec2 cluster = texelFetch(clusterGrid, (slice * CLUSTER_TILES_Y + tile.y) * CLUSTER_TILES_X + tile.x).xy;
+    for(uint i = 0u; i < cluster.y; i++)
+        result += CalcPointLight(FetchPointLight(int(texelFetch(clusterLights, int(cluster.x + i)).r)), norm, FragPos, viewDir);
+#endif
     // phase 3: spot light
-    result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
+#ifndef NO_SPOT
+    if (spotLightOn)
+        result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
+#endif
     
     FragColor = vec4(result, 1.0);
 }
@@ -92,9 +249,9 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     return (ambient + diffuse + specular);
 }
 
@@ -110,10 +267,13 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    // faded to zero at the light's range, so the cluster edges do not show
+    float window = clamp(1.0 - pow(distance / light.range, 4.0), 0.0, 1.0);
+    attenuation *= window * window;
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -123,25 +283,87 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 // calculates the color when using a spot light.
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
-    vec3 lightDir = normalize(light.position - fragPos);
+    vec3 lightDir = normalize(viewPos - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // attenuation
-    float distance = length(light.position - fragPos);
+    float distance = length(viewPos - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
     // spotlight intensity
-    float theta = dot(lightDir, normalize(-light.direction)); 
+    float theta = dot(lightDir, normalize(-viewFront)); 
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
     return (ambient + diffuse + specular);
+}
+
+#ifdef IMPOSTOR
+// the sphere's front surface, its normal and the texcoord createSphere() in
+// sphere_lod.h would have given it there; the quad's corners are discarded
+void TraceImpostor()
+{
+    vec3 dir = normalize(QuadPos - viewPos);
+    vec3 toEye = viewPos - Sphere.xyz;
+    float b = dot(toEye, dir);
+    float h = b * b - dot(toEye, toEye) + Sphere.w * Sphere.w;
+    if (h < 0.0)
+        discard;
+    FragPos = viewPos + dir * (-b - sqrt(h));
+    Normal = (FragPos - Sphere.xyz) / Sphere.w;
+    TexCoords = vec2(1.0 - fract(atan(Normal.z, Normal.x) / 6.28318530718), 0.5 + asin(clamp(Normal.y, -1.0, 1.0)) / 3.14159265359);
+    vec4 clip = projection * view * vec4(FragPos, 1.0);
+#ifdef REVERSED_Z
+    gl_FragDepth = clip.z / clip.w;
+#else
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+#endif
+}
+#endif
+
+// point light index of the lights buffer texture
+PointLight FetchPointLight(int index)
+{
+    vec4 a = texelFetch(pointLightData, index * 4);
+    vec4 b = texelFetch(pointLightData, index * 4 + 1);
+    vec4 c = texelFetch(pointLightData, index * 4 + 2);
+    vec4 d = texelFetch(pointLightData, index * 4 + 3);
+    PointLight light;
+    light.position = a.xyz - renderOrigin.xyz; // the buffer is in world space
+    light.constant = a.w;
+    light.ambient = b.xyz;
+    light.linear = b.w;
+    light.diffuse = c.xyz;
+    light.quadratic = c.w;
+    light.specular = d.xyz;
+    light.range = d.w;
+    return light;
+}
+
+// tile level from the screen footprint, keep in sync with 6.vt_feedback.fs
+// (120 = texture_bake::VT_TILE_PAYLOAD, 128 = VT_TILE_SIZE, 4 = VT_TILE_BORDER)
+vec3 SampleVirtualTexture(vec2 uv)
+{
+    vec2 texels = vtLayout.xy * 120.0;
+    // fract() keeps the footprint small across the seam where u wraps
+    vec2 dx = (fract(dFdx(uv) + 0.5) - 0.5) * texels;
+    vec2 dy = (fract(dFdy(uv) + 0.5) - 0.5) * texels;
+    int level = int(clamp(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8))), 0.0, vtLayout.z - 1.0));
+    vec2 wrapped = vec2(fract(uv.x), clamp(uv.y, 0.0, 1.0));
+    ivec2 pages = max(ivec2(vtLayout.xy) >> level, ivec2(1));
+    vec4 entry = texelFetch(vtPageTable, min(ivec2(wrapped * vec2(pages)), pages - 1), level) * 255.0;
+    // the entry may be a coarser tile: find the texel inside that one
+    ivec2 mappedPages = max(ivec2(vtLayout.xy) >> int(entry.z + 0.5), ivec2(1));
+    vec2 inPages = wrapped * vec2(mappedPages);
+    vec2 inTile = inPages - vec2(min(ivec2(inPages), mappedPages - 1));
+    vec2 texel = floor(entry.xy + 0.5) * 128.0 + 4.0 + inTile * 120.0;
+    return textureLod(vtTileCache, texel / (vtLayout.w * 128.0), 0.0).rgb;
 }
\ No newline at end of file
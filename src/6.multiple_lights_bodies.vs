@@ -0,0 +1,32 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per body (BodyInstance in body_batch.h)
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in mat3 aNormalMatrix;
+layout (location = 10) in int aLayer;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out int Layer; // the body's layer of the texture array
+invariant gl_Position; // the depth pre-pass and the lit pass must agree on depth
+
+layout (std140) uniform Camera
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    vec3 viewFront;
+};
+
+void main()
+{
+    FragPos = vec3(aModel * vec4(aPos, 1.0));
+    Normal = aNormalMatrix * aNormal;
+    TexCoords = aTexCoords;
+    Layer = aLayer;
+    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
\ No newline at end of file
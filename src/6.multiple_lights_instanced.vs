@@ -0,0 +1,63 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aInstanceModel;
+
+#ifdef IMPOSTOR
+out vec3 QuadPos;     // on the quad facing the eye, see ImpostorCorner()
+flat out vec4 Sphere; // render space centre, radius
+#else
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out int Layer; // -1: sample material.diffuse, not the body texture array
+#endif
+invariant gl_Position; // the depth pre-pass and the lit pass must agree on depth
+
+layout (std140) uniform Camera
+{
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+    vec3 viewFront;
+    vec4 clusterParams;
+    vec4 renderOrigin; // xyz: the world position at the origin of render space
+};
+
+#ifdef IMPOSTOR
+// Corner gl_VertexID (triangle strip order) of a quad through the sphere's
+// centre facing the eye, for 6.multiple_lights.fs to ray trace the sphere in.
+// The cone from the eye grazing the sphere cuts that plane in a circle of
+// radius r * d / sqrt(d^2 - r^2), which the quad covers.
+vec3 ImpostorCorner(vec4 sphere)
+{
+    vec3 toEye = viewPos - sphere.xyz;
+    float d2 = dot(toEye, toEye);
+    vec3 forward = toEye * inversesqrt(d2);
+    vec3 right = normalize(cross(vec3(view[0][1], view[1][1], view[2][1]), forward));
+    vec3 up = cross(forward, right);
+    float extent = sphere.w * sqrt(d2 / max(d2 - sphere.w * sphere.w, 1e-6 * d2));
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    return sphere.xyz + (right * corner.x + up * corner.y) * extent;
+}
+#endif
+
+void main()
+{
+#ifdef IMPOSTOR
+    Sphere = vec4(aInstanceModel[3].xyz - renderOrigin.xyz, length(aInstanceModel[0].xyz));
+    QuadPos = ImpostorCorner(Sphere);
+    gl_Position = projection * view * vec4(QuadPos, 1.0);
+#else
+    // the instances are in world space, the camera block in render space
+    FragPos = vec3(aInstanceModel * vec4(aPos, 1.0)) - renderOrigin.xyz;
+    // instances are translate + uniform scale, so the upper 3x3 is a valid normal matrix
+    // up to a scale factor the fragment shader normalizes away
+    Normal = mat3(aInstanceModel) * aNormal;
+    TexCoords = aTexCoords;
+    Layer = -1;
+    
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+#endif
+}
\ No newline at end of file
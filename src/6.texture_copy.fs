@@ -0,0 +1,13 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// any 2D texture, scaled to the layer being drawn; the source mip chain
+// filters the downscale
+uniform sampler2D source;
+
+void main()
+{
+    FragColor = vec4(texture(source, TexCoords).rgb, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#version 330 core
+out vec4 FragColor;
+
+// Virtual texture feedback (VirtualTextureFeedback in virtual_texture.h): the
+// tile every pixel samples, packed as x low byte, y low byte,
+// x high 2 bits | y high 2 bits << 2 | level << 4, and the texture id
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform vec4 vtLayout; // tiles x, tiles y at level 0, level count, cache size in tiles
+uniform int vtId;      // index + 1, 0 is the cleared background
+uniform float lodBias; // this pass runs at a fraction of the resolution
+
+void main()
+{
+    // keep in sync with SampleVirtualTexture() in 6.multiple_lights.fs
+    vec2 texels = vtLayout.xy * 120.0;
+    vec2 dx = (fract(dFdx(TexCoords) + 0.5) - 0.5) * texels;
+    vec2 dy = (fract(dFdy(TexCoords) + 0.5) - 0.5) * texels;
+    float footprint = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+    int level = int(clamp(floor(footprint), 0.0, vtLayout.z - 1.0));
+    vec2 wrapped = vec2(fract(TexCoords.x), clamp(TexCoords.y, 0.0, 1.0));
+    ivec2 pages = max(ivec2(vtLayout.xy) >> level, ivec2(1));
+    uvec2 page = uvec2(min(ivec2(wrapped * vec2(pages)), pages - 1));
+    uint packed = (page.x >> 8u) | ((page.y >> 8u) << 2u) | (uint(level) << 4u);
+    FragColor = vec4(float(page.x & 255u), float(page.y & 255u), float(packed), float(vtId)) / 255.0;
+}
\ No newline at end of file
@@ -0,0 +1,420 @@
+#ifndef ASTEROID_BELT_H
+#define ASTEROID_BELT_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "dynamic_buffer.h"
+#include "frustum.h"
+#include "job_system.h"
+#include "sphere_lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Belt animation modes
+enum BeltMode { BELT_STATIC, BELT_GPU_ORBIT, BELT_CPU_ORBIT };
+
+// Orbital elements of one asteroid, laid out exactly as the orbit vertex shader
+// reads them (locations 3 and 4)
+struct AsteroidElements {
+    float radius;
+    float phase;         // angle at t = 0
+    float inclination;   // tilt of the orbit plane (radians)
+    float angularSpeed;  // radians/sec, sqrt(GM / r^3)
+    float ascendingNode; // rotation of the line of nodes around Y (radians)
+    float scale;
+};
+
+// A sim time as the belt's orbits take it (AsteroidBelt::orbitTime()): whole
+// AsteroidBelt::TIME_SPAN spans, modulo 2^32, and the float seconds into the
+// current one
+struct BeltTime {
+    unsigned int spans = 0;
+    float offset = 0.0f;
+};
+
+// One cell of the belt's culling grid: a contiguous run of rocks and a sphere
+// bounding them (mesh radius included)
+struct BeltCell {
+    glm::vec3 center;
+    float radius;
+    unsigned int first;
+    unsigned int count;
+};
+
+// Asteroid belt drawn with a single instanced draw call. Per-instance model
+// matrices live in their own VBO, attached to a VAO that shares the sphere
+// mesh's vertex and index buffers.
+// In BELT_GPU_ORBIT mode the per-instance data is the orbital elements instead,
+// and 6.asteroid_orbit.vs places every rock from the current time, so the CPU
+// cost per frame does not depend on the size of the belt.
+// BELT_CPU_ORBIT computes the same orbits on the job system, writing the model
+// matrices straight into this frame's segment of a persistently mapped ring
+// (DynamicBuffer), which streamVAO reads; the t = 0 matrices stay untouched.
+// The orbits take the sim time split by orbitTime(), so orbitAngle() stays as
+// precise at any sim time as in the first seconds with the elements unchanged.
+// Rocks are sorted into a polar grid (angular sectors x radial bands) of their
+// t = 0 positions, so the static belt is culled per cell: a few hundred sphere
+// tests however large the belt, and each visible run of cells is one draw.
+class AsteroidBelt
+{
+public:
+    // GM of the sun in scene units: with 1 AU = 2.5 units this gives Earth an
+    // angular speed of 1 rad/sec, matching the planet table in main()
+    static constexpr float SUN_GM = 15.625f;
+    static constexpr float INNER_RADIUS = 5.5f;
+    static constexpr float OUTER_RADIUS = 8.0f;
+    static constexpr float MAX_SCALE = 0.0375f;
+    static const unsigned int GRID_SECTORS = 64;
+    static const unsigned int GRID_BANDS = 4;
+    static constexpr float TIME_SPAN = 256.0f; // sim seconds per BeltTime::spans, a power of two
+
+    BeltMode mode = BELT_GPU_ORBIT;
+    uint32_t seed = 1; // generate() builds the same belt for the same seed and count
+
+    unsigned int VAO = 0;
+    unsigned int instanceVBO = 0;
+    unsigned int orbitVAO = 0;
+    unsigned int elementsVBO = 0;
+    unsigned int streamVAO = 0;   // BELT_CPU_ORBIT: the instance attributes on streamedModels
+    DynamicBuffer streamedModels; // a model matrix per rock and frame
+    std::vector<AsteroidElements> elements;
+    std::vector<glm::mat4> instanceModels;
+    std::vector<BeltCell> cells; // sector-major, so neighbouring sectors are adjacent in memory
+    glm::mat4* mappedModels = NULL; // this frame's segment of streamedModels while a CPU orbit update runs
+
+    // build the VAOs around an existing sphere mesh (SphereVertex)
+    void setup(unsigned int meshVBO, unsigned int meshEBO)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &instanceVBO);
+        glGenVertexArrays(1, &orbitVAO);
+        glGenBuffers(1, &elementsVBO);
+        glGenVertexArrays(1, &streamVAO);
+        streamedModels.setup(GL_ARRAY_BUFFER, sizeof(glm::mat4));
+
+        // static belt: instance model matrix, one vec4 column per attribute slot (3..6)
+        glBindVertexArray(VAO);
+        SphereLOD::setupAttributes(meshVBO, meshEBO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(i * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(3 + i);
+            glVertexAttribDivisor(3 + i, 1);
+        }
+
+        // orbiting belt: (radius, phase, inclination, angularSpeed) + (ascendingNode, scale)
+        glBindVertexArray(orbitVAO);
+        SphereLOD::setupAttributes(meshVBO, meshEBO);
+        glBindBuffer(GL_ARRAY_BUFFER, elementsVBO);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(AsteroidElements), (void*)0);
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(AsteroidElements), (void*)(4 * sizeof(float)));
+        glEnableVertexAttribArray(4);
+        glVertexAttribDivisor(4, 1);
+
+        // CPU orbits: the same matrix attributes, pointed at the frame's segment by finishUpdate()
+        glBindVertexArray(streamVAO);
+        SphereLOD::setupAttributes(meshVBO, meshEBO);
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            glEnableVertexAttribArray(3 + i);
+            glVertexAttribDivisor(3 + i, 1);
+        }
+
+        glBindVertexArray(0);
+    }
+
+    // (re)generate the belt with the given number of rocks and upload both representations
+    void generate(unsigned int count)
+    {
+        elements.clear();
+        elements.reserve(count);
+        uint32_t state = seed ? seed : 1; // xorshift never leaves 0
+        for (unsigned int i = 0; i < count; ++i) {
+            AsteroidElements e;
+            e.phase = ((float)i / count) * glm::two_pi<float>();
+            e.radius = INNER_RADIUS + random01(state) * (OUTER_RADIUS - INNER_RADIUS);
+            // +-0.02 rad keeps the belt about as thick as the old +-0.125 height jitter
+            e.inclination = (random01(state) - 0.5f) * 0.04f;
+            e.ascendingNode = random01(state) * glm::two_pi<float>();
+            e.angularSpeed = sqrt(SUN_GM / (e.radius * e.radius * e.radius));
+            e.scale = 0.02f + random01(state) * (MAX_SCALE - 0.02f);
+            elements.push_back(e);
+        }
+        sortIntoGrid();
+
+        // the static belt is the orbiting belt frozen at t = 0
+        instanceModels.clear();
+        instanceModels.reserve(count);
+        for (unsigned int i = 0; i < count; ++i)
+            instanceModels.push_back(modelAt(elements[i], BeltTime()));
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instanceModels.size() * sizeof(glm::mat4), instanceModels.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, elementsVBO);
+        glBufferData(GL_ARRAY_BUFFER, elements.size() * sizeof(AsteroidElements), elements.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // the sim time for the orbit shaders' uniforms, positionAt() and beginUpdate()
+    static BeltTime orbitTime(double time)
+    {
+        double spans = std::floor(time / TIME_SPAN);
+        BeltTime t;
+        t.spans = static_cast<unsigned int>(static_cast<int64_t>(spans)); // wraps like the shaders' uint
+        t.offset = static_cast<float>(time - spans * TIME_SPAN);
+        return t;
+    }
+
+    // e.phase + e.angularSpeed * time, as precise in float at any time: per
+    // span the orbit turns whole turns, which drop out, plus a fraction; held
+    // in 32-bit fixed point, the fraction times the spans wraps at whole turns
+    // exactly. Keep in sync with 6.asteroid_orbit.vs and 6.belt_cull.cs
+    static float orbitAngle(const AsteroidElements& e, const BeltTime& time)
+    {
+        float turnsPerSecond = e.angularSpeed * (1.0f / glm::two_pi<float>());
+        float spanTurns = turnsPerSecond * TIME_SPAN;
+        unsigned int startTurns = static_cast<unsigned int>((spanTurns - std::floor(spanTurns)) * 4294967296.0f) * time.spans;
+        float turns = startTurns * (1.0f / 4294967296.0f) + turnsPerSecond * time.offset;
+        return e.phase + glm::two_pi<float>() * (turns - std::floor(turns));
+    }
+
+    // CPU reference of the position 6.asteroid_orbit.vs computes
+    static glm::vec3 positionAt(const AsteroidElements& e, const BeltTime& time)
+    {
+        float angle = orbitAngle(e, time);
+        float x = cos(angle) * e.radius;
+        float z = sin(angle) * e.radius;
+        // tilt around the X axis, then turn the line of nodes around Y
+        float y = -z * sin(e.inclination);
+        z = z * cos(e.inclination);
+        float cn = cos(e.ascendingNode), sn = sin(e.ascendingNode);
+        return glm::vec3(cn * x + sn * z, y, -sn * x + cn * z);
+    }
+
+    // derivative of positionAt, the starting velocity of the N-body mode
+    static glm::vec3 velocityAt(const AsteroidElements& e, const BeltTime& time)
+    {
+        float angle = orbitAngle(e, time);
+        float vx = -sin(angle) * e.radius * e.angularSpeed;
+        float vz = cos(angle) * e.radius * e.angularSpeed;
+        float vy = -vz * sin(e.inclination);
+        vz = vz * cos(e.inclination);
+        float cn = cos(e.ascendingNode), sn = sin(e.ascendingNode);
+        return glm::vec3(cn * vx + sn * vz, vy, -sn * vx + cn * vz);
+    }
+
+    static glm::mat4 modelAt(const AsteroidElements& e, const BeltTime& time)
+    {
+        glm::mat4 model(e.scale);
+        model[3] = glm::vec4(positionAt(e, time), 1.0f);
+        return model;
+    }
+
+    // switch animation mode; the static matrices are never overwritten, so nothing is restored
+    void setMode(BeltMode newMode)
+    {
+        mode = newMode;
+    }
+
+    // BELT_CPU_ORBIT: take the next segment of the instance ring and queue jobs
+    // that fill it for the given time. The GL thread is free until
+    // finishUpdate(), which must run before draw().
+    void beginUpdate(JobSystem& jobs, JobSystem::Counter& counter, const BeltTime& time)
+    {
+        if (!mapInstances())
+            return;
+        glm::mat4* out = mappedModels;
+        const AsteroidElements* in = elements.data();
+        jobs.parallelFor(counter, elements.size(), 4096, [out, in, time](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                out[i] = modelAt(in[i], time);
+        });
+    }
+
+    // the same for the N-body mode: place every rock alpha of the way from its
+    // previous to its current simulated position
+    void beginUpdate(JobSystem& jobs, JobSystem::Counter& counter, const glm::vec3* previous, const glm::vec3* current, float alpha)
+    {
+        if (!mapInstances())
+            return;
+        glm::mat4* out = mappedModels;
+        const AsteroidElements* in = elements.data();
+        jobs.parallelFor(counter, elements.size(), 4096, [out, in, previous, current, alpha](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                glm::mat4 model(in[i].scale);
+                model[3] = glm::vec4(glm::mix(previous[i], current[i], alpha), 1.0f);
+                out[i] = model;
+            }
+        });
+    }
+
+    // BELT_STATIC only: instanced draws of the cells that touch the frustum,
+    // merging runs of visible cells; returns the number of rocks drawn
+    unsigned int drawVisible(const SphereLOD& lod, unsigned int level, const Frustum& frustum) const
+    {
+        unsigned int drawn = 0;
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        size_t c = 0;
+        while (c < cells.size())
+        {
+            if (!cells[c].count || !frustum.intersectsSphere(cells[c].center, cells[c].radius))
+            {
+                ++c;
+                continue;
+            }
+            unsigned int first = cells[c].first;
+            unsigned int count = 0;
+            while (c < cells.size() && (!cells[c].count || frustum.intersectsSphere(cells[c].center, cells[c].radius)))
+                count += cells[c++].count;
+            // no base instance in 3.3: point the instance attributes at the run instead
+            setInstanceOffset(first);
+            lod.drawInstanced(level, count);
+            drawn += count;
+        }
+        setInstanceOffset(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return drawn;
+    }
+
+    void finishUpdate(JobSystem& jobs, JobSystem::Counter& counter)
+    {
+        jobs.wait(counter);
+        if (!mappedModels)
+            return;
+        streamedModels.end();
+        glBindVertexArray(streamVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, streamedModels.buffer);
+        size_t base = streamedModels.offset();
+        for (unsigned int i = 0; i < 4; ++i)
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(base + i * sizeof(glm::vec4)));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        mappedModels = NULL;
+    }
+
+    unsigned int count() const
+    {
+        return static_cast<unsigned int>(elements.size());
+    }
+
+    // distance from a point to the closest rock the belt could hold, used to
+    // pick one mesh level for the whole belt
+    static float nearestDistance(const glm::vec3& point)
+    {
+        float rho = sqrt(point.x * point.x + point.z * point.z);
+        float dr = 0.0f;
+        if (rho < INNER_RADIUS)
+            dr = INNER_RADIUS - rho;
+        else if (rho > OUTER_RADIUS)
+            dr = rho - OUTER_RADIUS;
+        return sqrt(dr * dr + point.y * point.y);
+    }
+
+    void draw(const SphereLOD& lod, unsigned int level) const
+    {
+        if (elements.empty())
+            return;
+        glBindVertexArray(mode == BELT_GPU_ORBIT ? orbitVAO : mode == BELT_CPU_ORBIT ? streamVAO : VAO);
+        lod.drawInstanced(level, count());
+    }
+
+    void release()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteVertexArrays(1, &orbitVAO);
+        glDeleteVertexArrays(1, &streamVAO);
+        glDeleteBuffers(1, &instanceVBO);
+        glDeleteBuffers(1, &elementsVBO);
+        streamedModels.release();
+        VAO = orbitVAO = streamVAO = instanceVBO = elementsVBO = 0;
+    }
+
+private:
+    // uniform in [0, 1) from a 32-bit xorshift, the same on every platform (unlike rand())
+    static float random01(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static void setInstanceOffset(unsigned int first)
+    {
+        for (unsigned int i = 0; i < 4; ++i)
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)((first * 4 + i) * sizeof(glm::vec4)));
+    }
+
+    // reorder elements by grid cell of their t = 0 position and bound every cell
+    void sortIntoGrid()
+    {
+        const unsigned int cellCount = GRID_SECTORS * GRID_BANDS;
+        std::vector<unsigned int> cellOf(elements.size());
+        std::vector<unsigned int> offsets(cellCount + 1, 0);
+        for (size_t i = 0; i < elements.size(); ++i)
+        {
+            glm::vec3 p = positionAt(elements[i], BeltTime());
+            float angle = atan2(p.z, p.x) + glm::pi<float>();
+            unsigned int sector = std::min(GRID_SECTORS - 1, static_cast<unsigned int>(angle / glm::two_pi<float>() * GRID_SECTORS));
+            float band01 = (elements[i].radius - INNER_RADIUS) / (OUTER_RADIUS - INNER_RADIUS);
+            unsigned int band = std::min(GRID_BANDS - 1, static_cast<unsigned int>(std::max(band01, 0.0f) * GRID_BANDS));
+            cellOf[i] = sector * GRID_BANDS + band;
+            ++offsets[cellOf[i] + 1];
+        }
+        for (unsigned int c = 0; c < cellCount; ++c)
+            offsets[c + 1] += offsets[c];
+
+        cells.assign(cellCount, BeltCell());
+        for (unsigned int c = 0; c < cellCount; ++c)
+        {
+            cells[c].first = offsets[c];
+            cells[c].count = offsets[c + 1] - offsets[c];
+        }
+        std::vector<AsteroidElements> sorted(elements.size());
+        for (size_t i = 0; i < elements.size(); ++i)
+            sorted[offsets[cellOf[i]]++] = elements[i];
+        elements.swap(sorted);
+
+        for (unsigned int c = 0; c < cellCount; ++c)
+        {
+            BeltCell& cell = cells[c];
+            if (!cell.count)
+            {
+                cell.center = glm::vec3(0.0f);
+                cell.radius = 0.0f;
+                continue;
+            }
+            glm::vec3 lo(1e30f), hi(-1e30f);
+            for (unsigned int i = cell.first; i < cell.first + cell.count; ++i)
+            {
+                glm::vec3 p = positionAt(elements[i], BeltTime());
+                lo = glm::min(lo, p);
+                hi = glm::max(hi, p);
+            }
+            cell.center = 0.5f * (lo + hi);
+            cell.radius = 0.5f * glm::length(hi - lo) + MAX_SCALE;
+        }
+    }
+
+    bool mapInstances()
+    {
+        if (elements.empty())
+            return false;
+        mappedModels = static_cast<glm::mat4*>(streamedModels.begin(elements.size() * sizeof(glm::mat4)));
+        return mappedModels != NULL;
+    }
+};
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader_m.h>
+
+#include "body_store.h"
+#include "job_system.h"
+#include "orbit_kernel.h"
+#include "sphere_lod.h"
+#include "uniform_buffers.h"
+#include "uniform_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// GPU time in milliseconds of `frames` frames of `drawsPerFrame` sphere draws
+// with rasterization discarded, so only the vertex stage is measured.
+// The program must declare model and (optionally) normalMatrix.
+inline double timeVertexStage(Shader& shader, unsigned int vao, const SphereLOD& lod, unsigned int level,
+    unsigned int drawsPerFrame, unsigned int frames)
+{
+    UniformCache uniforms(shader.ID);
+    int modelLocation = uniforms["model"];
+    int normalMatrixLocation = uniforms["normalMatrix"];
+
+    shader.use();
+    glBindVertexArray(vao);
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    unsigned int query;
+    glGenQueries(1, &query);
+    GLuint64 totalNs = 0;
+    for (unsigned int frame = 0; frame < frames; ++frame)
+    {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        for (unsigned int i = 0; i < drawsPerFrame; ++i)
+        {
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3((float)i, 0.0f, 0.0f));
+            model = glm::rotate(model, (float)i, glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::scale(model, glm::vec3(0.5f));
+            UniformCache::set(modelLocation, model);
+            UniformCache::set(normalMatrixLocation, glm::transpose(glm::inverse(glm::mat3(model))));
+            lod.draw(level);
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        if (frame > 0) // the first frame pays for shader warm-up
+            totalNs += elapsed;
+    }
+    glDeleteQueries(1, &query);
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    return frames > 1 ? totalNs / 1.0e6 / (frames - 1) : 0.0;
+}
+
+// --bench-normals: per-vertex inverse(model) against the CPU normal matrix uniform
+inline void runNormalMatrixBenchmark(unsigned int vao, const SphereLOD& lod)
+{
+    const unsigned int drawsPerFrame = 210; // planets + moon + 200 asteroids
+    const unsigned int frames = 101;
+
+    Shader perVertexShader("6.multiple_lights_inverse.vs", "6.multiple_lights.fs");
+    Shader uniformShader("6.multiple_lights.vs", "6.multiple_lights.fs");
+    UniformBuffers::bindProgram(perVertexShader.ID);
+    UniformBuffers::bindProgram(uniformShader.ID);
+
+    std::cout << "Normal matrix benchmark: " << drawsPerFrame << " draws/frame, vertex stage only" << std::endl;
+    for (unsigned int level = 0; level < SphereLOD::LEVEL_COUNT; ++level)
+    {
+        double perVertex = timeVertexStage(perVertexShader, vao, lod, level, drawsPerFrame, frames);
+        double uniform = timeVertexStage(uniformShader, vao, lod, level, drawsPerFrame, frames);
+        std::cout << "  " << lod.levels[level].sectorCount << " sectors: per-vertex inverse "
+            << perVertex << " ms, CPU normal matrix " << uniform << " ms ("
+            << (uniform > 0.0 ? perVertex / uniform : 0.0) << "x), " << lod.levels[level].cacheMissRatio
+            << " vertices/triangle" << std::endl;
+    }
+
+    glDeleteProgram(perVertexShader.ID);
+    glDeleteProgram(uniformShader.ID);
+}
+
+// the per-body glm chain BodyStore::update used before the batched kernels,
+// on the same wrapped angles
+inline void updateBodiesGlm(BodyStore& bodies, double time)
+{
+    for (size_t i = 0; i < bodies.count(); ++i)
+    {
+        float angle = orbit_kernel::wrappedAngle(time, bodies.orbitSpeed[i]);
+        bodies.orbitAngle[i] = angle;
+        glm::vec3 offset(cos(angle) * bodies.orbitRadius[i], 0.0f, sin(angle) * bodies.orbitRadius[i]);
+        int parent = bodies.parent[i];
+        bodies.worldPosition[i] = parent >= 0 ? bodies.worldPosition[parent] + offset : offset;
+
+        glm::mat4 spin = glm::rotate(glm::mat4(1.0f), orbit_kernel::wrappedAngle(time, bodies.selfRotateSpeed[i]), glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 m = glm::translate(glm::mat4(1.0f), bodies.worldPosition[i]) * spin;
+        bodies.model[i] = glm::scale(m, glm::vec3(bodies.size[i]));
+        bodies.normalMatrix[i] = glm::mat3(spin);
+    }
+}
+
+// average milliseconds per call of update(bodies, time) over a few sim times
+template <typename Update>
+inline double timeBodyUpdate(BodyStore& bodies, unsigned int iterations, Update update)
+{
+    update(bodies, 0.0); // touch every page once
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < iterations; ++i)
+        update(bodies, 10.0 + i * 0.016);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+inline float maxMatrixDifference(const std::vector<glm::mat4>& a, const std::vector<glm::mat4>& b)
+{
+    float maxError = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i)
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                maxError = std::max(maxError, std::fabs(a[i][c][r] - b[i][c][r]));
+    return maxError;
+}
+
+// --bench-kernel: batched orbit kernel against the glm path at 1k, 100k and 1M bodies,
+// single-threaded and on the job system
+inline void runOrbitKernelBenchmark(JobSystem& jobs)
+{
+    const double LARGE_TIME = 3.6e6; // sim seconds
+    const size_t sizes[] = { 1000, 100000, 1000000 };
+    std::cout << "Orbit kernel benchmark (" << orbit_kernel::instructionSet() << ", "
+        << jobs.threadCount() << " threads)" << std::endl;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        // a sun, planets around it and one moon out of every four bodies
+        BodyStore bodies;
+        bodies.reserve(sizes[s]);
+        srand(1);
+        for (size_t i = 0; i < sizes[s]; ++i)
+        {
+            CatalogBody body;
+            body.parent = i == 0 ? -1 : (i % 4 == 3 ? static_cast<int>(i) - 1 : 0);
+            body.orbitRadius = body.parent == 0 ? 2.0f + (rand() % 1000) * 0.01f : 0.3f;
+            body.orbitSpeed = (rand() % 1000) * 0.002f;
+            body.selfRotateSpeed = (rand() % 1000) * 0.01f;
+            body.size = 0.05f + (rand() % 100) * 0.001f;
+            body.color = glm::vec3(1.0f);
+            bodies.add(body, 0);
+        }
+
+        unsigned int iterations = static_cast<unsigned int>(std::max<size_t>(5, 20000000 / sizes[s] / 10));
+        double glmMs = timeBodyUpdate(bodies, iterations, updateBodiesGlm);
+        std::vector<glm::mat4> reference = bodies.model;
+        double kernelMs = timeBodyUpdate(bodies, iterations, [](BodyStore& b, double t) { b.update(t); });
+        double parallelMs = timeBodyUpdate(bodies, iterations, [&jobs](BodyStore& b, double t) { b.update(t, jobs); });
+
+        // every path ended on the same sim time, compare the last one against glm;
+        // then again an hour into a 1000x fast-forward, where unwrapped float
+        // angles would be off by radians
+        float maxError = maxMatrixDifference(bodies.model, reference);
+        updateBodiesGlm(bodies, LARGE_TIME);
+        reference = bodies.model;
+        bodies.update(LARGE_TIME, jobs);
+        float largeTimeError = maxMatrixDifference(bodies.model, reference);
+
+        std::cout << "  " << sizes[s] << " bodies: glm " << glmMs << " ms, kernel " << kernelMs << " ms ("
+            << (kernelMs > 0.0 ? glmMs / kernelMs : 0.0) << "x), parallel " << parallelMs << " ms ("
+            << (parallelMs > 0.0 ? glmMs / parallelMs : 0.0) << "x), max matrix difference " << maxError
+            << " (" << largeTimeError << " at t = " << LARGE_TIME << ")" << std::endl;
+    }
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef BODY_BATCH_H
+#define BODY_BATCH_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "body_store.h"
+#include "dynamic_buffer.h"
+#include "sphere_lod.h"
+
+#include <algorithm>
+#include <vector>
+
+// Per-instance data of 6.multiple_lights_bodies.vs (locations 3..10)
+struct BodyInstance {
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+    int layer; // texture array layer
+};
+
+// The visible bodies drawn with one instanced call per sphere level of detail
+// instead of one draw, and one texture bind, per body. The frame's instances
+// are grouped by level into a segment of a mapped ring (DynamicBuffer); GL 3.3
+// has no base instance, so the instance attributes are re-pointed at each
+// level's run, as the static belt does for its grid cells.
+class BodyBatch
+{
+public:
+    unsigned int VAO = 0;
+    DynamicBuffer instances; // a segment per draw(), which runs once per pass (two with the depth pre-pass)
+
+    // build the VAO around an existing sphere mesh (SphereVertex)
+    void setup(unsigned int meshVBO, unsigned int meshEBO)
+    {
+        glGenVertexArrays(1, &VAO);
+        instances.setup(GL_ARRAY_BUFFER, 64 * sizeof(BodyInstance), DynamicBuffer::FRAMES * 2);
+        glBindVertexArray(VAO);
+        SphereLOD::setupAttributes(meshVBO, meshEBO);
+        for (unsigned int i = 3; i <= 10; ++i)
+        {
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // queue body i of the store at the given level of detail for this frame
+    void add(const BodyStore& bodies, size_t i, unsigned int level)
+    {
+        BodyInstance instance;
+        instance.model = bodies.model[i];
+        instance.normalMatrix = bodies.normalMatrix[i];
+        instance.layer = bodies.textureLayer[i];
+        queued[level].push_back(instance);
+    }
+
+    // draw and clear the queued bodies; the current program must be
+    // 6.multiple_lights_bodies.vs with the texture array bound
+    void draw(const SphereLOD& lod)
+    {
+        unsigned int first[SphereLOD::LEVEL_COUNT];
+        unsigned int total = 0;
+        for (unsigned int l = 0; l < SphereLOD::LEVEL_COUNT; ++l)
+        {
+            first[l] = total;
+            total += static_cast<unsigned int>(queued[l].size());
+        }
+        if (total == 0)
+            return;
+        BodyInstance* out = static_cast<BodyInstance*>(instances.begin(total * sizeof(BodyInstance)));
+        if (!out)
+        {
+            for (unsigned int l = 0; l < SphereLOD::LEVEL_COUNT; ++l)
+                queued[l].clear();
+            return;
+        }
+        for (unsigned int l = 0; l < SphereLOD::LEVEL_COUNT; ++l)
+            std::copy(queued[l].begin(), queued[l].end(), out + first[l]);
+        instances.end();
+
+        glBindBuffer(GL_ARRAY_BUFFER, instances.buffer);
+        glBindVertexArray(VAO);
+        for (unsigned int l = 0; l < SphereLOD::LEVEL_COUNT; ++l)
+        {
+            if (queued[l].empty())
+                continue;
+            pointInstances(first[l]);
+            lod.drawInstanced(l, static_cast<unsigned int>(queued[l].size()));
+            queued[l].clear();
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void release()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        instances.release();
+        VAO = 0;
+    }
+
+private:
+    std::vector<BodyInstance> queued[SphereLOD::LEVEL_COUNT];
+
+    // instance attributes starting at instance `first` of the segment
+    void pointInstances(unsigned int first)
+    {
+        size_t base = instances.offset() + first * sizeof(BodyInstance);
+        for (unsigned int i = 0; i < 4; ++i)
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(base + i * sizeof(glm::vec4)));
+        for (unsigned int i = 0; i < 3; ++i)
+            glVertexAttribPointer(7 + i, 3, GL_FLOAT, GL_FALSE, sizeof(BodyInstance),
+                (void*)(base + sizeof(glm::mat4) + i * sizeof(glm::vec3)));
+        glVertexAttribIPointer(10, 1, GL_INT, sizeof(BodyInstance), (void*)(base + sizeof(glm::mat4) + sizeof(glm::mat3)));
+    }
+};
+
+#endif
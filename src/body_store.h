@@ -0,0 +1,205 @@
+#ifndef BODY_STORE_H
+#define BODY_STORE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "catalog.h"
+#include "job_system.h"
+#include "orbit_kernel.h"
+
+#include <string>
+#include <vector>
+
+// Structure-of-arrays store of every body in the scene. Bodies are kept in
+// topological order (parent index < own index), so one forward pass computes
+// every world transform; the renderer and the camera only read the results.
+// The model matrices are in render space: rebase() moves their translations
+// from the double world positions to the camera, so floats only ever hold
+// what is small around the viewer (camera-relative rendering).
+class BodyStore
+{
+public:
+    // description, from the catalog
+    std::vector<std::string> name;
+    std::vector<int> parent;           // -1 for the root
+    std::vector<float> orbitRadius;
+    std::vector<float> orbitSpeed;     // radians/sec
+    std::vector<float> selfRotateSpeed; // radians/sec
+    std::vector<float> size;
+    std::vector<float> mass;           // GM, 0 if the catalog leaves it out
+    std::vector<glm::vec3> color;
+    std::vector<unsigned int> texture;
+    std::vector<int> virtualTexture;   // index into the scene's virtual textures, -1 for none
+    std::vector<int> textureLayer;     // layer of the body texture array, -1 for none
+    std::vector<char> emissive;        // 1: drawn unlit (the UNLIT shader variant)
+
+    // per-frame state, written by update()
+    std::vector<float> orbitAngle;             // wrapped to [0, 2pi)
+    std::vector<glm::vec3> worldPosition;
+    std::vector<glm::dvec3> position;  // world position summed in double; worldPosition is it in float
+    std::vector<glm::mat4> model;      // translation relative to the last rebase() origin
+    std::vector<glm::mat3> normalMatrix;
+
+    // parent-relative orbit offsets, scratch for update()
+    std::vector<float> offsetX;
+    std::vector<float> offsetZ;
+
+    size_t count() const
+    {
+        return parent.size();
+    }
+
+    void clear()
+    {
+        name.clear();
+        parent.clear();
+        orbitRadius.clear();
+        orbitSpeed.clear();
+        selfRotateSpeed.clear();
+        size.clear();
+        mass.clear();
+        color.clear();
+        texture.clear();
+        virtualTexture.clear();
+        textureLayer.clear();
+        emissive.clear();
+        orbitAngle.clear();
+        worldPosition.clear();
+        position.clear();
+        model.clear();
+        normalMatrix.clear();
+        offsetX.clear();
+        offsetZ.clear();
+    }
+
+    void reserve(size_t n)
+    {
+        name.reserve(n);
+        parent.reserve(n);
+        orbitRadius.reserve(n);
+        orbitSpeed.reserve(n);
+        selfRotateSpeed.reserve(n);
+        size.reserve(n);
+        mass.reserve(n);
+        color.reserve(n);
+        texture.reserve(n);
+        virtualTexture.reserve(n);
+        textureLayer.reserve(n);
+        emissive.reserve(n);
+        orbitAngle.reserve(n);
+        worldPosition.reserve(n);
+        position.reserve(n);
+        model.reserve(n);
+        normalMatrix.reserve(n);
+        offsetX.reserve(n);
+        offsetZ.reserve(n);
+    }
+
+    // append a body; its parent must already be in the store
+    int add(const CatalogBody& body, unsigned int textureID)
+    {
+        int index = static_cast<int>(count());
+        name.push_back(body.name);
+        parent.push_back(body.parent < index ? body.parent : -1);
+        orbitRadius.push_back(body.orbitRadius);
+        orbitSpeed.push_back(body.orbitSpeed);
+        selfRotateSpeed.push_back(body.selfRotateSpeed);
+        size.push_back(body.size);
+        mass.push_back(body.mass);
+        color.push_back(body.color);
+        texture.push_back(textureID);
+        virtualTexture.push_back(-1);
+        textureLayer.push_back(-1);
+        emissive.push_back(body.emissive ? 1 : 0);
+        orbitAngle.push_back(0.0f);
+        worldPosition.push_back(glm::vec3(0.0f));
+        position.push_back(glm::dvec3(0.0));
+        model.push_back(glm::mat4(1.0f));
+        normalMatrix.push_back(glm::mat3(1.0f));
+        offsetX.push_back(0.0f);
+        offsetZ.push_back(0.0f);
+        return index;
+    }
+
+    // the transform pass of the frame: orbit angle, world position,
+    // model matrix (translate * spin * uniform scale) and normal matrix.
+    // The trigonometry and matrix packing run in the batched kernels; only
+    // adding the parent positions is a sequential walk. Each offset is float,
+    // precise relative to its own radius. They are summed in double, so a
+    // moon's offset keeps that precision on top of a true-scale planet's
+    // position, which the follow camera and rebase() read. Culling and level
+    // selection read the same position in float.
+    void update(double time)
+    {
+        const size_t n = count();
+        orbit_kernel::orbitOffsets(orbitRadius.data(), orbitSpeed.data(), time,
+            orbitAngle.data(), offsetX.data(), offsetZ.data(), n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            glm::dvec3 offset(offsetX[i], 0.0, offsetZ[i]);
+            position[i] = parent[i] >= 0 ? position[parent[i]] + offset : offset;
+            worldPosition[i] = glm::vec3(position[i]);
+        }
+        // the inverse transpose of a rotation times a uniform scale is the rotation
+        // (up to a factor the fragment shader normalizes away)
+        orbit_kernel::modelMatrices(selfRotateSpeed.data(), size.data(), worldPosition.data(), time,
+            model.data(), normalMatrix.data(), n);
+    }
+
+    // the same pass split into chunks on the job system. Positions are summed
+    // up each body's own ancestor chain instead of reading the parent's
+    // result, so no chunk waits for another; chains are short (sun, planet, moon).
+    void update(double time, JobSystem& jobs)
+    {
+        const size_t n = count();
+        if (n < PARALLEL_GRAIN || jobs.threadCount() < 2)
+        {
+            update(time);
+            return;
+        }
+        jobs.parallelFor(n, PARALLEL_GRAIN, [this, time](size_t begin, size_t end) {
+            orbit_kernel::orbitOffsets(orbitRadius.data() + begin, orbitSpeed.data() + begin, time,
+                orbitAngle.data() + begin, offsetX.data() + begin, offsetZ.data() + begin, end - begin);
+        });
+        jobs.parallelFor(n, PARALLEL_GRAIN, [this, time](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                glm::dvec3 sum(offsetX[i], 0.0, offsetZ[i]);
+                for (int p = parent[i]; p >= 0; p = parent[p])
+                    sum += glm::dvec3(offsetX[p], 0.0, offsetZ[p]);
+                position[i] = sum;
+                worldPosition[i] = glm::vec3(sum);
+            }
+            orbit_kernel::modelMatrices(selfRotateSpeed.data() + begin, size.data() + begin, worldPosition.data() + begin,
+                time, model.data() + begin, normalMatrix.data() + begin, end - begin);
+        });
+    }
+
+    // model and normal matrices only, for positions written by someone else
+    // (N-body mode); the integrator is float, so position just follows them
+    void updateMatrices(double time, JobSystem& jobs)
+    {
+        jobs.parallelFor(count(), PARALLEL_GRAIN, [this, time](size_t begin, size_t end) {
+            orbit_kernel::modelMatrices(selfRotateSpeed.data() + begin, size.data() + begin, worldPosition.data() + begin,
+                time, model.data() + begin, normalMatrix.data() + begin, end - begin);
+            for (size_t i = begin; i < end; ++i)
+                position[i] = glm::dvec3(worldPosition[i]);
+        });
+    }
+
+    // move the model matrices' translations to be relative to origin (the
+    // camera's world position); call after the positions are final
+    void rebase(const glm::dvec3& origin, JobSystem& jobs)
+    {
+        jobs.parallelFor(count(), PARALLEL_GRAIN, [this, origin](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                model[i][3] = glm::vec4(glm::vec3(position[i] - origin), 1.0f);
+        });
+    }
+
+private:
+    static const size_t PARALLEL_GRAIN = 16384; // bodies per job, below this one thread wins
+};
+
+#endif
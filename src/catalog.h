@@ -0,0 +1,165 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <glm/glm.hpp>
+
+#include "json.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// One body as described in a catalog file. parent is an index into
+// Catalog::bodies (-1 for a root) and always smaller than the body's own index.
+struct CatalogBody {
+    std::string name;
+    int parent = -1;
+    float orbitRadius = 0.0f;
+    float orbitSpeed = 0.0f;      // radians/sec
+    float selfRotateSpeed = 0.0f; // radians/sec
+    float size = 0.1f;
+    float mass = 0.0f;            // GM for the N-body mode, 0 = derive from the moons' orbits
+    glm::vec3 color = glm::vec3(1.0f);
+    std::string texture;          // file name under resources/textures, may be empty
+    std::string virtualTexture; // optional high resolution map under resources/textures, streamed as tiles once baked
+    bool emissive = false;        // a star: drawn in its texture's colour, unlit
+};
+
+struct Catalog {
+    std::vector<CatalogBody> bodies;
+    int followBody = 0; // body the camera starts on
+};
+
+// Catalog files are JSON:
+// {
+//   "follow": "Earth",
+//   "bodies": [
+//     { "name": "Sun", "size": 0.625, "selfRotateSpeed": 0.5, "texture": "sun.jpg" },
+//     { "name": "Earth", "parent": "Sun", "orbitRadius": 2.5, "orbitSpeed": 1.0, ... },
+//     ...
+//   ]
+// }
+// Parents are referenced by name and may appear anywhere in the list; bodies
+// are reordered so every parent comes before its children.
+inline bool loadCatalog(const std::string& path, Catalog& catalog, std::string& error)
+{
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+
+    JsonValue root;
+    if (!JsonParser::parse(buffer.str(), root, error))
+        return false;
+    const JsonValue* bodies = root.find("bodies");
+    if (!bodies || !bodies->isArray())
+    {
+        error = "missing \"bodies\" array";
+        return false;
+    }
+
+    // read entries in file order, parents still by name
+    std::vector<CatalogBody> entries;
+    std::vector<std::string> parentNames;
+    std::unordered_map<std::string, int> byName;
+    entries.reserve(bodies->array.size());
+    parentNames.reserve(bodies->array.size());
+    byName.reserve(bodies->array.size());
+    for (size_t i = 0; i < bodies->array.size(); ++i)
+    {
+        const JsonValue& entry = bodies->array[i];
+        if (!entry.isObject())
+        {
+            error = "body " + std::to_string(i) + " is not an object";
+            return false;
+        }
+        CatalogBody body;
+        body.name = entry.getString("name", "body" + std::to_string(i));
+        body.parent = -1;
+        body.orbitRadius = static_cast<float>(entry.getNumber("orbitRadius", 0.0));
+        body.orbitSpeed = static_cast<float>(entry.getNumber("orbitSpeed", 0.0));
+        body.selfRotateSpeed = static_cast<float>(entry.getNumber("selfRotateSpeed", 0.0));
+        body.size = static_cast<float>(entry.getNumber("size", 0.1));
+        body.mass = static_cast<float>(entry.getNumber("mass", 0.0));
+        body.color = glm::vec3(1.0f);
+        const JsonValue* color = entry.find("color");
+        if (color && color->isArray() && color->array.size() == 3)
+            body.color = glm::vec3((float)color->array[0].number, (float)color->array[1].number, (float)color->array[2].number);
+        body.texture = entry.getString("texture", "");
+        body.virtualTexture = entry.getString("virtualTexture", "");
+        body.emissive = entry.getBool("emissive", false);
+        if (!byName.insert(std::make_pair(body.name, static_cast<int>(entries.size()))).second)
+        {
+            error = "duplicate body name " + body.name;
+            return false;
+        }
+        parentNames.push_back(entry.getString("parent", ""));
+        entries.push_back(std::move(body));
+    }
+
+    // resolve parents
+    std::vector<int> parents(entries.size(), -1);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (parentNames[i].empty())
+            continue;
+        std::unordered_map<std::string, int>::const_iterator it = byName.find(parentNames[i]);
+        if (it == byName.end())
+        {
+            error = entries[i].name + " has unknown parent " + parentNames[i];
+            return false;
+        }
+        parents[i] = it->second;
+    }
+
+    // order parents before children, keeping file order where it already is valid:
+    // every body is emitted right after its not yet emitted ancestors
+    std::vector<int> newIndex(entries.size(), -1);
+    std::vector<int> order;
+    std::vector<int> chain;
+    order.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        chain.clear();
+        int current = static_cast<int>(i);
+        while (current >= 0 && newIndex[current] < 0)
+        {
+            chain.push_back(current);
+            if (chain.size() > entries.size())
+            {
+                error = entries[i].name + " is part of a parent cycle";
+                return false;
+            }
+            current = parents[current];
+        }
+        for (size_t c = chain.size(); c-- > 0;)
+        {
+            newIndex[chain[c]] = static_cast<int>(order.size());
+            order.push_back(chain[c]);
+        }
+    }
+
+    catalog.bodies.clear();
+    catalog.bodies.reserve(entries.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        catalog.bodies.push_back(std::move(entries[order[i]]));
+        catalog.bodies.back().parent = parents[order[i]] >= 0 ? newIndex[parents[order[i]]] : -1;
+    }
+
+    catalog.followBody = catalog.bodies.size() > 1 ? 1 : 0;
+    std::string follow = root.getString("follow", "");
+    std::unordered_map<std::string, int>::const_iterator followIt = byName.find(follow);
+    if (followIt != byName.end())
+        catalog.followBody = newIndex[followIt->second];
+    return true;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef COMPUTE_SHADER_H
+#define COMPUTE_SHADER_H
+
+#include <glad/glad.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Build a program from a single compute shader file (OpenGL 4.3); 0 on failure,
+// with the file name and the driver's log in error.
+inline unsigned int compileComputeProgram(const char* path, std::string& error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = std::string("cannot open ") + path;
+        return 0;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string source = stream.str();
+    const char* code = source.c_str();
+
+    unsigned int shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+    int success = 0;
+    char infoLog[1024];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+        error = std::string(path) + ": " + infoLog;
+        glDeleteShader(shader);
+        return 0;
+    }
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(program, sizeof(infoLog), NULL, infoLog);
+        error = std::string(path) + ": " + infoLog;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+#endif
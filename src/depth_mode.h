@@ -0,0 +1,92 @@
+#ifndef DEPTH_MODE_H
+#define DEPTH_MODE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frustum.h"
+
+#include <cmath>
+
+// How the scene's depth is stored. Standard is the learnopengl default: a
+// 24-bit buffer, depth mapped to [-1, 1] and a 0.1-250 range, which is why the
+// catalog's orbits are compressed. Reversed maps the near plane to 1 and
+// infinity to 0 in a 32-bit float buffer (glClipControl, OpenGL 4.5): the
+// float's exponent then cancels the 1/z of the projection, so the precision
+// stays roughly relative to the distance from the near plane to any distance,
+// and true-scale scenes need neither a far plane nor depth partitioning.
+class DepthMode
+{
+public:
+    static constexpr float NEAR_PLANE = 0.1f;
+    static constexpr float FAR_PLANE = 250.0f;       // standard depth only
+    static constexpr float CLUSTER_FAR = 1.0e5f;     // reversed: light clusters end here, lights are short range
+
+    bool reversed = false;
+
+    static bool supported()
+    {
+        return GLAD_GL_VERSION_4_5 || GLAD_GL_ARB_clip_control;
+    }
+
+    // global depth state; GL_LESS and a clear to 1 are the standard defaults
+    void setup() const
+    {
+        if (!reversed)
+            return;
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepth(0.0);
+        glDepthFunc(GL_GREATER);
+    }
+
+    glm::mat4 projection(float fovY, float aspect) const
+    {
+        if (!reversed)
+            return glm::perspective(fovY, aspect, NEAR_PLANE, FAR_PLANE);
+        // z_clip = near, w_clip = -z_view: depth = near / distance, 1 at the near plane
+        float f = 1.0f / std::tan(0.5f * fovY);
+        glm::mat4 p(0.0f);
+        p[0][0] = f / aspect;
+        p[1][1] = f;
+        p[2][3] = -1.0f;
+        p[3][2] = NEAR_PLANE;
+        return p;
+    }
+
+    // the view frustum for culling; the infinite projection has no far plane,
+    // so the side and near planes come from a finite one (they do not depend
+    // on its far distance) and the far plane passes everything
+    Frustum frustum(float fovY, float aspect, const glm::mat4& view) const
+    {
+        Frustum result(glm::perspective(fovY, aspect, NEAR_PLANE, FAR_PLANE) * view);
+        if (reversed)
+            result.planes[5] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return result;
+    }
+
+    // the depth range the light clusters are sliced over
+    float farPlane() const
+    {
+        return reversed ? CLUSTER_FAR : FAR_PLANE;
+    }
+
+    GLenum depthFormat() const
+    {
+        return reversed ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24;
+    }
+
+    // the depth tests "nearer than" and "nearer or equal"
+    GLenum less() const
+    {
+        return reversed ? GL_GREATER : GL_LESS;
+    }
+
+    GLenum lessEqual() const
+    {
+        return reversed ? GL_GEQUAL : GL_LEQUAL;
+    }
+};
+
+#endif
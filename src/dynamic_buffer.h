@@ -0,0 +1,139 @@
+#ifndef DYNAMIC_BUFFER_H
+#define DYNAMIC_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Data rewritten every frame (instance transforms, the camera block) in a ring
+// of segments of one buffer, persistently and coherently mapped with
+// glBufferStorage (OpenGL 4.4 or ARB_buffer_storage). Each begin() hands out
+// the next segment's pointer, which any thread may write until end(); the
+// draws then read it at offset(). begin() also fences the previous segment's
+// reads and waits on the fence of the one it hands out, which with enough
+// segments for the frames in flight has long been signalled. So nothing is
+// copied and the driver never has to stall or rename a buffer the GPU is
+// still reading, as glBufferData/glBufferSubData on it would. Without buffer
+// storage the buffer is a single segment mapped with INVALIDATE each time.
+class DynamicBuffer
+{
+public:
+    static const unsigned int FRAMES = 3; // frames the GPU may be behind, one segment each
+
+    unsigned int buffer = 0;
+    size_t segmentSize = 0; // bytes, a multiple of the target's offset alignment
+    unsigned int waits = 0; // begin() calls that found the GPU still reading their segment
+
+    static bool persistent()
+    {
+        return GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+    }
+
+    // segments of at least bytes each; begin() is used that many times before a segment comes round again
+    void setup(GLenum bufferTarget, size_t bytes, unsigned int segmentCount = FRAMES)
+    {
+        release();
+        target = bufferTarget;
+        segments = persistent() ? std::max(segmentCount, 1u) : 1u;
+        GLint alignment = 256;
+        if (target == GL_UNIFORM_BUFFER)
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        else if (target == GL_SHADER_STORAGE_BUFFER)
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        size_t align = static_cast<size_t>(std::max(alignment, 256));
+        segmentSize = (std::max<size_t>(bytes, 1) + align - 1) / align * align;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+        if (persistent())
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, segmentSize * segments, NULL, flags);
+            mapped = static_cast<char*>(glMapBufferRange(target, 0, segmentSize * segments, flags));
+        }
+        else
+        {
+            glBufferData(target, segmentSize, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(target, 0);
+        fences.assign(segments, GLsync(0));
+        current = 0;
+    }
+
+    // a pointer to bytes of the next segment, growing the buffer (and
+    // dropping what it held) if they do not fit; NULL if it cannot be mapped
+    void* begin(size_t bytes)
+    {
+        if (!buffer || bytes > segmentSize)
+            setup(target, std::max(bytes, segmentSize * 2), segments);
+        if (!mapped)
+        {
+            glBindBuffer(target, buffer);
+            void* pointer = glMapBufferRange(target, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(target, 0);
+            return pointer;
+        }
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current = (current + 1) % segments;
+        if (fences[current])
+        {
+            GLenum status = glClientWaitSync(fences[current], 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                ++waits;
+                while (status == GL_TIMEOUT_EXPIRED)
+                    status = glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            }
+            glDeleteSync(fences[current]);
+            fences[current] = 0;
+        }
+        return mapped + current * segmentSize;
+    }
+
+    // the writes since begin() are done; on the GL thread, before the draws reading them
+    void end()
+    {
+        if (mapped)
+            return; // coherent: visible to the commands issued from here on
+        glBindBuffer(target, buffer);
+        glUnmapBuffer(target);
+        glBindBuffer(target, 0);
+    }
+
+    // byte offset of the segment of the last begin()
+    size_t offset() const
+    {
+        return current * segmentSize;
+    }
+
+    void release()
+    {
+        for (size_t i = 0; i < fences.size(); ++i)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        }
+        fences.clear();
+        if (mapped)
+        {
+            glBindBuffer(target, buffer);
+            glUnmapBuffer(target);
+            glBindBuffer(target, 0);
+        }
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = NULL;
+        segmentSize = 0;
+    }
+
+private:
+    GLenum target = GL_ARRAY_BUFFER;
+    unsigned int segments = FRAMES;
+    unsigned int current = 0;
+    char* mapped = NULL;
+    std::vector<GLsync> fences; // per segment, after the last reads of it were issued
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Frame pacing against a frame time budget. Frames are presented every
+// swapInterval() display refreshes, the whole number nearest the budget, so
+// their cadence is even; and the scene's resolution follows the GPU time the
+// profiler measures. The fill-bound passes cost about the pixel count, so a
+// frame over budget goes to scale * sqrt(budget / time) of the window's size
+// (RenderTarget in render_target.h draws it and stretches it over the
+// window), and one under budget grows back a step at a time. Scales are
+// multiples of STEP and only change when the time leaves a band below the
+// budget, so the image does not pump between two sizes; and since the GPU
+// times arrive Profiler::QUERY_FRAMES late, the pacer waits that long after
+// a change before it judges again.
+class FramePacer
+{
+public:
+    static constexpr float MIN_SCALE = 0.5f;
+    static constexpr float STEP = 1.0f / 16.0f;
+    static constexpr float LOW_BAND = 0.75f;  // grow below this fraction of the budget
+    static constexpr float HIGH_BAND = 0.9f;  // shrink above it, leaving room for the CPU and the swap
+    static constexpr float SMOOTHING = 0.2f;  // weight of the newest frame in the running mean
+
+    float targetMs = 0.0f; // the budget; 0 keeps the full resolution and the driver's cadence
+    float scale = 1.0f;    // of the window's size in each axis
+
+    bool enabled() const
+    {
+        return targetMs > 0.0f;
+    }
+
+    // display refreshes per frame for the budget
+    static int swapInterval(float targetMs, int refreshHz)
+    {
+        if (targetMs <= 0.0f || refreshHz <= 0)
+            return 1;
+        return std::max(1, static_cast<int>(std::lround(targetMs * refreshHz / 1000.0f)));
+    }
+
+    // once per frame with Profiler::lastGpuFrame()
+    void update(float gpuMs)
+    {
+        if (!enabled() || gpuMs < 0.0f)
+            return;
+        if (cooldown > 0)
+        {
+            --cooldown; // still frames drawn at the previous scale
+            return;
+        }
+        smoothed = smoothed < 0.0f ? gpuMs : smoothed + (gpuMs - smoothed) * SMOOTHING;
+        if (smoothed >= targetMs * LOW_BAND && smoothed <= targetMs * HIGH_BAND)
+            return;
+        float wanted = scale * std::sqrt(targetMs * 0.5f * (LOW_BAND + HIGH_BAND) / std::max(smoothed, 0.01f));
+        wanted = std::min(wanted, scale + STEP); // growing again too fast would overshoot
+        wanted = std::max(MIN_SCALE, std::min(1.0f, std::round(wanted / STEP) * STEP));
+        if (wanted == scale)
+            return;
+        scale = wanted;
+        smoothed = -1.0f;
+        cooldown = Profiler::QUERY_FRAMES + 1;
+    }
+
+    // the scene's size along a window axis
+    int scaled(int windowSize) const
+    {
+        return std::max(1, static_cast<int>(windowSize * scale + 0.5f));
+    }
+
+private:
+    float smoothed = -1.0f; // running mean of the GPU frame time, -1 for none
+    unsigned int cooldown = 0;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+// View frustum as six inward-facing planes (xyz = normal, w = distance),
+// extracted from a projection * view matrix (Gribb & Hartmann).
+struct Frustum {
+    glm::vec4 planes[6]; // left, right, bottom, top, near, far
+
+    Frustum()
+    {
+        for (int i = 0; i < 6; ++i)
+            planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+        glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+        glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+        glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+        planes[0] = row3 + row0;
+        planes[1] = row3 - row0;
+        planes[2] = row3 + row1;
+        planes[3] = row3 - row1;
+        planes[4] = row3 + row2;
+        planes[5] = row3 - row2;
+        // normalized, so plane distances are in world units
+        for (int i = 0; i < 6; ++i)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+
+    // false only if the sphere is entirely outside one plane
+    bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        for (int i = 0; i < 6; ++i)
+        {
+            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+// Render targets of the deferred path: albedo (alpha 0 marks unlit fragments),
+// world space normal and depth, written by the GBUFFER variant of
+// 6.multiple_lights.fs. The DEFERRED_LIGHTING variant then shades every pixel
+// once in a fullscreen pass, so the lights run on visible fragments only
+// however much the belt and the planets overdraw. The lighting pass also
+// writes the stored depth back, so what is drawn forward afterwards (the sun
+// marker, the profiler overlay) is still depth tested against the scene.
+// As with RenderTarget, the storage follows the window's size and dynamic
+// resolution draws into the lower left part only, so it never reallocates.
+class GBuffer
+{
+public:
+    unsigned int FBO = 0;
+    unsigned int albedo = 0;
+    unsigned int normal = 0;
+    unsigned int depth = 0;
+    int width = 0;  // of the storage
+    int height = 0;
+    GLenum depthFormat = GL_DEPTH_COMPONENT24; // DepthMode::depthFormat(), set before the first resize()
+
+    // (re)create the storage when the size changes; false if the framebuffer is incomplete
+    bool resize(int w, int h)
+    {
+        if (FBO && w == width && h == height)
+            return true;
+        releaseTargets();
+        width = w;
+        height = h;
+        if (!FBO)
+        {
+            glGenFramebuffers(1, &FBO);
+            glGenVertexArrays(1, &VAO); // core profile draws need one, even without attributes
+        }
+        albedo = target(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        normal = target(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        depth = target(depthFormat, GL_DEPTH_COMPONENT, depthFormat == GL_DEPTH_COMPONENT32F ? GL_FLOAT : GL_UNSIGNED_INT);
+
+        GLint previous = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normal, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, buffers);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+        return complete;
+    }
+
+    // draw the scene's materials into the lower left w x h (at most the
+    // storage size) of the targets from here to end()
+    void begin(int w, int h)
+    {
+        usedWidth = w < width ? w : width;
+        usedHeight = h < height ? h : height;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, usedWidth, usedHeight);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // back to the framebuffer that was bound at begin(), with the same viewport
+    void end()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    }
+
+    // the part of the storage drawn since begin(), the gBufferScale of the
+    // DEFERRED_LIGHTING variant
+    glm::vec2 usedScale() const
+    {
+        return glm::vec2((float)usedWidth / width, (float)usedHeight / height);
+    }
+
+    // the fullscreen lighting pass with the given program (the targets on
+    // three consecutive units from firstUnit); leaves unit 0 active and the
+    // depth test as it was
+    void light(unsigned int program, unsigned int firstUnit)
+    {
+        GLint depthFunc = GL_LESS;
+        glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+        unsigned int textures[3] = { albedo, normal, depth };
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glUseProgram(program);
+        glDepthFunc(GL_ALWAYS);
+        glBindVertexArray(VAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glDepthFunc(depthFunc);
+    }
+
+    void release()
+    {
+        releaseTargets();
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &VAO);
+        FBO = VAO = 0;
+        width = height = 0;
+    }
+
+private:
+    unsigned int VAO = 0;
+    GLint previousFramebuffer = 0;
+    int usedWidth = 0;
+    int usedHeight = 0;
+
+    unsigned int target(GLenum internalFormat, GLenum format, GLenum type) const
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+
+    void releaseTargets()
+    {
+        glDeleteTextures(1, &albedo);
+        glDeleteTextures(1, &normal);
+        glDeleteTextures(1, &depth);
+        albedo = normal = depth = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "asteroid_belt.h"
+#include "compute_shader.h"
+#include "frustum.h"
+#include "sphere_lod.h"
+#include "uniform_cache.h"
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+// GPU-driven culling of the orbiting belt (OpenGL 4.3). 6.belt_cull.cs places
+// every rock on its orbit, tests it against the frustum and appends the
+// survivors to a compact buffer, counting them in an indirect draw command;
+// glDrawElementsIndirect then draws exactly those, with no read back. Rocks
+// below SphereLOD::impostorRadius on screen go to a second run of the buffer
+// and command instead, drawn as impostors with four vertices each.
+class GpuBeltCuller
+{
+public:
+    static const unsigned int WORKGROUP_SIZE = 256; // local_size_x of the compute shader
+
+    unsigned int program = 0;
+    unsigned int VAO = 0;
+    unsigned int visibleSSBO = 0; // vec4 position + scale per drawn rock, meshes then impostors, binding 1, attributes 3 and 4
+    unsigned int commandBuffer = 0; // Commands, binding 2
+    unsigned int capacity = 0;
+
+    static bool supported()
+    {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+    bool setup(unsigned int meshVBO, unsigned int meshEBO, std::string& error)
+    {
+        program = compileComputeProgram("6.belt_cull.cs", error);
+        if (!program)
+            return false;
+        UniformCache uniforms(program);
+        rockCountLocation = uniforms["rockCount"];
+        timeSpansLocation = uniforms["timeSpans"];
+        timeOffsetLocation = uniforms["timeOffset"];
+        planesLocation = uniforms["planes"];
+        cameraPositionLocation = uniforms["cameraPosition"];
+        pixelScaleLocation = uniforms["pixelScale"];
+        impostorRadiusLocation = uniforms["impostorRadius"];
+
+        glGenBuffers(1, &visibleSSBO);
+        glGenBuffers(1, &commandBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(Commands), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        // drawn with 6.asteroid_particles.vs at alpha 0: the same buffer feeds
+        // both its current and previous position
+        glGenVertexArrays(1, &VAO);
+        glBindVertexArray(VAO);
+        SphereLOD::setupAttributes(meshVBO, meshEBO);
+        glBindBuffer(GL_ARRAY_BUFFER, visibleSSBO);
+        for (unsigned int i = 3; i <= 4; ++i)
+        {
+            glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    // cull the belt at the given time, with one mesh level for the rocks that
+    // are not impostors; drawMeshes() and drawImpostors() must follow
+    void cull(const AsteroidBelt& belt, const BeltTime& time, const Frustum& frustum, const SphereLOD& lod, unsigned int level,
+        const glm::vec3& cameraPosition, float fovY, float viewportHeight)
+    {
+        unsigned int rocks = belt.count();
+        if (rocks > capacity)
+        {
+            capacity = rocks;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * capacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        const SphereLODLevel& l = lod.levels[level];
+        Commands commands = { { l.indexCount, 0, l.firstIndex, static_cast<int>(l.baseVertex), 0 }, { 4, 0, 0, rocks } };
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commands), &commands);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        if (rocks == 0)
+            return;
+
+        glUseProgram(program);
+        UniformCache::set(rockCountLocation, static_cast<int>(rocks));
+        UniformCache::set(timeSpansLocation, time.spans);
+        UniformCache::set(timeOffsetLocation, time.offset);
+        glUniform4fv(planesLocation, 6, &frustum.planes[0][0]);
+        UniformCache::set(cameraPositionLocation, cameraPosition);
+        UniformCache::set(pixelScaleLocation, viewportHeight * 0.5f / tanf(fovY * 0.5f));
+        UniformCache::set(impostorRadiusLocation, lod.impostorRadius);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, belt.elementsVBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+        glDispatchCompute((rocks + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    // the current program must be 6.asteroid_particles.vs with alpha 0
+    void drawMeshes() const
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glDrawElementsIndirect(GL_TRIANGLES, SphereLOD::INDEX_TYPE, (void*)0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // the same with its IMPOSTOR variant
+    void drawImpostors() const
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)offsetof(Commands, impostors));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void release()
+    {
+        glDeleteProgram(program);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &visibleSSBO);
+        glDeleteBuffers(1, &commandBuffer);
+        program = VAO = visibleSSBO = commandBuffer = 0;
+        capacity = 0;
+    }
+
+private:
+    struct DrawCommand {
+        unsigned int count;
+        unsigned int instanceCount;
+        unsigned int firstIndex;
+        int baseVertex;
+        unsigned int baseInstance;
+    };
+
+    struct DrawArraysCommand {
+        unsigned int count;
+        unsigned int instanceCount;
+        unsigned int first;
+        unsigned int baseInstance;
+    };
+
+    // the Command block of 6.belt_cull.cs
+    struct Commands {
+        DrawCommand meshes;
+        DrawArraysCommand impostors;
+    };
+
+    int rockCountLocation = -1;
+    int timeSpansLocation = -1;
+    int timeOffsetLocation = -1;
+    int planesLocation = -1;
+    int cameraPositionLocation = -1;
+    int pixelScaleLocation = -1;
+    int impostorRadiusLocation = -1;
+};
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef GPU_NBODY_H
+#define GPU_NBODY_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "asteroid_belt.h"
+#include "compute_shader.h"
+#include "nbody.h"
+#include "sphere_lod.h"
+#include "uniform_cache.h"
+
+#include <string>
+#include <vector>
+
+// Belt integrated on the GPU (OpenGL 4.3). Particle state lives in three SSBOs
+// that 6.asteroid_nbody.cs advances one step per dispatch; the render VAO reads
+// the same buffers as instance attributes, so nothing comes back to the CPU.
+// Rocks are test particles pulled by the massive bodies of the CPU NBodySystem,
+// which are uploaded every step: O(rocks * bodies) instead of O(rocks^2), which
+// is what keeps a million-rock belt in the frame budget. A step is a whole
+// belt pass on the GPU but only microseconds to submit, so SimClock's CPU
+// budget cannot see it; at most MAX_STEPS_PER_FRAME are run a frame and the
+// rest stays in the clock's backlog: this mode advances at most 8 / 120 sim
+// seconds a frame, 4x real time at 60 fps, whatever the time scale asks.
+class GpuNBody
+{
+public:
+    static const unsigned int WORKGROUP_SIZE = 256; // local_size_x of the compute shader
+    static const unsigned int MAX_STEPS_PER_FRAME = 8;
+
+    unsigned int program = 0;
+    unsigned int VAO = 0;
+    unsigned int previousSSBO = 0; // vec4 position + scale, binding 0 and attribute 4
+    unsigned int currentSSBO = 0;  // vec4 position + scale, binding 1 and attribute 3
+    unsigned int velocitySSBO = 0; // vec4, binding 2
+    unsigned int attractorSSBO = 0; // 2 vec4 (position, GM) per body, binding 3
+    unsigned int particleCount = 0;
+    std::vector<unsigned int> attractors; // NBodySystem indices of the bodies that pull
+
+    // compute shaders, SSBOs and glMemoryBarrier are all core in 4.3
+    static bool supported()
+    {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+    bool setup(unsigned int meshVBO, unsigned int meshEBO, std::string& error)
+    {
+        program = compileComputeProgram("6.asteroid_nbody.cs", error);
+        if (!program)
+            return false;
+        UniformCache uniforms(program);
+        particleCountLocation = uniforms["particleCount"];
+        attractorCountLocation = uniforms["attractorCount"];
+        dtLocation = uniforms["dt"];
+        softeningLocation = uniforms["softening"];
+
+        glGenBuffers(1, &previousSSBO);
+        glGenBuffers(1, &currentSSBO);
+        glGenBuffers(1, &velocitySSBO);
+        glGenBuffers(1, &attractorSSBO);
+
+        glGenVertexArrays(1, &VAO);
+        glBindVertexArray(VAO);
+        SphereLOD::setupAttributes(meshVBO, meshEBO);
+        glBindBuffer(GL_ARRAY_BUFFER, currentSSBO);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, previousSSBO);
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+        glEnableVertexAttribArray(4);
+        glVertexAttribDivisor(4, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    // start every rock on its circular orbit at the given time, and take the
+    // bodies heavier than test particles as the attractors
+    void seed(const std::vector<AsteroidElements>& elements, const BeltTime& time, const NBodySystem& bodies)
+    {
+        particleCount = static_cast<unsigned int>(elements.size());
+        std::vector<glm::vec4> positions(elements.size());
+        std::vector<glm::vec4> velocities(elements.size());
+        for (size_t i = 0; i < elements.size(); ++i)
+        {
+            positions[i] = glm::vec4(AsteroidBelt::positionAt(elements[i], time), elements[i].scale);
+            velocities[i] = glm::vec4(AsteroidBelt::velocityAt(elements[i], time), 0.0f);
+        }
+        upload(previousSSBO, positions);
+        upload(currentSSBO, positions);
+        upload(velocitySSBO, velocities);
+
+        attractors.clear();
+        for (size_t i = 0; i < bodies.count(); ++i)
+        {
+            if (bodies.mass[i] > NBodySystem::LEAF_GM)
+                attractors.push_back(static_cast<unsigned int>(i));
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, attractorSSBO);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, attractors.size() * 2 * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // advance the belt by one step; the bodies have just made the same step,
+    // so their previous and current positions bracket it
+    void step(const NBodySystem& bodies, float dt)
+    {
+        if (particleCount == 0)
+            return;
+        attractorData.resize(attractors.size() * 2);
+        for (size_t a = 0; a < attractors.size(); ++a)
+        {
+            unsigned int i = attractors[a];
+            attractorData[2 * a] = glm::vec4(bodies.previousPosition[i], bodies.mass[i]);
+            attractorData[2 * a + 1] = glm::vec4(bodies.position[i], bodies.mass[i]);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, attractorSSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, attractorData.size() * sizeof(glm::vec4), attractorData.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glUseProgram(program);
+        UniformCache::set(particleCountLocation, static_cast<int>(particleCount));
+        UniformCache::set(attractorCountLocation, static_cast<int>(attractors.size()));
+        UniformCache::set(dtLocation, dt);
+        UniformCache::set(softeningLocation, NBodySystem::SOFTENING);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, previousSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, currentSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, velocitySSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, attractorSSBO);
+        // every step reads what the one before wrote
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glDispatchCompute((particleCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+        stepped = true;
+    }
+
+    // instanced draw straight from the particle buffers; the current program
+    // must be 6.asteroid_particles.vs
+    void draw(const SphereLOD& lod, unsigned int level)
+    {
+        if (particleCount == 0)
+            return;
+        if (stepped)
+        {
+            glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+            stepped = false;
+        }
+        glBindVertexArray(VAO);
+        lod.drawInstanced(level, particleCount);
+    }
+
+    void release()
+    {
+        glDeleteProgram(program);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &previousSSBO);
+        glDeleteBuffers(1, &currentSSBO);
+        glDeleteBuffers(1, &velocitySSBO);
+        glDeleteBuffers(1, &attractorSSBO);
+        program = VAO = previousSSBO = currentSSBO = velocitySSBO = attractorSSBO = 0;
+        particleCount = 0;
+    }
+
+private:
+    int particleCountLocation = -1;
+    int attractorCountLocation = -1;
+    int dtLocation = -1;
+    int softeningLocation = -1;
+    bool stepped = false;
+    std::vector<glm::vec4> attractorData;
+
+    static void upload(unsigned int buffer, const std::vector<glm::vec4>& data)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, data.size() * sizeof(glm::vec4), data.data(), GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef GPU_SCENE_H
+#define GPU_SCENE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "body_batch.h"
+#include "body_store.h"
+#include "compute_shader.h"
+#include "dynamic_buffer.h"
+#include "frustum.h"
+#include "sphere_lod.h"
+#include "uniform_cache.h"
+
+#include <cmath>
+#include <string>
+
+// std430 layout of one body in 6.body_cull.cs
+struct GpuBody {
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3]; // columns
+    glm::vec4 sphere;          // world centre, radius
+    int layer;
+    int padding[3];
+};
+
+static_assert(sizeof(GpuBody) == 144, "GpuBody must match std430 layout");
+
+// GPU-driven drawing of the bodies in the texture array (OpenGL 4.3). The
+// frame's transforms are written straight into a segment of a mapped ring
+// (DynamicBuffer); 6.body_cull.cs frustum culls them,
+// picks each one's sphere level as SphereLOD::select() does, and appends the
+// survivors to that level's run of BodyInstances, counting them in one
+// indirect command per level. A single glMultiDrawElementsIndirect then draws
+// every level, so the draw calls and state changes stay the same however many
+// bodies the catalog has. The instance attributes start at each command's
+// baseInstance, so unlike BodyBatch nothing is re-pointed per level.
+class GpuSceneRenderer
+{
+public:
+    static const unsigned int WORKGROUP_SIZE = 64; // local_size_x of the compute shader
+
+    unsigned int program = 0;
+    unsigned int VAO = 0;
+    DynamicBuffer bodies;          // GpuBody per uploaded body, binding 0
+    unsigned int visibleSSBO = 0;  // BodyInstance per level and body, binding 1, attributes 3..10
+    unsigned int commandBuffer = 0; // SphereLOD::LEVEL_COUNT commands, binding 2
+    unsigned int capacity = 0;
+
+    static bool supported()
+    {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+    bool setup(unsigned int meshVBO, unsigned int meshEBO, std::string& error)
+    {
+        program = compileComputeProgram("6.body_cull.cs", error);
+        if (!program)
+            return false;
+        UniformCache uniforms(program);
+        bodyCountLocation = uniforms["bodyCount"];
+        planesLocation = uniforms["planes"];
+        cameraPositionLocation = uniforms["cameraPosition"];
+        pixelScaleLocation = uniforms["pixelScale"];
+        viewportHeightLocation = uniforms["viewportHeight"];
+        pixelErrorLocation = uniforms["pixelError"];
+        levelSectorsLocation = uniforms["levelSectors"];
+
+        bodies.setup(GL_SHADER_STORAGE_BUFFER, 64 * sizeof(GpuBody));
+        glGenBuffers(1, &visibleSSBO);
+        glGenBuffers(1, &commandBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(commands), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        // same attributes as BodyBatch, for 6.multiple_lights_bodies.vs
+        glGenVertexArrays(1, &VAO);
+        glBindVertexArray(VAO);
+        SphereLOD::setupAttributes(meshVBO, meshEBO);
+        glBindBuffer(GL_ARRAY_BUFFER, visibleSSBO);
+        for (unsigned int i = 0; i < 4; ++i)
+            glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(i * sizeof(glm::vec4)));
+        for (unsigned int i = 0; i < 3; ++i)
+            glVertexAttribPointer(7 + i, 3, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(sizeof(glm::mat4) + i * sizeof(glm::vec3)));
+        glVertexAttribIPointer(10, 1, GL_INT, sizeof(BodyInstance), (void*)(sizeof(glm::mat4) + sizeof(glm::mat3)));
+        for (unsigned int i = 3; i <= 10; ++i)
+        {
+            glEnableVertexAttribArray(i);
+            glVertexAttribDivisor(i, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    // upload the bodies of the store that have a texture array layer and cull
+    // them for this view; draw() must follow
+    void cull(const BodyStore& store, const Frustum& frustum, const SphereLOD& lod, const glm::vec3& cameraPosition,
+        float fovY, float viewportHeight)
+    {
+        unsigned int n = 0;
+        for (size_t i = 0; i < store.count(); ++i)
+            n += store.textureLayer[i] >= 0 ? 1 : 0;
+        if (n > capacity)
+        {
+            capacity = n;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * SphereLOD::LEVEL_COUNT * sizeof(BodyInstance), NULL, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        int sectors[SphereLOD::LEVEL_COUNT];
+        for (unsigned int l = 0; l < SphereLOD::LEVEL_COUNT; ++l)
+        {
+            const SphereLODLevel& level = lod.levels[l];
+            DrawCommand command = { level.indexCount, 0, level.firstIndex, level.baseVertex, l * n };
+            commands[l] = command;
+            sectors[l] = static_cast<int>(level.sectorCount);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commands), commands);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        if (n == 0)
+            return;
+
+        GpuBody* out = static_cast<GpuBody*>(bodies.begin(n * sizeof(GpuBody)));
+        if (!out)
+            return;
+        for (size_t i = 0; i < store.count(); ++i)
+        {
+            if (store.textureLayer[i] < 0)
+                continue;
+            GpuBody& body = *out++;
+            body.model = store.model[i];
+            for (int c = 0; c < 3; ++c)
+                body.normalMatrix[c] = glm::vec4(store.normalMatrix[i][c], 0.0f);
+            body.sphere = glm::vec4(store.worldPosition[i], store.size[i]);
+            body.layer = store.textureLayer[i];
+            body.padding[0] = body.padding[1] = body.padding[2] = 0;
+        }
+        bodies.end();
+
+        glUseProgram(program);
+        UniformCache::set(bodyCountLocation, static_cast<int>(n));
+        glUniform4fv(planesLocation, 6, &frustum.planes[0][0]);
+        UniformCache::set(cameraPositionLocation, cameraPosition);
+        UniformCache::set(pixelScaleLocation, viewportHeight * 0.5f / tanf(fovY * 0.5f));
+        UniformCache::set(viewportHeightLocation, viewportHeight);
+        UniformCache::set(pixelErrorLocation, lod.pixelError);
+        glUniform1iv(levelSectorsLocation, SphereLOD::LEVEL_COUNT, sectors);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, bodies.buffer, bodies.offset(), n * sizeof(GpuBody));
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+        glDispatchCompute((n + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    // every level in one call; the current program must be
+    // 6.multiple_lights_bodies.vs with the texture array bound
+    void draw() const
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, SphereLOD::INDEX_TYPE, (void*)0, SphereLOD::LEVEL_COUNT, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void release()
+    {
+        glDeleteProgram(program);
+        glDeleteVertexArrays(1, &VAO);
+        bodies.release();
+        glDeleteBuffers(1, &visibleSSBO);
+        glDeleteBuffers(1, &commandBuffer);
+        program = VAO = visibleSSBO = commandBuffer = 0;
+        capacity = 0;
+    }
+
+private:
+    struct DrawCommand {
+        unsigned int count;
+        unsigned int instanceCount;
+        unsigned int firstIndex;
+        int baseVertex;
+        unsigned int baseInstance;
+    };
+
+    DrawCommand commands[SphereLOD::LEVEL_COUNT];
+    int bodyCountLocation = -1;
+    int planesLocation = -1;
+    int cameraPositionLocation = -1;
+    int pixelScaleLocation = -1;
+    int viewportHeightLocation = -1;
+    int pixelErrorLocation = -1;
+    int levelSectorsLocation = -1;
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Small work-stealing job system. Every worker owns a deque: it pushes and pops
+// its own jobs at the back and steals from the front of the others when it runs
+// dry. Threads outside the pool (the GL thread) push into a shared queue and
+// help run jobs while they wait on a counter.
+class JobSystem
+{
+public:
+    typedef std::function<void()> Job;
+
+    // number of jobs still running in a group; wait() returns once it is zero
+    struct Counter {
+        std::atomic<int> pending{ 0 };
+    };
+
+    ~JobSystem()
+    {
+        stop();
+    }
+
+    // start workerCount threads (0 runs every job on the waiting thread)
+    void start(unsigned int workerCount)
+    {
+        stop();
+        stopping = false;
+        queues.clear();
+        for (unsigned int i = 0; i <= workerCount; ++i)
+            queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+        for (unsigned int i = 0; i < workerCount; ++i)
+            workers.push_back(std::thread(&JobSystem::workerLoop, this, i + 1));
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+        workers.clear();
+    }
+
+    // workers plus the thread that waits
+    unsigned int threadCount() const
+    {
+        return static_cast<unsigned int>(workers.size()) + 1;
+    }
+
+    void run(Counter& counter, Job job)
+    {
+        counter.pending.fetch_add(1);
+        WorkQueue& queue = *queues[queueIndex() < queues.size() ? queueIndex() : 0];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(Job([&counter, job = std::move(job)]() {
+                job();
+                counter.pending.fetch_sub(1);
+            }));
+        }
+        queued.fetch_add(1);
+        // take the lock so a worker between its check and its sleep cannot miss this
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // run jobs on this thread until every job of the counter has finished
+    void wait(Counter& counter)
+    {
+        while (counter.pending.load() > 0)
+        {
+            if (!runOne(queueIndex()))
+                std::this_thread::yield();
+        }
+    }
+
+    // split [0, count) into chunks of at least grain items and queue body(begin, end)
+    // for each; returns at once, wait on the counter for the results
+    template <typename Body>
+    void parallelFor(Counter& counter, size_t count, size_t grain, Body body)
+    {
+        if (count == 0)
+            return;
+        // about four chunks per thread so stealing can even out slow ones
+        size_t chunks = std::max<size_t>(1, std::min<size_t>(count / std::max<size_t>(grain, 1), threadCount() * 4));
+        size_t chunkSize = (count + chunks - 1) / chunks;
+        for (size_t begin = 0; begin < count; begin += chunkSize)
+        {
+            size_t end = std::min(count, begin + chunkSize);
+            run(counter, [body, begin, end]() { body(begin, end); });
+        }
+    }
+
+    template <typename Body>
+    void parallelFor(size_t count, size_t grain, Body body)
+    {
+        if (count <= grain || workers.empty())
+        {
+            body(size_t(0), count);
+            return;
+        }
+        Counter counter;
+        parallelFor(counter, count, grain, body);
+        wait(counter);
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue> > queues; // 0: external threads, i: worker i
+    std::vector<std::thread> workers;
+    std::atomic<int> queued{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    // queue owned by the calling thread, 0 outside the pool
+    static size_t& queueIndex()
+    {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    // pop from our own queue's back, otherwise steal from another queue's front
+    bool runOne(size_t own)
+    {
+        Job job;
+        if (own < queues.size())
+        {
+            WorkQueue& queue = *queues[own];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty())
+            {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            }
+        }
+        for (size_t i = 1; !job && i < queues.size(); ++i)
+        {
+            WorkQueue& victim = *queues[(own + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty())
+            {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+            }
+        }
+        if (!job)
+            return false;
+        queued.fetch_sub(1);
+        job();
+        return true;
+    }
+
+    void workerLoop(size_t index)
+    {
+        queueIndex() = index;
+        while (true)
+        {
+            if (runOne(index))
+                continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0)
+                return;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal JSON reader: a small DOM and a single-pass recursive descent parser.
+// Enough for the body catalog and script files, and fast enough for catalogs
+// with tens of thousands of entries.
+class JsonValue
+{
+public:
+    enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+    Type type = JSON_NULL;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue> > object;
+
+    bool isNull() const { return type == JSON_NULL; }
+    bool isNumber() const { return type == JSON_NUMBER; }
+    bool isString() const { return type == JSON_STRING; }
+    bool isArray() const { return type == JSON_ARRAY; }
+    bool isObject() const { return type == JSON_OBJECT; }
+
+    // object member lookup, NULL if missing or not an object
+    const JsonValue* find(const std::string& key) const
+    {
+        for (size_t i = 0; i < object.size(); ++i)
+        {
+            if (object[i].first == key)
+                return &object[i].second;
+        }
+        return NULL;
+    }
+
+    double getNumber(const std::string& key, double fallback) const
+    {
+        const JsonValue* value = find(key);
+        return value && value->isNumber() ? value->number : fallback;
+    }
+
+    std::string getString(const std::string& key, const std::string& fallback) const
+    {
+        const JsonValue* value = find(key);
+        return value && value->isString() ? value->string : fallback;
+    }
+
+    bool getBool(const std::string& key, bool fallback) const
+    {
+        const JsonValue* value = find(key);
+        return value && value->type == JSON_BOOL ? value->boolean : fallback;
+    }
+};
+
+class JsonParser
+{
+public:
+    // deepest nesting of objects and arrays accepted; deeper input is an
+    // error rather than a stack overflow of the recursive descent
+    static const unsigned int MAX_DEPTH = 64;
+
+    // parse a whole document; on failure error holds the reason and byte offset
+    static bool parse(const std::string& text, JsonValue& root, std::string& error)
+    {
+        JsonParser parser(text);
+        parser.skipWhitespace();
+        if (!parser.parseValue(root))
+        {
+            error = parser.error + " at offset " + std::to_string(parser.pos);
+            return false;
+        }
+        parser.skipWhitespace();
+        if (parser.pos != text.size())
+        {
+            error = "trailing characters at offset " + std::to_string(parser.pos);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const std::string& text;
+    size_t pos = 0;
+    unsigned int depth = 0; // objects and arrays currently open
+    std::string error;
+
+    explicit JsonParser(const std::string& input)
+        : text(input)
+    {
+    }
+
+    void skipWhitespace()
+    {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+            ++pos;
+    }
+
+    bool fail(const char* reason)
+    {
+        error = reason;
+        return false;
+    }
+
+    bool parseValue(JsonValue& value)
+    {
+        if (pos >= text.size())
+            return fail("unexpected end of input");
+        char c = text[pos];
+        if (c == '{' || c == '[')
+        {
+            if (depth >= MAX_DEPTH)
+                return fail("nesting too deep");
+            ++depth;
+            bool parsed = c == '{' ? parseObject(value) : parseArray(value);
+            --depth;
+            return parsed;
+        }
+        if (c == '"')
+        {
+            value.type = JsonValue::JSON_STRING;
+            return parseString(value.string);
+        }
+        if (c == 't' || c == 'f' || c == 'n')
+            return parseLiteral(value);
+        return parseNumber(value);
+    }
+
+    bool parseObject(JsonValue& value)
+    {
+        value.type = JsonValue::JSON_OBJECT;
+        value.object.reserve(8); // typical catalog entry size, avoids regrowing small objects
+        ++pos; // {
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == '}')
+        {
+            ++pos;
+            return true;
+        }
+        while (true)
+        {
+            skipWhitespace();
+            if (pos >= text.size() || text[pos] != '"')
+                return fail("expected member name");
+            value.object.push_back(std::make_pair(std::string(), JsonValue()));
+            if (!parseString(value.object.back().first))
+                return false;
+            skipWhitespace();
+            if (pos >= text.size() || text[pos] != ':')
+                return fail("expected ':'");
+            ++pos;
+            skipWhitespace();
+            if (!parseValue(value.object.back().second))
+                return false;
+            skipWhitespace();
+            if (pos < text.size() && text[pos] == ',')
+            {
+                ++pos;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == '}')
+            {
+                ++pos;
+                return true;
+            }
+            return fail("expected ',' or '}'");
+        }
+    }
+
+    bool parseArray(JsonValue& value)
+    {
+        value.type = JsonValue::JSON_ARRAY;
+        ++pos; // [
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == ']')
+        {
+            ++pos;
+            return true;
+        }
+        while (true)
+        {
+            skipWhitespace();
+            value.array.push_back(JsonValue());
+            if (!parseValue(value.array.back()))
+                return false;
+            skipWhitespace();
+            if (pos < text.size() && text[pos] == ',')
+            {
+                ++pos;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == ']')
+            {
+                ++pos;
+                return true;
+            }
+            return fail("expected ',' or ']'");
+        }
+    }
+
+    bool parseString(std::string& out)
+    {
+        ++pos; // opening quote
+        while (pos < text.size())
+        {
+            // copy runs without escapes in one go
+            size_t run = pos;
+            while (run < text.size() && text[run] != '"' && text[run] != '\\')
+                ++run;
+            out.append(text, pos, run - pos);
+            pos = run;
+            if (pos >= text.size())
+                break;
+            char c = text[pos++];
+            if (c == '"')
+                return true;
+            if (c != '\\')
+            {
+                out.push_back(c);
+                continue;
+            }
+            if (pos >= text.size())
+                break;
+            char e = text[pos++];
+            switch (e)
+            {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u':
+            {
+                if (pos + 4 > text.size())
+                    return fail("truncated \\u escape");
+                unsigned int code = static_cast<unsigned int>(std::strtoul(text.substr(pos, 4).c_str(), NULL, 16));
+                pos += 4;
+                // basic multilingual plane only, encoded as UTF-8
+                if (code < 0x80)
+                    out.push_back(static_cast<char>(code));
+                else if (code < 0x800)
+                {
+                    out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                    out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                else
+                {
+                    out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                    out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                break;
+            }
+            default:
+                return fail("invalid escape");
+            }
+        }
+        return fail("unterminated string");
+    }
+
+    bool parseLiteral(JsonValue& value)
+    {
+        if (text.compare(pos, 4, "true") == 0)
+        {
+            value.type = JsonValue::JSON_BOOL;
+            value.boolean = true;
+            pos += 4;
+            return true;
+        }
+        if (text.compare(pos, 5, "false") == 0)
+        {
+            value.type = JsonValue::JSON_BOOL;
+            value.boolean = false;
+            pos += 5;
+            return true;
+        }
+        if (text.compare(pos, 4, "null") == 0)
+        {
+            value.type = JsonValue::JSON_NULL;
+            pos += 4;
+            return true;
+        }
+        return fail("invalid literal");
+    }
+
+    bool parseNumber(JsonValue& value)
+    {
+        const char* begin = text.c_str() + pos;
+        char* end = NULL;
+        value.number = std::strtod(begin, &end);
+        if (end == begin)
+            return fail("invalid value");
+        value.type = JsonValue::JSON_NUMBER;
+        pos += static_cast<size_t>(end - begin);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+// S3TC is an extension to core GL, so glad's core loader has no names for it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Vulkan format numbers the container records
+const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+
+// A 2D texture with a full mip chain of 4x4 compressed blocks, as stored in a
+// KTX2 file (no supercompression, one layer, one face).
+struct Ktx2Image {
+    uint32_t vkFormat = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<std::vector<unsigned char> > levels; // level 0 is the full size
+    std::vector<std::pair<std::string, std::string> > keyValues;
+
+    // 8 bytes per block for BC1, 16 for BC3
+    uint32_t blockBytes() const
+    {
+        return vkFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK ? 8 : 16;
+    }
+
+    const std::string* value(const std::string& key) const
+    {
+        for (size_t i = 0; i < keyValues.size(); ++i)
+        {
+            if (keyValues[i].first == key)
+                return &keyValues[i].second;
+        }
+        return NULL;
+    }
+};
+
+namespace ktx2_detail {
+const unsigned char IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t HEADER_BYTES = 80;
+const uint32_t LEVEL_INDEX_BYTES = 24;
+
+inline void put32(std::vector<unsigned char>& out, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(static_cast<unsigned char>(v >> (8 * i)));
+}
+
+inline void put64(std::vector<unsigned char>& out, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        out.push_back(static_cast<unsigned char>(v >> (8 * i)));
+}
+
+inline uint32_t get32(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint64_t get64(const unsigned char* p)
+{
+    return get32(p) | (static_cast<uint64_t>(get32(p + 4)) << 32);
+}
+
+// levels of a full mip chain of a width x height image, floor(log2(max)) + 1
+inline uint32_t fullMipCount(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1)
+        ++count;
+    return count;
+}
+
+// the entries of a key/value data block; a corrupt length ends the list
+inline void parseKeyValues(const unsigned char* data, size_t size, std::vector<std::pair<std::string, std::string> >& keyValues)
+{
+    // bounds by subtraction from the end, so a corrupt length cannot wrap past it
+    size_t k = 0;
+    while (size - k >= 4)
+    {
+        size_t length = get32(data + k);
+        if (length > size - k - 4)
+            break;
+        const char* entry = reinterpret_cast<const char*>(data + k + 4);
+        const char* nul = static_cast<const char*>(std::memchr(entry, 0, length));
+        size_t keyLength = nul ? static_cast<size_t>(nul - entry) : length;
+        std::string value = keyLength < length ? std::string(entry + keyLength + 1, length - keyLength - 1) : std::string();
+        if (!value.empty() && value[value.size() - 1] == '\0')
+            value.erase(value.size() - 1);
+        keyValues.push_back(std::make_pair(std::string(entry, keyLength), value));
+        k += std::min(4 + (length + 3) / 4 * 4, size - k);
+    }
+}
+
+inline void pad(std::vector<unsigned char>& out, size_t alignment)
+{
+    while (out.size() % alignment)
+        out.push_back(0);
+}
+
+// basic data format descriptor: BC1 colour, or BC3 alpha block then colour block
+inline void putDataFormatDescriptor(std::vector<unsigned char>& out, uint32_t vkFormat)
+{
+    bool bc3 = vkFormat == VK_FORMAT_BC3_UNORM_BLOCK;
+    uint32_t samples = bc3 ? 2 : 1;
+    uint32_t blockSize = 24 + 16 * samples;
+    put32(out, 4 + blockSize);                // dfdTotalSize
+    put32(out, 0);                            // vendor Khronos, basic descriptor
+    put32(out, 2 | (blockSize << 16));        // version 2
+    put32(out, (bc3 ? 130 : 128) | (1 << 8) | (1 << 16)); // BC3 or BC1A model, BT.709, linear
+    put32(out, 3 | (3 << 8));                 // 4x4 texel blocks
+    put32(out, bc3 ? 16 : 8);                 // bytes per block in plane 0
+    put32(out, 0);
+    if (bc3)
+    {
+        put32(out, 0 | (63 << 16) | (15u << 24)); // alpha: bits 0..63
+        put32(out, 0);
+        put32(out, 0);
+        put32(out, 0xFFFFFFFFu);
+    }
+    put32(out, (bc3 ? 64 : 0) | (63 << 16));  // colour
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, 0xFFFFFFFFu);
+}
+}
+
+inline bool writeKtx2(const std::string& path, const Ktx2Image& image, std::string& error)
+{
+    using namespace ktx2_detail;
+    uint32_t levelCount = static_cast<uint32_t>(image.levels.size());
+    std::vector<unsigned char> out(IDENTIFIER, IDENTIFIER + sizeof(IDENTIFIER));
+    put32(out, image.vkFormat);
+    put32(out, 1); // typeSize of block-compressed formats
+    put32(out, image.width);
+    put32(out, image.height);
+    put32(out, 0); // pixelDepth
+    put32(out, 0); // layerCount
+    put32(out, 1); // faceCount
+    put32(out, levelCount);
+    put32(out, 0); // no supercompression
+
+    // descriptor and key/value data go straight after the level index
+    std::vector<unsigned char> dfd;
+    putDataFormatDescriptor(dfd, image.vkFormat);
+    std::vector<unsigned char> kvd;
+    for (size_t i = 0; i < image.keyValues.size(); ++i)
+    {
+        const std::string& key = image.keyValues[i].first;
+        const std::string& value = image.keyValues[i].second;
+        put32(kvd, static_cast<uint32_t>(key.size() + 1 + value.size() + 1));
+        kvd.insert(kvd.end(), key.begin(), key.end());
+        kvd.push_back(0);
+        kvd.insert(kvd.end(), value.begin(), value.end());
+        kvd.push_back(0);
+        pad(kvd, 4);
+    }
+    uint32_t dfdOffset = HEADER_BYTES + LEVEL_INDEX_BYTES * levelCount;
+    uint32_t kvdOffset = dfdOffset + static_cast<uint32_t>(dfd.size());
+    put32(out, dfdOffset);
+    put32(out, static_cast<uint32_t>(dfd.size()));
+    put32(out, kvd.empty() ? 0 : kvdOffset);
+    put32(out, static_cast<uint32_t>(kvd.size()));
+    put64(out, 0); // no supercompression global data
+    put64(out, 0);
+
+    // images are stored smallest level first, each aligned to the block size
+    std::vector<uint64_t> offsets(levelCount);
+    uint64_t offset = kvdOffset + kvd.size();
+    for (uint32_t l = levelCount; l-- > 0;)
+    {
+        offset = (offset + image.blockBytes() - 1) / image.blockBytes() * image.blockBytes();
+        offsets[l] = offset;
+        offset += image.levels[l].size();
+    }
+    for (uint32_t l = 0; l < levelCount; ++l)
+    {
+        put64(out, offsets[l]);
+        put64(out, image.levels[l].size());
+        put64(out, image.levels[l].size());
+    }
+    out.insert(out.end(), dfd.begin(), dfd.end());
+    out.insert(out.end(), kvd.begin(), kvd.end());
+    for (uint32_t l = levelCount; l-- > 0;)
+    {
+        pad(out, image.blockBytes());
+        out.insert(out.end(), image.levels[l].begin(), image.levels[l].end());
+    }
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file)
+    {
+        error = "cannot create " + path;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+    if (!file)
+    {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+// reads only what writeKtx2 produces: BC1/BC3 2D textures without supercompression
+inline bool readKtx2(const std::string& path, Ktx2Image& image, std::string& error)
+{
+    using namespace ktx2_detail;
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < HEADER_BYTES || std::memcmp(data.data(), IDENTIFIER, sizeof(IDENTIFIER)) != 0)
+    {
+        error = "not a KTX2 file";
+        return false;
+    }
+    const unsigned char* header = data.data() + sizeof(IDENTIFIER);
+    image.vkFormat = get32(header);
+    image.width = get32(header + 8);
+    image.height = get32(header + 12);
+    uint32_t depth = get32(header + 16);
+    uint32_t layers = get32(header + 20);
+    uint32_t faces = get32(header + 24);
+    uint32_t levelCount = get32(header + 28);
+    uint32_t supercompression = get32(header + 32);
+    if (image.vkFormat != VK_FORMAT_BC1_RGB_UNORM_BLOCK && image.vkFormat != VK_FORMAT_BC3_UNORM_BLOCK)
+    {
+        error = "unsupported format " + std::to_string(image.vkFormat);
+        return false;
+    }
+    if (depth != 0 || layers != 0 || faces != 1 || supercompression != 0 || levelCount == 0 || image.width == 0 || image.height == 0)
+    {
+        error = "only uncompressed single 2D images are supported";
+        return false;
+    }
+    if (levelCount > fullMipCount(image.width, image.height))
+    {
+        error = "more levels than a full mip chain";
+        return false;
+    }
+    if (data.size() < HEADER_BYTES + static_cast<size_t>(LEVEL_INDEX_BYTES) * levelCount)
+    {
+        error = "truncated level index";
+        return false;
+    }
+
+    uint32_t kvdOffset = get32(header + 44);
+    uint32_t kvdLength = get32(header + 48);
+    image.keyValues.clear();
+    if (static_cast<uint64_t>(kvdOffset) + kvdLength <= data.size())
+        parseKeyValues(data.data() + kvdOffset, kvdLength, image.keyValues);
+
+    image.levels.assign(levelCount, std::vector<unsigned char>());
+    for (uint32_t l = 0; l < levelCount; ++l)
+    {
+        const unsigned char* index = data.data() + HEADER_BYTES + LEVEL_INDEX_BYTES * l;
+        uint64_t offset = get64(index);
+        uint64_t length = get64(index + 8);
+        uint32_t w = std::max(image.width >> l, 1u), h = std::max(image.height >> l, 1u);
+        uint64_t expected = ((static_cast<uint64_t>(w) + 3) / 4) * ((static_cast<uint64_t>(h) + 3) / 4) * image.blockBytes();
+        if (length != expected || length > data.size() || offset > data.size() - length)
+        {
+            error = "level " + std::to_string(l) + " is truncated";
+            return false;
+        }
+        image.levels[l].assign(data.begin() + offset, data.begin() + offset + length);
+    }
+    return true;
+}
+
+// only the key/value data of a KTX2 file, without reading its levels
+inline bool readKtx2KeyValues(const std::string& path, std::vector<std::pair<std::string, std::string> >& keyValues, std::string& error)
+{
+    using namespace ktx2_detail;
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    unsigned char data[HEADER_BYTES];
+    file.seekg(0);
+    if (fileSize < HEADER_BYTES || !file.read(reinterpret_cast<char*>(data), HEADER_BYTES)
+        || std::memcmp(data, IDENTIFIER, sizeof(IDENTIFIER)) != 0)
+    {
+        error = "not a KTX2 file";
+        return false;
+    }
+    const unsigned char* header = data + sizeof(IDENTIFIER);
+    uint32_t kvdOffset = get32(header + 44);
+    uint32_t kvdLength = get32(header + 48);
+    keyValues.clear();
+    if (static_cast<uint64_t>(kvdOffset) + kvdLength > fileSize)
+        return true; // like readKtx2, a block past the end is no key/value data
+    std::vector<unsigned char> kvd(kvdLength);
+    file.seekg(static_cast<std::streamoff>(kvdOffset));
+    if (!file.read(reinterpret_cast<char*>(kvd.data()), kvd.size()))
+    {
+        error = "cannot read " + path;
+        return false;
+    }
+    parseKeyValues(kvd.data(), kvd.size(), keyValues);
+    return true;
+}
+
+// true if the driver exposes S3TC, which every desktop GL driver does in practice
+inline bool compressedTexturesSupported()
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        supported = 0;
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count && !supported; ++i)
+        {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            supported = name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0;
+        }
+    }
+    return supported != 0;
+}
+
+// the GL internal format of a container format
+inline GLenum ktx2GLFormat(uint32_t vkFormat)
+{
+    return vkFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "lighting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Clustered forward shading of the point lights. The view frustum is split
+// into TILES_X x TILES_Y screen tiles and SLICES depth slices (exponential, so
+// near clusters are not stretched), and every frame each light's range sphere
+// is binned on the CPU into the clusters it touches. 6.multiple_lights.fs finds
+// its fragment's cluster and loops over that cluster's lights only, so the cost
+// per fragment follows the lights nearby rather than the lights in the scene.
+// GL 3.3 has no storage buffers: the lights, the grid and the light index list
+// are buffer textures.
+class LightClusters
+{
+public:
+    // keep in sync with 6.multiple_lights.fs
+    static const unsigned int TILES_X = 16;
+    static const unsigned int TILES_Y = 9;
+    static const unsigned int SLICES = 24;
+    static const unsigned int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+    static constexpr float CUTOFF = 1.0f / 256.0f; // a light ends where it adds less than this
+    static const unsigned int DIRECT_LIGHTS = 8; // up to this many, shading every light beats the cluster lookup (N_LIGHTS)
+
+    unsigned int lightsBuffer = 0, lightsTexture = 0;   // PointLight, 4 RGBA32F texels each
+    unsigned int gridBuffer = 0, gridTexture = 0;       // per cluster: first index, light count (RG32UI)
+    unsigned int indexBuffer = 0, indexTexture = 0;     // light indices of every cluster back to back (R32UI)
+
+    // Camera block clusterParams: tiles per pixel in x and y, then slice = log(depth) * z + w
+    glm::vec4 params = glm::vec4(0.0f);
+
+    void setup()
+    {
+        glGenBuffers(1, &lightsBuffer);
+        glGenBuffers(1, &gridBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenTextures(1, &lightsTexture);
+        glGenTextures(1, &gridTexture);
+        glGenTextures(1, &indexTexture);
+        grid.assign(CLUSTER_COUNT * 2, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, grid.size() * sizeof(unsigned int), grid.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        attach(lightsTexture, GL_RGBA32F, lightsBuffer);
+        attach(gridTexture, GL_RG32UI, gridBuffer);
+        attach(indexTexture, GL_R32UI, indexBuffer);
+    }
+
+    // whether the shaders for these lights look up the clusters at all; with
+    // DIRECT_LIGHTS or fewer they shade every light (N_LIGHTS) and only the
+    // lights themselves are needed, so update() and bind() are skipped for
+    // uploadLights() and bindLights()
+    static bool used(const LightSetup& lights)
+    {
+        return lights.pointLights.size() > DIRECT_LIGHTS;
+    }
+
+    // distance at which a light's attenuated intensity falls below CUTOFF
+    static float range(const PointLight& light)
+    {
+        glm::vec3 total = light.ambient + light.diffuse + light.specular;
+        float k = std::fmax(total.x, std::fmax(total.y, total.z)) / CUTOFF;
+        if (k <= light.constant)
+            return 0.0f;
+        if (light.quadratic > 0.0f)
+            return (-light.linear + std::sqrt(light.linear * light.linear + 4.0f * light.quadratic * (k - light.constant))) / (2.0f * light.quadratic);
+        if (light.linear > 0.0f)
+            return (k - light.constant) / light.linear;
+        return std::numeric_limits<float>::infinity();
+    }
+
+    // the lights with their ranges, re-uploaded only when lights.version changes
+    void uploadLights(const LightSetup& lights)
+    {
+        if (uploadedVersion == lights.version)
+            return;
+        uploadedVersion = lights.version;
+        ranged = lights.pointLights;
+        for (size_t i = 0; i < ranged.size(); ++i)
+            ranged[i].range = range(ranged[i]);
+        glBindBuffer(GL_TEXTURE_BUFFER, lightsBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, ranged.size() * sizeof(PointLight), ranged.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // uploadLights(), then bin the lights into the clusters of this view
+    void update(const LightSetup& lights, const glm::mat4& view, float fovY, float aspect, float nearPlane, float farPlane,
+        int viewportWidth, int viewportHeight)
+    {
+        uploadLights(lights);
+
+        // the cluster range of each light, then a count/prefix sum/fill pass over the grid
+        float scaleY = 1.0f / std::tan(0.5f * fovY);
+        float scaleX = scaleY / aspect;
+        float sliceScale = SLICES / std::log(farPlane / nearPlane);
+        params = glm::vec4(static_cast<float>(TILES_X) / viewportWidth, static_cast<float>(TILES_Y) / viewportHeight,
+            sliceScale, -std::log(nearPlane) * sliceScale);
+        boxes.clear();
+        for (size_t i = 0; i < ranged.size(); ++i)
+        {
+            float r = ranged[i].range;
+            if (r <= 0.0f)
+                continue;
+            glm::vec3 c = glm::vec3(view * glm::vec4(ranged[i].position, 1.0f));
+            float depth = -c.z;
+            if (depth - r > farPlane || depth + r < nearPlane)
+                continue;
+            LightBox box;
+            box.light = static_cast<unsigned int>(i);
+            box.z0 = slice(depth - r, nearPlane, farPlane, sliceScale);
+            box.z1 = slice(depth + r, nearPlane, farPlane, sliceScale);
+            tiles(c.x, depth, r, scaleX, TILES_X, box.x0, box.x1);
+            tiles(c.y, depth, r, scaleY, TILES_Y, box.y0, box.y1);
+            if (box.x0 <= box.x1 && box.y0 <= box.y1)
+                boxes.push_back(box);
+        }
+
+        std::fill(grid.begin(), grid.end(), 0u);
+        for (size_t b = 0; b < boxes.size(); ++b)
+            forEachCluster(boxes[b], [this](unsigned int cluster, unsigned int) { ++grid[cluster * 2 + 1]; });
+        unsigned int total = 0;
+        for (unsigned int cluster = 0; cluster < CLUSTER_COUNT; ++cluster)
+        {
+            grid[cluster * 2] = total;
+            total += grid[cluster * 2 + 1];
+            grid[cluster * 2 + 1] = 0;
+        }
+        indices.resize(total > 0 ? total : 1);
+        for (size_t b = 0; b < boxes.size(); ++b)
+        {
+            forEachCluster(boxes[b], [this](unsigned int cluster, unsigned int light) {
+                indices[grid[cluster * 2] + grid[cluster * 2 + 1]++] = light;
+            });
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, grid.size() * sizeof(unsigned int), grid.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // the lights, the grid and the index list on three consecutive units; leaves unit 0 active
+    void bind(unsigned int firstUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + firstUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightsTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+        glActiveTexture(GL_TEXTURE0 + firstUnit + 2);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // the lights only, on the unit bind() puts them on
+    void bindLights(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightsTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // lights binned into at least one cluster by the last update()
+    size_t visibleLights() const
+    {
+        return boxes.size();
+    }
+
+    void release()
+    {
+        glDeleteTextures(1, &lightsTexture);
+        glDeleteTextures(1, &gridTexture);
+        glDeleteTextures(1, &indexTexture);
+        glDeleteBuffers(1, &lightsBuffer);
+        glDeleteBuffers(1, &gridBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+        lightsTexture = gridTexture = indexTexture = 0;
+        lightsBuffer = gridBuffer = indexBuffer = 0;
+        uploadedVersion = 0;
+    }
+
+private:
+    // inclusive cluster ranges of one light
+    struct LightBox {
+        unsigned int light;
+        int x0, x1, y0, y1, z0, z1;
+    };
+
+    std::vector<PointLight> ranged; // the scene's point lights with range filled in
+    std::vector<LightBox> boxes;
+    std::vector<unsigned int> grid;
+    std::vector<unsigned int> indices;
+    unsigned int uploadedVersion = 0;
+
+    static void attach(unsigned int texture, GLenum format, unsigned int buffer)
+    {
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    static int slice(float depth, float nearPlane, float farPlane, float sliceScale)
+    {
+        if (depth <= nearPlane)
+            return 0;
+        if (depth >= farPlane)
+            return static_cast<int>(SLICES) - 1;
+        int s = static_cast<int>(std::log(depth / nearPlane) * sliceScale);
+        return s < static_cast<int>(SLICES) ? s : static_cast<int>(SLICES) - 1;
+    }
+
+    // tiles along one screen axis covered by the sphere around (a, depth) in
+    // that axis' plane: its two tangents from the eye, projected with scale.
+    // A sphere around the eye, or reaching behind it, covers the whole axis.
+    static void tiles(float a, float depth, float r, float scale, unsigned int count, int& first, int& last)
+    {
+        first = 0;
+        last = static_cast<int>(count) - 1;
+        float d2 = a * a + depth * depth;
+        if (d2 <= r * r)
+            return;
+        float t = std::sqrt(d2 - r * r);
+        float lowDenominator = depth * t + a * r;
+        float highDenominator = depth * t - a * r;
+        float low = lowDenominator > 0.0f ? (a * t - depth * r) / lowDenominator * scale : -1.0f;
+        float high = highDenominator > 0.0f ? (a * t + depth * r) / highDenominator * scale : 1.0f;
+        if (low > 1.0f || high < -1.0f)
+        {
+            first = 1;
+            last = 0; // off screen
+            return;
+        }
+        if (low > -1.0f)
+            first = static_cast<int>((low * 0.5f + 0.5f) * count);
+        if (high < 1.0f)
+            last = std::min(static_cast<int>((high * 0.5f + 0.5f) * count), static_cast<int>(count) - 1);
+    }
+
+    template <typename Body>
+    void forEachCluster(const LightBox& box, Body body)
+    {
+        for (int z = box.z0; z <= box.z1; ++z)
+            for (int y = box.y0; y <= box.y1; ++y)
+                for (int x = box.x0; x <= box.x1; ++x)
+                    body((z * TILES_Y + y) * TILES_X + x, box.light);
+    }
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// CPU-side mirrors of the light structs in 6.multiple_lights.fs, laid out with
+// std140 rules so they can be copied straight into the Lights uniform block.
+// Point lights are not in the block: LightClusters hands them to the shader
+// as a buffer texture of the same 64-byte records.
+// The spot light is the camera flashlight: its pose comes from the Camera block.
+struct PointLight {
+    glm::vec3 position;
+    float constant;
+    glm::vec3 ambient;
+    float linear;
+    glm::vec3 diffuse;
+    float quadratic;
+    glm::vec3 specular;
+    float range; // filled in by LightClusters from the attenuation
+};
+
+struct DirLight {
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+struct SpotLight {
+    glm::vec3 ambient;
+    float cutOff;
+    glm::vec3 diffuse;
+    float outerCutOff;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+    float padding[2];
+};
+
+static_assert(sizeof(PointLight) == 64, "PointLight must match std140 layout");
+static_assert(sizeof(DirLight) == 64, "DirLight must match std140 layout");
+static_assert(sizeof(SpotLight) == 64, "SpotLight must match std140 layout");
+
+// a light whose colours are all zero adds nothing and is skipped by the shaders
+inline bool isLit(const DirLight& light)
+{
+    return light.ambient != glm::vec3(0.0f) || light.diffuse != glm::vec3(0.0f) || light.specular != glm::vec3(0.0f);
+}
+
+inline bool isLit(const SpotLight& light)
+{
+    return light.ambient != glm::vec3(0.0f) || light.diffuse != glm::vec3(0.0f) || light.specular != glm::vec3(0.0f);
+}
+
+// Scene light state, any number of point lights. Bump version after editing
+// so the Lights block and the point lights are re-uploaded.
+struct LightSetup {
+    std::vector<PointLight> pointLights;
+    DirLight dirLight;
+    SpotLight spotLight;
+    unsigned int version = 1;
+};
+
+#endif
@@ -10,60 +10,135 @@
 #include <learnopengl/shader_m.h>
 #include <learnopengl/camera.h>
 
+#include "asteroid_belt.h"
+#include "benchmark.h"
+#include "body_batch.h"
+#include "body_store.h"
+#include "catalog.h"
+#include "depth_mode.h"
+#include "frame_pacing.h"
+#include "frustum.h"
+#include "gbuffer.h"
+#include "gpu_culling.h"
+#include "gpu_nbody.h"
+#include "gpu_scene.h"
+#include "job_system.h"
+#include "light_clusters.h"
+#include "lighting.h"
+#include "nbody.h"
+#include "profiler.h"
+#include "render_target.h"
+#include "scene_benchmark.h"
+#include "shader_variants.h"
+#include "sim_clock.h"
+#include "sphere_lod.h"
+#include "startup_timer.h"
+#include "texture_array.h"
+#include "texture_bake.h"
+#include "texture_streamer.h"
+#include "uniform_buffers.h"
+#include "uniform_cache.h"
+#include "virtual_texture.h"
+
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 #include <cmath>
-
-#define M_PI 3.14159265358979323846
+#include <cstdlib>
+#include <cstring>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
+void parseArguments(int argc, char* argv[]);
 
 // Camera modes
 enum CameraMode { FOLLOW_PLANET, FREE };
 CameraMode cameraMode = FOLLOW_PLANET;
-int followedPlanetIdx = 3; // Start with Earth
+int followedPlanetIdx = 3; // the catalog's "follow" body, Earth by default
+
+// How the lit materials are drawn
+enum RenderPath { RENDER_FORWARD, RENDER_PREPASS, RENDER_DEFERRED };
+
+// The programs that draw the scene's materials one way (shaded, depth only,
+// into the G-buffer) and their per-draw uniforms
+struct MaterialPass {
+    ShaderProgram lighting, emissive, body;
+    ShaderProgram asteroid[2], asteroidOrbit[2], asteroidParticle[2]; // the belt's meshes, then its IMPOSTOR variant
+    int lightingModel = -1, lightingNormalMatrix = -1, lightingUseVirtualTexture = -1, lightingVtLayout = -1;
+    int emissiveModel = -1, asteroidOrbitSpans[2] = { -1, -1 }, asteroidOrbitOffset[2] = { -1, -1 }, asteroidParticleAlpha[2] = { -1, -1 };
+};
 
-unsigned int loadTexture(const char* path);
-void createSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, float radius, unsigned int sectorCount, unsigned int stackCount);
+int bakeTextures();
 
 // settings
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
+unsigned int asteroidCount = 200; // --asteroids <n>, resized at runtime with [ / ]
+BeltMode beltMode = BELT_GPU_ORBIT; // --belt static|orbit|cpu, cycled at runtime with B
+bool benchNormals = false; // --bench-normals: time the vertex stage and exit
+bool benchKernel = false; // --bench-kernel: time the orbit kernel on the CPU and exit
+bool bakeTexturesOnly = false; // --bake-textures: compress the catalog's textures to KTX2 and exit
+MotionModel motionModel = MOTION_CIRCULAR; // --motion circular|nbody|gpu
+bool gpuCull = false; // --gpu-cull: cull the orbiting belt and the batched bodies in compute shaders (4.3)
+double initialTimeScale = 1.0; // --time-scale <x>, sim seconds per real second
+int workerThreads = -1; // --threads <n>, update workers besides the GL thread; -1 = one per extra core
+std::string catalogPath; // --catalog <file>, defaults to resources/catalogs/solar_system.json
+std::string tracePath; // --trace <file>: write the profiler's last frames as Chrome trace JSON at exit
+std::string benchmarkPath; // --benchmark <file>: replay the scripted camera path offscreen, write frame time percentiles (.csv or JSON) and exit
+unsigned int beltSeed = 1; // --seed <n>, the asteroid belt's random seed
+unsigned int beaconLights = 0; // --lights <n>: n small coloured point lights scattered through the belt
+RenderPath renderPath = RENDER_FORWARD; // --render forward|prepass|deferred
+float impostorRadius = 4.0f; // --impostors <px>: belt rocks below this radius on screen are ray-traced quads, 0 = never
+bool reversedDepth = false; // --depth standard|reversed: reversed-Z float depth, no far plane (4.5)
+float targetFrameMs = 0.0f; // --target-ms <ms>: pace frames to this and scale the resolution to keep the GPU within it, 0 = off
 
 // camera
 Camera camera(glm::vec3(0.0f, 5.0f, 20.0f));
+glm::dvec3 cameraOrigin(0.0); // camera.Position in double, the origin of render space
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
-// timing
+// timing: deltaTime is real time and drives the camera; the orbits run on simClock
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+SimClock simClock;
 
-// Sphere mesh data
-std::vector<float> sphereVertices;
-std::vector<unsigned int> sphereIndices;
-
-struct Planet {
-    float orbitRadius;
-    float orbitSpeed; // radians/sec
-    float selfRotateSpeed; // radians/sec
-    float size;
-    glm::vec3 color;
-    unsigned int texture;
-    float orbitAngle; // updated each frame
-};
+// Sphere meshes, one shared VBO/EBO holding every level of detail
+SphereLOD sphereLOD;
+
+// every body in catalog order (parents first); transforms are computed once per frame
+BodyStore bodies;
+
+// gravity simulation of the bodies and, in MOTION_NBODY, the belt
+NBodySystem nbody;
+
+// workers for the per-frame update; the GL thread only maps, waits and draws
+JobSystem jobs;
+
+// CPU and GPU time of each pass, always collected; F3 shows the overlay
+Profiler profiler;
 
-std::vector<Planet> planets;
-glm::vec3 earthPos, moonPos;
+// --target-ms: the display cadence and the scene's resolution
+FramePacer pacer;
 
 // Input state for planet switching
 bool qPressedLast = false;
 bool ePressedLast = false;
 bool wasdPressedLast = false;
+bool bracketLeftPressedLast = false;
+bool bracketRightPressedLast = false;
+bool bPressedLast = false;
+bool pPressedLast = false;
+bool commaPressedLast = false;
+bool periodPressedLast = false;
+bool f3PressedLast = false;
 
 // Orbit camera state for planet focus mode
 float orbitYaw = 0.0f;   // horizontal angle around planet
@@ -71,24 +146,81 @@ float orbitPitch = 20.0f; // vertical angle (degrees)
 float orbitDistance = 3.0f;
 
 void updateCameraFollow();
-
-int main()
+void setupSunLights(LightSetup& lights);
+std::vector<std::string> lightingVariant(const LightSetup& lights);
+void configureMaterial(const ShaderProgram& shader);
+MaterialPass buildMaterialPass(ShaderVariants& variants, const std::vector<std::string>& lit, const std::vector<std::string>& unlit, std::string& error);
+void configureMaterialPass(MaterialPass& pass);
+void startNBody(double time, const AsteroidBelt* belt);
+void startMotion(double time, AsteroidBelt& belt, GpuNBody& gpuBelt);
+
+int main(int argc, char* argv[])
 {
-    // glfw: initialize and configure
+    StartupTimer startupTimer;
+    parseArguments(argc, argv);
+    if (workerThreads < 0)
+        workerThreads = std::thread::hardware_concurrency() > 1 ? static_cast<int>(std::thread::hardware_concurrency()) - 1 : 0;
+    jobs.start(static_cast<unsigned int>(workerThreads));
+    simClock.setTimeScale(initialTimeScale);
+    if (benchKernel) {
+        runOrbitKernelBenchmark(jobs);
+        return 0;
+    }
+    if (bakeTexturesOnly)
+        return bakeTextures();
+
+    // the sphere meshes and the catalog need no GL context: build them on the
+    // workers while GLFW creates the window and the shaders compile
+    if (catalogPath.empty())
+        catalogPath = FileSystem::getPath("resources/catalogs/solar_system.json");
+    JobSystem::Counter startupJobs;
+    Catalog catalog;
+    std::string catalogError;
+    bool catalogLoaded = false;
+    double catalogMs = 0.0;
+    jobs.run(startupJobs, []() { sphereLOD.generate(); });
+    jobs.run(startupJobs, [&]() {
+        std::chrono::steady_clock::time_point catalogStart = std::chrono::steady_clock::now();
+        catalogLoaded = loadCatalog(catalogPath, catalog, catalogError) && !catalog.bodies.empty();
+        catalogMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - catalogStart).count();
+    });
+
+    // glfw: initialize and configure; the GPU N-body belt and GPU culling need
+    // compute shaders (4.3), reversed-Z needs glClipControl (4.5, or
+    // ARB_clip_control on an older context)
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    bool wantCompute = motionModel == MOTION_GPU_NBODY || gpuCull;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, wantCompute || reversedDepth ? 4 : 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, reversedDepth ? 5 : 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-    // glfw window creation
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Solar System Simulator | WASD - FreeCam | Q/E - Next Planet", NULL, NULL);
+    // glfw window creation; the benchmark renders offscreen in a hidden window
+    if (!benchmarkPath.empty())
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    const char* windowTitle = "Solar System Simulator | WASD - FreeCam | Q/E - Next Planet | [/] - Belt Size | B - Belt Mode | P - Pause | ,/. - Time Scale | F3 - Profiler";
+    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, windowTitle, NULL, NULL);
+    if (window == NULL && wantCompute && reversedDepth)
+    {
+        // no 4.5 driver: compute still only needs 4.3, and DepthMode::supported()
+        // then keeps reversed-Z if the driver has ARB_clip_control
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, windowTitle, NULL, NULL);
+    }
+    if (window == NULL && (wantCompute || reversedDepth))
+    {
+        // no 4.x driver: retry with the baseline context and let the capability checks fall back
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, windowTitle, NULL, NULL);
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
+        jobs.wait(startupJobs);
         glfwTerminate();
         return -1;
     }
@@ -97,125 +229,309 @@ int main()
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
 
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // tell GLFW to capture our mouse; frames are presented every so many
+    // refreshes of the display, one unless --target-ms asks for longer frames
+    pacer.targetMs = targetFrameMs;
+    if (benchmarkPath.empty()) {
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        const GLFWvidmode* videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+        glfwSwapInterval(FramePacer::swapInterval(pacer.targetMs, videoMode ? videoMode->refreshRate : 0));
+    }
+    else {
+        glfwSwapInterval(0); // benchmark frames are not held to the display's refresh
+    }
 
     // glad: load all OpenGL function pointers
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
         std::cout << "Failed to initialize GLAD" << std::endl;
+        jobs.wait(startupJobs);
         return -1;
     }
+    startupTimer.phase("window");
+    if (motionModel == MOTION_GPU_NBODY && !GpuNBody::supported())
+    {
+        std::cout << "GPU N-body needs OpenGL 4.3, using the CPU N-body integrator" << std::endl;
+        motionModel = MOTION_NBODY;
+    }
+    if (gpuCull && !GpuBeltCuller::supported())
+    {
+        std::cout << "GPU culling needs OpenGL 4.3, culling on the CPU only" << std::endl;
+        gpuCull = false;
+    }
+    if (reversedDepth && !DepthMode::supported())
+    {
+        std::cout << "Reversed-Z needs OpenGL 4.5 or ARB_clip_control, using the standard depth buffer" << std::endl;
+        reversedDepth = false;
+    }
 
     glEnable(GL_DEPTH_TEST);
-
-    // build and compile our shader program
-    Shader lightingShader("6.multiple_lights.vs", "6.multiple_lights.fs");
+    DepthMode depthMode;
+    depthMode.reversed = reversedDepth;
+    depthMode.setup();
+    profiler.setup();
+
+    // lights are static; the Lights block and the point lights are only
+    // re-uploaded when lights.version changes, the clusters are rebuilt every frame
+    LightSetup lights;
+    setupSunLights(lights);
+
+    // build and compile our shader programs. The lit ones are the variant of
+    // 6.multiple_lights.fs specialized for these lights, emissive bodies get the
+    // UNLIT one; linked programs are cached as binaries across runs. They
+    // compile (on the driver's threads where it can) while the rest of the
+    // scene is set up, and are checked and configured just before the first frame.
+    // --render prepass adds depth-only programs, deferred the G-buffer ones
+    // and the fullscreen lighting pass. REVERSED_Z goes into every variant
+    // that writes or reads depth itself.
+    ShaderVariants shaderVariants;
+    shaderVariants.setup("shader_cache.bin");
+    auto withDepthMode = [&](std::vector<std::string> defines) {
+        if (depthMode.reversed)
+            defines.push_back("REVERSED_Z");
+        return defines;
+    };
+    std::vector<std::string> litVariant = withDepthMode(lightingVariant(lights));
+    std::string shaderError;
+    MaterialPass forwardPass = buildMaterialPass(shaderVariants, litVariant, std::vector<std::string>(1, "UNLIT"), shaderError);
+    MaterialPass depthPass, gbufferPass;
+    ShaderProgram deferredLightingShader;
+    int deferredInverseViewProjection = -1, deferredGBufferScale = -1;
+    if (renderPath == RENDER_PREPASS) {
+        std::vector<std::string> depthOnly = withDepthMode(std::vector<std::string>(1, "DEPTH_ONLY"));
+        depthPass = buildMaterialPass(shaderVariants, depthOnly, depthOnly, shaderError);
+    }
+    if (renderPath == RENDER_DEFERRED) {
+        std::vector<std::string> gbufferUnlit = { "GBUFFER", "UNLIT" };
+        gbufferPass = buildMaterialPass(shaderVariants, withDepthMode(std::vector<std::string>(1, "GBUFFER")), gbufferUnlit, shaderError);
+        std::vector<std::string> lightingPassVariant(litVariant);
+        lightingPassVariant.push_back("DEFERRED_LIGHTING");
+        deferredLightingShader = shaderVariants.get("6.texture_copy.vs", "6.multiple_lights.fs", lightingPassVariant, shaderError);
+    }
     Shader lightCubeShader("6.light_cube.vs", "6.light_cube.fs");
-
-    // create sphere data
-    const unsigned int sectorCount = 64;
-    const unsigned int stackCount = 64;
-    createSphere(sphereVertices, sphereIndices, 1.0f, sectorCount, stackCount);
-
-    // setup sphere VAO/VBO/EBO
-    unsigned int sphereVAO, sphereVBO, sphereEBO;
+    Shader vtFeedbackShader("6.multiple_lights.vs", "6.vt_feedback.fs");
+    Shader textureCopyShader("6.texture_copy.vs", "6.texture_copy.fs");
+
+    // camera and lights are shared uniform blocks; resolve the remaining per-program locations once
+    UniformBuffers uniformBuffers;
+    uniformBuffers.setup();
+    UniformBuffers::bindProgram(lightCubeShader.ID);
+    UniformBuffers::bindProgram(vtFeedbackShader.ID);
+    UniformCache vtFeedbackUniforms(vtFeedbackShader.ID);
+    int vtFeedbackModel = vtFeedbackUniforms["model"];
+    int vtFeedbackNormalMatrix = vtFeedbackUniforms["normalMatrix"];
+    int vtFeedbackLayout = vtFeedbackUniforms["vtLayout"];
+    int vtFeedbackId = vtFeedbackUniforms["vtId"];
+    int vtFeedbackLodBias = vtFeedbackUniforms["lodBias"];
+    int lightCubeModel = UniformCache(lightCubeShader.ID)["model"];
+    startupTimer.phase("shaders");
+
+    // upload the sphere data (all levels of detail) the workers generated
+    jobs.wait(startupJobs);
+    startupTimer.phase("workers");
+    sphereLOD.upload();
+    sphereLOD.impostorRadius = impostorRadius;
+    unsigned int sphereVBO = sphereLOD.VBO;
+    unsigned int sphereEBO = sphereLOD.EBO;
+
+    // setup sphere VAO
+    unsigned int sphereVAO;
     glGenVertexArrays(1, &sphereVAO);
-    glGenBuffers(1, &sphereVBO);
-    glGenBuffers(1, &sphereEBO);
 
     glBindVertexArray(sphereVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(float), &sphereVertices[0], GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(unsigned int), &sphereIndices[0], GL_STATIC_DRAW);
-
-    // position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // normal
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    // texcoord
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-
-    // light cube VAO
-    unsigned int lightCubeVAO;
-    glGenVertexArrays(1, &lightCubeVAO);
-    glBindVertexArray(lightCubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // load textures
-    unsigned int sunTexture = loadTexture(FileSystem::getPath("resources/textures/sun.jpg").c_str());
-    unsigned int mercuryTexture = loadTexture(FileSystem::getPath("resources/textures/mercury.jpg").c_str());
-    unsigned int venusTexture = loadTexture(FileSystem::getPath("resources/textures/venus.jpg").c_str());
-    unsigned int earthTexture = loadTexture(FileSystem::getPath("resources/textures/earth.jpg").c_str());
-    unsigned int moonTexture = loadTexture(FileSystem::getPath("resources/textures/moon.jpg").c_str());
-    unsigned int marsTexture = loadTexture(FileSystem::getPath("resources/textures/mars.jpg").c_str());
-    unsigned int jupiterTexture = loadTexture(FileSystem::getPath("resources/textures/jupiter.jpg").c_str());
-    unsigned int saturnTexture = loadTexture(FileSystem::getPath("resources/textures/saturn.jpg").c_str());
-    unsigned int uranusTexture = loadTexture(FileSystem::getPath("resources/textures/uranus.jpg").c_str());
-    unsigned int neptuneTexture = loadTexture(FileSystem::getPath("resources/textures/neptune.jpg").c_str());
-    unsigned int asteroidTexture = loadTexture(FileSystem::getPath("resources/textures/asteroid.jpg").c_str());
-
-    // Planets: orbitRadius (scaled AU), orbitSpeed, selfRotateSpeed, size, color, texture, orbitAngle
-    // AU scale: 1.0f = 2.5 units (1 AU = 2.5f)
-    planets = {
-        // Sun (center, no orbit)
-        { 0.0f, 0.0f, 0.5f, 0.625f, glm::vec3(1.0f, 0.9f, 0.3f), sunTexture, 0.0f },
-        // Mercury (0.39 AU)
-        { 0.975f, 4.15f, 1.0f, 0.045f, glm::vec3(0.7f, 0.7f, 0.7f), mercuryTexture, 0.0f },
-        // Venus (0.72 AU)
-        { 1.8f, 1.62f, 1.2f, 0.1125f, glm::vec3(1.0f, 0.8f, 0.5f), venusTexture, 0.0f },
-        // Earth (1.00 AU)
-        { 2.5f, 1.0f, 1.5f, 0.125f, glm::vec3(0.5f, 0.7f, 1.0f), earthTexture, 0.0f },
-        // Moon (orbits Earth)
-        { 0.2f, 12.0f, 2.0f, 0.0325f, glm::vec3(0.8f, 0.8f, 0.8f), moonTexture, 0.0f },
-        // Mars (1.52 AU)
-        { 3.8f, 0.53f, 1.0f, 0.0675f, glm::vec3(1.0f, 0.5f, 0.3f), marsTexture, 0.0f },
-        // Jupiter (5.20 AU)
-        { 13.0f, 0.08f, 0.8f, 0.25f, glm::vec3(1.0f, 0.8f, 0.5f), jupiterTexture, 0.0f },
-        // Saturn (9.58 AU)
-        { 23.95f, 0.03f, 0.7f, 0.2125f, glm::vec3(1.0f, 0.9f, 0.6f), saturnTexture, 0.0f },
-        // Uranus (19.18 AU)
-        { 47.95f, 0.011f, 0.6f, 0.15f, glm::vec3(0.7f, 0.9f, 1.0f), uranusTexture, 0.0f },
-        // Neptune (30.07 AU)
-        { 75.175f, 0.006f, 0.5f, 0.145f, glm::vec3(0.5f, 0.7f, 1.0f), neptuneTexture, 0.0f }
-    };
+    SphereLOD::setupAttributes(sphereVBO, sphereEBO); // position, normal, texcoord
+
+
+    if (benchNormals) {
+        runNormalMatrixBenchmark(sphereVAO, sphereLOD);
+        glfwTerminate();
+        return 0;
+    }
+
+    // the body catalog
+    if (!catalogLoaded)
+    {
+        std::cout << "Failed to load catalog " << catalogPath << ": " << catalogError << std::endl;
+        glfwTerminate();
+        return -1;
+    }
+    std::cout << "Loaded " << catalogPath << " with " << catalog.bodies.size() << " bodies in "
+        << catalogMs << " ms" << std::endl;
+
+    // stream textures in behind the first frames; bodies show their catalog colour until then
+    TextureStreamer textures;
+    textures.start(2);
+    bodies.clear();
+    bodies.reserve(catalog.bodies.size());
+    for (size_t i = 0; i < catalog.bodies.size(); ++i) {
+        const CatalogBody& body = catalog.bodies[i];
+        unsigned int texture = 0;
+        if (!body.texture.empty())
+            texture = textures.request(FileSystem::getPath("resources/textures/" + body.texture), body.color);
+        bodies.add(body, texture);
+    }
+    followedPlanetIdx = catalog.followBody;
+
+    // virtual textures for bodies whose high resolution map has been baked to tiles
+    std::vector<std::unique_ptr<VirtualTexture> > virtualTextures;
+    for (size_t i = 0; i < catalog.bodies.size(); ++i) {
+        if (catalog.bodies[i].virtualTexture.empty())
+            continue;
+        std::string vtPath = texture_bake::virtualTexturePath(FileSystem::getPath("resources/textures/" + catalog.bodies[i].virtualTexture));
+        std::unique_ptr<VirtualTexture> vt(new VirtualTexture());
+        std::string vtError;
+        if (!vt->open(vtPath, vtError)) {
+            std::cout << "No virtual texture for " << catalog.bodies[i].name << " (" << vtError << "), run --bake-textures" << std::endl;
+            vt->release();
+            continue;
+        }
+        bodies.virtualTexture[i] = static_cast<int>(virtualTextures.size());
+        virtualTextures.push_back(std::move(vt));
+    }
+    VirtualTextureFeedback vtFeedback;
+    std::vector<std::vector<uint32_t> > vtPages(virtualTextures.size());
+    if (!virtualTextures.empty() && !vtFeedback.setup(SCR_WIDTH, SCR_HEIGHT)) {
+        std::cout << "Virtual texture feedback framebuffer incomplete, using the plain textures" << std::endl;
+        for (size_t v = 0; v < virtualTextures.size(); ++v)
+            virtualTextures[v]->release();
+        virtualTextures.clear();
+        std::fill(bodies.virtualTexture.begin(), bodies.virtualTexture.end(), -1);
+    }
+    unsigned int asteroidTexture = textures.request(FileSystem::getPath("resources/textures/asteroid.jpg"), glm::vec3(0.5f));
+
+    // the other bodies' textures as layers of one array, so they are drawn
+    // in one instanced call per mesh level instead of a bind and draw each
+    std::vector<unsigned int> layerSources;
+    for (size_t i = 0; i < bodies.count(); ++i) {
+        if (bodies.virtualTexture[i] < 0 && !bodies.emissive[i] && std::find(layerSources.begin(), layerSources.end(), bodies.texture[i]) == layerSources.end())
+            layerSources.push_back(bodies.texture[i]);
+    }
+    TextureArray bodyTextures;
+    if (bodyTextures.setup(layerSources, textureCopyShader.ID)) {
+        for (size_t i = 0; i < bodies.count(); ++i)
+            bodies.textureLayer[i] = bodies.virtualTexture[i] < 0 && !bodies.emissive[i] ? bodyTextures.layerOf(bodies.texture[i]) : -1;
+    }
+    else if (!layerSources.empty()) {
+        std::cout << "Cannot hold " << layerSources.size() << " body textures in a texture array, drawing bodies one by one" << std::endl;
+    }
+    BodyBatch bodyBatch;
+    bodyBatch.setup(sphereVBO, sphereEBO);
+
+    // Asteroid belt (instanced, shares the sphere mesh)
+    AsteroidBelt asteroidBelt;
+    asteroidBelt.mode = beltMode;
+    JobSystem::Counter beltJobs;
+    asteroidBelt.setup(sphereVBO, sphereEBO);
+    asteroidBelt.seed = beltSeed;
+    asteroidBelt.generate(asteroidCount);
+    GpuNBody gpuBelt;
+    if (motionModel == MOTION_GPU_NBODY) {
+        std::string gpuError;
+        if (!gpuBelt.setup(sphereVBO, sphereEBO, gpuError)) {
+            std::cout << "GPU N-body unavailable (" << gpuError << "), using the CPU N-body integrator" << std::endl;
+            motionModel = MOTION_NBODY;
+        }
+    }
+    GpuBeltCuller beltCuller;
+    if (gpuCull) {
+        std::string cullError;
+        if (!beltCuller.setup(sphereVBO, sphereEBO, cullError)) {
+            std::cout << "GPU culling unavailable (" << cullError << "), culling on the CPU only" << std::endl;
+            gpuCull = false;
+        }
+    }
+    // the bodies of the texture array: culled, sorted by level and drawn in one
+    // multi-draw on the GPU; everyone else still goes through drawPlanets
+    GpuSceneRenderer gpuScene;
+    bool gpuBodies = false;
+    if (gpuCull) {
+        std::string sceneError;
+        gpuBodies = gpuScene.setup(sphereVBO, sphereEBO, sceneError);
+        if (!gpuBodies)
+            std::cout << "GPU body culling unavailable (" << sceneError << "), batching the bodies on the CPU" << std::endl;
+    }
+    startMotion(simClock.time(), asteroidBelt, gpuBelt);
+
+    LightClusters lightClusters;
+    lightClusters.setup();
+    GBuffer gbuffer;
+    gbuffer.depthFormat = depthMode.depthFormat();
+    if (renderPath == RENDER_DEFERRED && !gbuffer.resize(SCR_WIDTH, SCR_HEIGHT)) {
+        std::cout << "G-buffer framebuffer incomplete, using forward shading" << std::endl;
+        renderPath = RENDER_FORWARD;
+    }
 
-    // Asteroid belt
-    const int asteroidCount = 200;
-    std::vector<glm::vec3> asteroidPositions;
-    std::vector<float> asteroidScales;
-    for (int i = 0; i < asteroidCount; ++i) {
-        float angle = ((float)i / asteroidCount) * glm::two_pi<float>();
-        float radius = 5.5f + static_cast<float>(rand()) / RAND_MAX * 2.5f;
-        float height = (static_cast<float>(rand()) / RAND_MAX - 0.5f) * 0.25f;
-        asteroidPositions.push_back(glm::vec3(
-            cos(angle) * radius,
-            height,
-            sin(angle) * radius
-        ));
-        float scale = 0.02f + static_cast<float>(rand()) / RAND_MAX * 0.0175f;
-        asteroidScales.push_back(scale);
-    }
-
-    // shader configuration
-    lightingShader.use();
-    lightingShader.setInt("material.diffuse", 0);
-    lightingShader.setInt("material.specular", 0); // use same texture for specular
+    // the scene goes into an offscreen target for the benchmark, with
+    // reversed-Z and with dynamic resolution; the window then gets a blit of it
+    RenderTarget sceneTarget;
+    sceneTarget.depthFormat = depthMode.depthFormat();
+    if ((!benchmarkPath.empty() || depthMode.reversed || pacer.enabled()) && !sceneTarget.resize(SCR_WIDTH, SCR_HEIGHT)) {
+        std::cout << "Scene framebuffer incomplete, rendering to the window at full resolution" << std::endl;
+        sceneTarget.release();
+        pacer.targetMs = 0.0f;
+    }
+    startupTimer.phase("scene");
+
+    // the material programs have been building since the shader section;
+    // textures that arrive meanwhile are uploaded instead of waiting
+    while (!shaderVariants.ready()) {
+        textures.update();
+        bodyTextures.refresh(textures.arrivedTextures());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    shaderVariants.finish(shaderError);
+    if (!shaderError.empty())
+        std::cout << "Failed to build a shader variant: " << shaderError << std::endl;
+    shaderVariants.save();
+    configureMaterialPass(forwardPass);
+    if (depthPass.lighting.ID)
+        configureMaterialPass(depthPass);
+    if (gbufferPass.lighting.ID)
+        configureMaterialPass(gbufferPass);
+    if (deferredLightingShader.ID) {
+        configureMaterial(deferredLightingShader);
+        deferredLightingShader.setInt("gAlbedo", 7);
+        deferredLightingShader.setInt("gNormal", 8);
+        deferredLightingShader.setInt("gDepth", 9);
+        UniformCache uniforms(deferredLightingShader.ID);
+        deferredInverseViewProjection = uniforms["inverseViewProjection"];
+        deferredGBufferScale = uniforms["gBufferScale"];
+    }
+    startupTimer.phase("link");
+    std::cout << shaderVariants.compiled << " shader variants compiled" << (shaderVariants.parallel ? " in parallel, " : ", ")
+        << shaderVariants.fromBinary << " loaded from the cache" << std::endl;
+
+    // --benchmark: every texture resident before the first frame, then the
+    // scripted runs rendered offscreen
+    SceneBenchmark benchmark;
+    if (!benchmarkPath.empty()) {
+        while (!textures.idle()) {
+            textures.update();
+            bodyTextures.refresh(textures.arrivedTextures());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        benchmark.start(benchmarkPath, bodies.name);
+    }
 
     // render loop
+    unsigned int frameIndex = 0;
+    std::vector<std::pair<size_t, unsigned int> > emissiveBodies; // body, mesh level
     while (!glfwWindowShouldClose(window))
     {
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        if (benchmark.active())
+            deltaTime = SceneBenchmark::FRAME_SECONDS; // the same simulation however long the frames take
+        profiler.beginFrame();
 
         processInput(window);
+        {
+            ProfileScope scope(profiler, "textures");
+            textures.update();
+            bodyTextures.refresh(textures.arrivedTextures());
+        }
 
         // Camera follow/focus logic
         bool wasdPressed = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS ||
@@ -226,317 +542,715 @@ int main()
         // Planet switching
         bool qPressed = glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS;
         bool ePressed = glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS;
-        int planetCount = static_cast<int>(planets.size());
+        int planetCount = static_cast<int>(bodies.count());
+        int firstFollowable = planetCount > 1 ? 1 : 0; // skip the root (the Sun)
         if (qPressed && !qPressedLast) {
             followedPlanetIdx--;
-            if (followedPlanetIdx < 1) followedPlanetIdx = 9;
+            if (followedPlanetIdx < firstFollowable) followedPlanetIdx = planetCount - 1;
             cameraMode = FOLLOW_PLANET;
         }
         if (ePressed && !ePressedLast) {
             followedPlanetIdx++;
-            if (followedPlanetIdx > 9) followedPlanetIdx = 1;
+            if (followedPlanetIdx > planetCount - 1) followedPlanetIdx = firstFollowable;
             cameraMode = FOLLOW_PLANET;
         }
         qPressedLast = qPressed;
         ePressedLast = ePressed;
 
+        // Belt resizing
+        bool bracketLeftPressed = glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS;
+        bool bracketRightPressed = glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS;
+        if (bracketLeftPressed && !bracketLeftPressedLast && asteroidCount > 1) {
+            asteroidCount /= 2;
+            asteroidBelt.generate(asteroidCount);
+            startMotion(simClock.time(), asteroidBelt, gpuBelt);
+        }
+        if (bracketRightPressed && !bracketRightPressedLast && asteroidCount < (1u << 22)) {
+            asteroidCount = asteroidCount > 0 ? asteroidCount * 2 : 1;
+            asteroidBelt.generate(asteroidCount);
+            startMotion(simClock.time(), asteroidBelt, gpuBelt);
+        }
+        bracketLeftPressedLast = bracketLeftPressed;
+        bracketRightPressedLast = bracketRightPressed;
+
+        // Belt animation mode: static -> GPU orbits -> CPU orbits
+        bool bPressed = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+        if (bPressed && !bPressedLast && motionModel == MOTION_CIRCULAR) {
+            asteroidBelt.setMode(asteroidBelt.mode == BELT_STATIC ? BELT_GPU_ORBIT :
+                asteroidBelt.mode == BELT_GPU_ORBIT ? BELT_CPU_ORBIT : BELT_STATIC);
+        }
+        bPressedLast = bPressed;
+
+        // Simulation speed: pause, halve or double the time scale
+        bool pPressed = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+        bool commaPressed = glfwGetKey(window, GLFW_KEY_COMMA) == GLFW_PRESS;
+        bool periodPressed = glfwGetKey(window, GLFW_KEY_PERIOD) == GLFW_PRESS;
+        if (pPressed && !pPressedLast)
+            simClock.paused = !simClock.paused;
+        if (commaPressed && !commaPressedLast)
+            simClock.setTimeScale(simClock.timeScale * 0.5);
+        if (periodPressed && !periodPressedLast)
+            simClock.setTimeScale(simClock.timeScale * 2.0);
+        if ((pPressed && !pPressedLast) || (commaPressed && !commaPressedLast) || (periodPressed && !periodPressedLast))
+            std::cout << "Time scale " << simClock.timeScale << "x" << (simClock.paused ? " (paused)" : "") << std::endl;
+        pPressedLast = pPressed;
+        commaPressedLast = commaPressed;
+        periodPressedLast = periodPressed;
+
+        // Profiler overlay, with the numbers and the colour key printed once a second while it is shown
+        bool f3Pressed = glfwGetKey(window, GLFW_KEY_F3) == GLFW_PRESS;
+        if (f3Pressed && !f3PressedLast)
+            profiler.overlay = !profiler.overlay;
+        if (profiler.overlay && ((f3Pressed && !f3PressedLast) || static_cast<int>(currentFrame) != static_cast<int>(currentFrame - deltaTime)))
+            profiler.printSummary();
+        f3PressedLast = f3Pressed;
+
         if (cameraMode == FOLLOW_PLANET && wasdPressed && !wasdPressedLast) {
             cameraMode = FREE;
         }
         wasdPressedLast = wasdPressed;
 
+        // Benchmark script: each run restarts the simulation at time 0 with the seeded belt
+        if (benchmark.active()) {
+            const BenchmarkShot& shot = benchmark.shot();
+            if (benchmark.runStarts()) {
+                simClock.reset(0.0);
+                asteroidCount = shot.asteroids;
+                asteroidBelt.generate(asteroidCount);
+                startMotion(0.0, asteroidBelt, gpuBelt);
+            }
+            sphereLOD.pixelError = shot.pixelError;
+            if (shot.follow >= 0) {
+                cameraMode = FOLLOW_PLANET;
+                followedPlanetIdx = shot.follow;
+                orbitYaw = shot.orbitYaw;
+            }
+            else {
+                cameraMode = FREE;
+                camera.Position = shot.position;
+                camera.Front = shot.front;
+                camera.Up = glm::vec3(0.0f, 1.0f, 0.0f);
+            }
+        }
+        // the scene's size this frame: the window's, or the pacer's fraction of
+        // it; the benchmark's is fixed
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        int sceneWidth = benchmark.active() ? SCR_WIDTH : std::max(framebufferWidth, 1);
+        int sceneHeight = benchmark.active() ? SCR_HEIGHT : std::max(framebufferHeight, 1);
+        // the G-buffer, like the scene target, is as large as the window and
+        // only reallocates when the window does
+        if (renderPath == RENDER_DEFERRED && !gbuffer.resize(sceneWidth, sceneHeight)) {
+            std::cout << "G-buffer framebuffer incomplete at " << sceneWidth << "x" << sceneHeight << ", using forward shading" << std::endl;
+            gbuffer.release();
+            renderPath = RENDER_FORWARD;
+        }
+        if (sceneTarget.FBO) {
+            sceneTarget.resize(sceneWidth, sceneHeight);
+            if (!benchmark.active())
+                pacer.update(profiler.lastGpuFrame());
+            sceneWidth = pacer.scaled(sceneWidth);
+            sceneHeight = pacer.scaled(sceneHeight);
+            sceneTarget.bind(sceneWidth, sceneHeight);
+        }
+        else {
+            glViewport(0, 0, sceneWidth, sceneHeight);
+        }
+
         glClearColor(0.02f, 0.02f, 0.08f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Animate planet orbits
-        planets[0].orbitAngle = 0.0f; // Sun doesn't orbit
-        for (size_t i = 1; i < planets.size(); ++i) {
-            planets[i].orbitAngle = currentFrame * planets[i].orbitSpeed;
-        }
-        // Animate moon around earth
-        earthPos = glm::vec3(
-            cos(planets[3].orbitAngle) * planets[3].orbitRadius,
-            0.0f,
-            sin(planets[3].orbitAngle) * planets[3].orbitRadius
-        );
-        moonPos = earthPos + glm::vec3(
-            cos(planets[4].orbitAngle) * planets[4].orbitRadius,
-            0.0f,
-            sin(planets[4].orbitAngle) * planets[4].orbitRadius
-        );
+        // Fixed-step simulation. The circular orbits have no per-step state, they
+        // are evaluated in closed form at the interpolated render time below.
+        double simTime;
+        float alpha;
+        BeltTime beltTime;
+        {
+            ProfileScope scope(profiler, "update");
+            unsigned int simSteps = simClock.advance(deltaTime);
+            std::chrono::steady_clock::time_point stepStart = std::chrono::steady_clock::now();
+            for (unsigned int step = 0; step < simSteps; ++step) {
+                // the rest stays in the backlog; benchmark runs step in full so they stay reproducible
+                if (step > 0 && !benchmark.active() && std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count() > SimClock::STEP_BUDGET)
+                    break;
+                if (motionModel == MOTION_GPU_NBODY && !benchmark.active() && step >= GpuNBody::MAX_STEPS_PER_FRAME)
+                    break; // the GPU time of a step is not in the CPU budget
+                if (motionModel != MOTION_CIRCULAR)
+                    nbody.step(static_cast<float>(SimClock::STEP), jobs);
+                if (motionModel == MOTION_GPU_NBODY)
+                    gpuBelt.step(nbody, static_cast<float>(SimClock::STEP));
+                simClock.finishStep();
+            }
+            simTime = simClock.renderTime();
+            beltTime = AsteroidBelt::orbitTime(simTime);
+
+            // Animate orbits: every world transform, computed once for the renderer and the camera.
+            // The belt fills its instance buffer on the workers while the planets are drawn.
+            alpha = static_cast<float>(simClock.alpha());
+            if (motionModel != MOTION_CIRCULAR) {
+                size_t bodyCount = bodies.count();
+                nbody.interpolate(alpha, 0, bodyCount, bodies.worldPosition.data(), jobs);
+                bodies.updateMatrices(simTime, jobs);
+                if (motionModel == MOTION_NBODY)
+                    asteroidBelt.beginUpdate(jobs, beltJobs, nbody.previousPosition.data() + bodyCount, nbody.position.data() + bodyCount, alpha);
+            }
+            else {
+                bodies.update(simTime, jobs);
+                if (asteroidBelt.mode == BELT_CPU_ORBIT)
+                    asteroidBelt.beginUpdate(jobs, beltJobs, beltTime);
+            }
 
-        // Camera follow logic
-        if (cameraMode == FOLLOW_PLANET) {
-            updateCameraFollow();
-        }
-
-        //Sun and extra point lights around the sun
-        lightingShader.use();
-        lightingShader.setVec3("viewPos", camera.Position);
-        lightingShader.setFloat("material.shininess", 1.0f);
-
-        glm::vec3 sunPos(0.0f, 0.0f, 0.0f);
-
-        // Sun as point light 0
-        lightingShader.setVec3("pointLights[0].position", sunPos);
-        lightingShader.setVec3("pointLights[0].ambient", glm::vec3(0.3f, 0.3f, 0.3f));
-        lightingShader.setVec3("pointLights[0].diffuse", glm::vec3(0.7f, 0.7f, 0.7f));
-        lightingShader.setVec3("pointLights[0].specular", glm::vec3(0.0f, 0.0f, 0.0f));
-        lightingShader.setFloat("pointLights[0].constant", 1.0f);
-        lightingShader.setFloat("pointLights[0].linear", 0.007f);
-        lightingShader.setFloat("pointLights[0].quadratic", 0.0002f);
-
-        // Add 6 extra point lights in a sphere around the sun for even illumination
-        float sunRingRadius = 0.75f;
-        for (int i = 0; i < 6; ++i) {
-            float theta = glm::two_pi<float>() * i / 6.0f;
-            float phi = glm::pi<float>() * (i % 2 == 0 ? 0.33f : 0.66f); // alternate latitude
-            glm::vec3 ringPos = glm::vec3(
-                sin(phi) * cos(theta) * sunRingRadius,
-                cos(phi) * sunRingRadius,
-                sin(phi) * sin(theta) * sunRingRadius
-            );
-            std::string idx = std::to_string(i + 1);
-            lightingShader.setVec3("pointLights[" + idx + "].position", ringPos);
-            lightingShader.setVec3("pointLights[" + idx + "].ambient", glm::vec3(0.15f, 0.15f, 0.15f));
-            lightingShader.setVec3("pointLights[" + idx + "].diffuse", glm::vec3(0.35f, 0.35f, 0.35f));
-            lightingShader.setVec3("pointLights[" + idx + "].specular", glm::vec3(0.0f, 0.0f, 0.0f)); // No reflection
-            lightingShader.setFloat("pointLights[" + idx + "].constant", 1.0f);
-            lightingShader.setFloat("pointLights[" + idx + "].linear", 0.07f);
-            lightingShader.setFloat("pointLights[" + idx + "].quadratic", 0.017f);
-        }
-
-        lightingShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-        lightingShader.setVec3("dirLight.ambient", 0.0f, 0.0f, 0.0f);
-        lightingShader.setVec3("dirLight.diffuse", 0.0f, 0.0f, 0.0f);
-        lightingShader.setVec3("dirLight.specular", 0.0f, 0.0f, 0.0f);
-
-        lightingShader.setVec3("spotLight.position", camera.Position);
-        lightingShader.setVec3("spotLight.direction", camera.Front);
-        lightingShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-        lightingShader.setVec3("spotLight.diffuse", 0.0f, 0.0f, 0.0f);
-        lightingShader.setVec3("spotLight.specular", 0.0f, 0.0f, 0.0f);
-        lightingShader.setFloat("spotLight.constant", 1.0f);
-        lightingShader.setFloat("spotLight.linear", 0.09f);
-        lightingShader.setFloat("spotLight.quadratic", 0.032f);
-        lightingShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(12.5f)));
-        lightingShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(15.0f)));
-
-        // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 250.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
-
-        // Draw planets
-        for (size_t i = 0; i < planets.size(); ++i) {
-            glm::mat4 model = glm::mat4(1.0f);
-            glm::vec3 pos;
-            if (i == 0) {
-                // Sun
-                pos = glm::vec3(0.0f);
+            // Camera follow logic, then the body transforms around the camera
+            if (cameraMode == FOLLOW_PLANET) {
+                updateCameraFollow();
             }
-            else if (i == 4) {
-                // Moon
-                pos = earthPos + glm::vec3(
-                    cos(planets[4].orbitAngle) * planets[4].orbitRadius,
-                    0.0f,
-                    sin(planets[4].orbitAngle) * planets[4].orbitRadius
-                );
+            else {
+                cameraOrigin = glm::dvec3(camera.Position);
             }
-            else if (i == 3) {
-                // Earth
-                pos = earthPos;
+            bodies.rebase(cameraOrigin, jobs);
+        }
+
+        // view/projection transformations. What the GPU draws is in render
+        // space, centred on cameraOrigin, so the view there is a rotation only;
+        // culling, level selection and the light clusters stay in world space.
+        float fovY = glm::radians(camera.Zoom);
+        float aspect = (float)sceneWidth / (float)sceneHeight;
+        glm::mat4 projection = depthMode.projection(fovY, aspect);
+        glm::mat4 view = camera.GetViewMatrix();
+        glm::mat4 renderView = glm::lookAt(glm::vec3(0.0f), camera.Front, camera.Up);
+        Frustum frustum = depthMode.frustum(fovY, aspect, view);
+        {
+            ProfileScope scope(profiler, "light setup");
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            if (LightClusters::used(lights)) {
+                lightClusters.update(lights, view, fovY, aspect, DepthMode::NEAR_PLANE, depthMode.farPlane(), viewport[2], viewport[3]);
+                lightClusters.bind(4);
             }
             else {
-                pos = glm::vec3(
-                    cos(planets[i].orbitAngle) * planets[i].orbitRadius,
-                    0.0f,
-                    sin(planets[i].orbitAngle) * planets[i].orbitRadius
-                );
+                lightClusters.uploadLights(lights); // the N_LIGHTS variant never reads the clusters
+                lightClusters.bindLights(4);
             }
-            model = glm::translate(model, pos);
-            model = glm::rotate(model, currentFrame * planets[i].selfRotateSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::scale(model, glm::vec3(planets[i].size));
-            lightingShader.setMat4("model", model);
-            glBindTexture(GL_TEXTURE_2D, planets[i].texture);
+            uniformBuffers.updateCamera(renderView, projection, glm::vec3(0.0f), camera.Front, lightClusters.params, glm::vec3(cameraOrigin));
+            uniformBuffers.updateLights(lights);
+        }
+
+        // virtual texture feedback: the tiles the visible virtual-textured bodies
+        // sample, read back a frame later and streamed into the tile caches
+        if (!virtualTextures.empty()) {
+            ProfileScope scope(profiler, "vt feedback");
+            vtFeedback.begin();
+            vtFeedbackShader.use();
+            UniformCache::set(vtFeedbackLodBias, vtFeedback.lodBias());
             glBindVertexArray(sphereVAO);
-            glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(sphereIndices.size()), GL_UNSIGNED_INT, 0);
+            for (size_t i = 0; i < bodies.count(); ++i) {
+                int vt = bodies.virtualTexture[i];
+                if (vt < 0 || !frustum.intersectsSphere(bodies.worldPosition[i], bodies.size[i]))
+                    continue;
+                UniformCache::set(vtFeedbackModel, bodies.model[i]);
+                UniformCache::set(vtFeedbackNormalMatrix, bodies.normalMatrix[i]);
+                UniformCache::set(vtFeedbackLayout, virtualTextures[vt]->layout());
+                UniformCache::set(vtFeedbackId, vt + 1);
+                sphereLOD.draw(sphereLOD.select(bodies.size[i], glm::length(bodies.worldPosition[i] - camera.Position), fovY, (float)sceneHeight));
+            }
+            vtFeedback.end(vtPages);
+            for (size_t v = 0; v < virtualTextures.size(); ++v) {
+                virtualTextures[v]->request(vtPages[v], frameIndex);
+                virtualTextures[v]->update(frameIndex);
+            }
         }
 
-        // Draw asteroid belt
-        for (size_t i = 0; i < asteroidPositions.size(); ++i) {
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, asteroidPositions[i]);
-            model = glm::scale(model, glm::vec3(asteroidScales[i]));
-            lightingShader.setMat4("model", model);
-            glBindTexture(GL_TEXTURE_2D, asteroidTexture);
+        // Draw planets, each with the mesh level matching its size on screen. Bodies
+        // in the texture array are queued for the batch (or left to gpuScene with
+        // --gpu-cull); the virtual-textured ones (and every body if the array could
+        // not be built) are drawn one by one, and the emissive ones afterwards with
+        // the unlit variant.
+        auto drawPlanets = [&](const MaterialPass& pass) {
+            emissiveBodies.clear();
+            pass.lighting.use();
             glBindVertexArray(sphereVAO);
-            glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(sphereIndices.size()), GL_UNSIGNED_INT, 0);
+            for (size_t i = 0; i < bodies.count(); ++i) {
+                if (gpuBodies && bodies.textureLayer[i] >= 0)
+                    continue; // culled and drawn by gpuScene
+                if (!frustum.intersectsSphere(bodies.worldPosition[i], bodies.size[i]))
+                    continue;
+                unsigned int lod = sphereLOD.select(bodies.size[i], glm::length(bodies.worldPosition[i] - camera.Position), fovY, (float)sceneHeight);
+                if (bodies.emissive[i]) {
+                    emissiveBodies.push_back(std::make_pair(i, lod));
+                    continue;
+                }
+                if (bodies.textureLayer[i] >= 0) {
+                    bodyBatch.add(bodies, i, lod);
+                    continue;
+                }
+                UniformCache::set(pass.lightingModel, bodies.model[i]);
+                UniformCache::set(pass.lightingNormalMatrix, bodies.normalMatrix[i]);
+                int vt = bodies.virtualTexture[i];
+                if (vt >= 0) {
+                    virtualTextures[vt]->bind(1, 2);
+                    UniformCache::set(pass.lightingVtLayout, virtualTextures[vt]->layout());
+                }
+                UniformCache::set(pass.lightingUseVirtualTexture, vt >= 0 ? 1 : 0);
+                if (vt < 0)
+                    glBindTexture(GL_TEXTURE_2D, bodies.texture[i]);
+                sphereLOD.draw(lod);
+            }
+            pass.body.use();
+            bodyTextures.bind(3);
+            if (gpuBodies)
+                gpuScene.draw();
+            else
+                bodyBatch.draw(sphereLOD);
+            if (!emissiveBodies.empty()) {
+                pass.emissive.use();
+                glBindVertexArray(sphereVAO);
+                for (size_t e = 0; e < emissiveBodies.size(); ++e) {
+                    UniformCache::set(pass.emissiveModel, bodies.model[emissiveBodies[e].first]);
+                    glBindTexture(GL_TEXTURE_2D, bodies.texture[emissiveBodies[e].first]);
+                    sphereLOD.draw(emissiveBodies[e].second);
+                }
+            }
+        };
+
+        // Draw asteroid belt: instanced, culled per grid cell when static or
+        // per rock on the GPU with --gpu-cull (once a frame, on the first pass).
+        // One level for the whole belt, impostors once even its nearest rock is
+        // small; the GPU cull picks impostors per rock instead.
+        auto drawAsteroids = [&](const MaterialPass& pass, bool cull) {
+            glBindTexture(GL_TEXTURE_2D, asteroidTexture);
+            unsigned int beltLod = sphereLOD.selectOrImpostor(AsteroidBelt::MAX_SCALE, AsteroidBelt::nearestDistance(camera.Position), fovY, (float)sceneHeight);
+            int impostors = beltLod == SphereLOD::IMPOSTOR ? 1 : 0;
+            if (motionModel == MOTION_GPU_NBODY) {
+                pass.asteroidParticle[impostors].use();
+                UniformCache::set(pass.asteroidParticleAlpha[impostors], alpha);
+                gpuBelt.draw(sphereLOD, beltLod);
+            }
+            else if (asteroidBelt.mode == BELT_GPU_ORBIT && gpuCull) {
+                if (cull)
+                    beltCuller.cull(asteroidBelt, beltTime, frustum, sphereLOD, impostors ? 0 : beltLod, camera.Position, fovY, (float)sceneHeight);
+                pass.asteroidParticle[0].use();
+                UniformCache::set(pass.asteroidParticleAlpha[0], 0.0f);
+                beltCuller.drawMeshes();
+                pass.asteroidParticle[1].use();
+                UniformCache::set(pass.asteroidParticleAlpha[1], 0.0f);
+                beltCuller.drawImpostors();
+            }
+            else if (asteroidBelt.mode == BELT_GPU_ORBIT) {
+                pass.asteroidOrbit[impostors].use();
+                UniformCache::set(pass.asteroidOrbitSpans[impostors], beltTime.spans);
+                UniformCache::set(pass.asteroidOrbitOffset[impostors], beltTime.offset);
+                asteroidBelt.draw(sphereLOD, beltLod);
+            }
+            else if (asteroidBelt.mode == BELT_STATIC) {
+                pass.asteroid[impostors].use();
+                asteroidBelt.drawVisible(sphereLOD, beltLod, frustum);
+            }
+            else {
+                asteroidBelt.finishUpdate(jobs, beltJobs);
+                pass.asteroid[impostors].use();
+                asteroidBelt.draw(sphereLOD, beltLod);
+            }
+        };
+
+        if (gpuBodies) {
+            ProfileScope scope(profiler, "body cull");
+            gpuScene.cull(bodies, frustum, sphereLOD, camera.Position, fovY, (float)sceneHeight);
+        }
+
+        if (renderPath == RENDER_DEFERRED) {
+            {
+                ProfileScope scope(profiler, "gbuffer");
+                gbuffer.begin(sceneWidth, sceneHeight);
+                drawPlanets(gbufferPass);
+                drawAsteroids(gbufferPass, true);
+                gbuffer.end();
+            }
+            ProfileScope scope(profiler, "deferred lighting");
+            deferredLightingShader.use();
+            UniformCache::set(deferredInverseViewProjection, glm::inverse(projection * renderView));
+            UniformCache::set(deferredGBufferScale, gbuffer.usedScale());
+            gbuffer.light(deferredLightingShader.ID, 7);
+        }
+        else {
+            // the pre-pass lays down the final depth with trivial fragments, so the
+            // lit pass below shades each pixel once (depth test less or equal, no writes)
+            if (renderPath == RENDER_PREPASS) {
+                ProfileScope scope(profiler, "depth prepass");
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                drawPlanets(depthPass);
+                drawAsteroids(depthPass, true);
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glDepthFunc(depthMode.lessEqual());
+                glDepthMask(GL_FALSE);
+            }
+            {
+                ProfileScope scope(profiler, "planets");
+                drawPlanets(forwardPass);
+            }
+            {
+                ProfileScope scope(profiler, "asteroids");
+                drawAsteroids(forwardPass, renderPath != RENDER_PREPASS);
+            }
+            glDepthFunc(depthMode.less());
+            glDepthMask(GL_TRUE);
         }
 
         // Draw the sun as a light source
-        lightCubeShader.use();
-        lightCubeShader.setMat4("projection", projection);
-        lightCubeShader.setMat4("view", view);
-        glBindVertexArray(lightCubeVAO);
-        glm::mat4 sunLightModel = glm::mat4(1.0f);
-        sunLightModel = glm::scale(sunLightModel, glm::vec3(0.075f));
-        lightCubeShader.setMat4("model", sunLightModel);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(sphereIndices.size()), GL_UNSIGNED_INT, 0);
+        if (frustum.intersectsSphere(glm::vec3(0.0f), 0.075f)) {
+            ProfileScope scope(profiler, "sun");
+            lightCubeShader.use();
+            glBindVertexArray(sphereVAO); // 6.light_cube.vs reads the position only
+            glm::mat4 sunLightModel = glm::translate(glm::mat4(1.0f), glm::vec3(-cameraOrigin));
+            sunLightModel = glm::scale(sunLightModel, glm::vec3(0.075f));
+            UniformCache::set(lightCubeModel, sunLightModel);
+            sphereLOD.draw(sphereLOD.select(0.075f, glm::length(camera.Position), fovY, (float)sceneHeight));
+        }
 
+        if (sceneTarget.FBO && !benchmark.active())
+            sceneTarget.present(framebufferWidth, framebufferHeight);
+        profiler.drawOverlay(framebufferWidth, framebufferHeight);
+        profiler.endFrame();
+
+        // benchmark frame time: CPU start to GPU done
+        if (benchmark.active()) {
+            glFinish();
+            benchmark.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+            if (!benchmark.active()) {
+                std::vector<BenchmarkResult> results = benchmark.results();
+                for (size_t r = 0; r < results.size(); ++r) {
+                    if (results[r].segment == "all")
+                        std::cout << "Benchmark " << results[r].asteroids << " asteroids, pixel error " << results[r].pixelError << ": p50 "
+                            << results[r].p50 << " ms, p95 " << results[r].p95 << " ms, p99 " << results[r].p99 << " ms" << std::endl;
+                }
+                std::string benchmarkError;
+                if (benchmark.write(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), benchmarkError))
+                    std::cout << "Wrote benchmark results to " << benchmarkPath << std::endl;
+                else
+                    std::cout << "Failed to write benchmark results: " << benchmarkError << std::endl;
+                glfwSetWindowShouldClose(window, true);
+            }
+        }
+
+        ++frameIndex;
         glfwSwapBuffers(window);
         glfwPollEvents();
+        if (frameIndex == 1) {
+            startupTimer.phase("first frame");
+            startupTimer.report();
+        }
+    }
+
+    if (!tracePath.empty()) {
+        if (profiler.writeChromeTrace(tracePath))
+            std::cout << "Wrote the profile of the last " << profiler.storedFrames() << " frames to " << tracePath << std::endl;
+        else
+            std::cout << "Failed to write profile trace " << tracePath << std::endl;
     }
 
     glDeleteVertexArrays(1, &sphereVAO);
-    glDeleteVertexArrays(1, &lightCubeVAO);
-    glDeleteBuffers(1, &sphereVBO);
-    glDeleteBuffers(1, &sphereEBO);
+    asteroidBelt.release();
+    bodyBatch.release();
+    bodyTextures.release();
+    gpuBelt.release();
+    textures.release();
+    beltCuller.release();
+    gpuScene.release();
+    for (size_t v = 0; v < virtualTextures.size(); ++v)
+        virtualTextures[v]->release();
+    vtFeedback.release();
+    sceneTarget.release();
+    sphereLOD.release();
+    uniformBuffers.release();
+    shaderVariants.release();
+    lightClusters.release();
+    gbuffer.release();
+    profiler.release();
+    jobs.stop();
 
     glfwTerminate();
     return 0;
 }
 
-// Camera follow logic
-void updateCameraFollow()
+// Sun and extra point lights around the sun
+void setupSunLights(LightSetup& lights)
 {
-    int idx = followedPlanetIdx;
-    glm::vec3 pos;
-    if (idx == 4) {
-        pos = earthPos + glm::vec3(
-            cos(planets[4].orbitAngle) * planets[4].orbitRadius,
-            0.0f,
-            sin(planets[4].orbitAngle) * planets[4].orbitRadius
+    glm::vec3 sunPos(0.0f, 0.0f, 0.0f);
+
+    // Sun as point light 0
+    PointLight sun;
+    sun.position = sunPos;
+    sun.ambient = glm::vec3(0.3f, 0.3f, 0.3f);
+    sun.diffuse = glm::vec3(0.7f, 0.7f, 0.7f);
+    sun.specular = glm::vec3(0.0f, 0.0f, 0.0f);
+    sun.constant = 1.0f;
+    sun.linear = 0.007f;
+    sun.quadratic = 0.0002f;
+    lights.pointLights.clear();
+    lights.pointLights.push_back(sun);
+
+    // Add 6 extra point lights in a sphere around the sun for even illumination
+    float sunRingRadius = 0.75f;
+    for (int i = 0; i < 6; ++i) {
+        float theta = glm::two_pi<float>() * i / 6.0f;
+        float phi = glm::pi<float>() * (i % 2 == 0 ? 0.33f : 0.66f); // alternate latitude
+        PointLight ring;
+        ring.position = glm::vec3(
+            sin(phi) * cos(theta) * sunRingRadius,
+            cos(phi) * sunRingRadius,
+            sin(phi) * sin(theta) * sunRingRadius
         );
+        ring.ambient = glm::vec3(0.15f, 0.15f, 0.15f);
+        ring.diffuse = glm::vec3(0.35f, 0.35f, 0.35f);
+        ring.specular = glm::vec3(0.0f, 0.0f, 0.0f); // No reflection
+        ring.constant = 1.0f;
+        ring.linear = 0.07f;
+        ring.quadratic = 0.017f;
+        lights.pointLights.push_back(ring);
     }
-    else if (idx == 3) {
-        pos = earthPos;
-    }
-    else {
-        pos = glm::vec3(
-            cos(planets[idx].orbitAngle) * planets[idx].orbitRadius,
-            0.0f,
-            sin(planets[idx].orbitAngle) * planets[idx].orbitRadius
-        );
+
+    // --lights: beacons at fixed pseudo-random spots in the belt, each reaching about one unit
+    uint32_t state = 12345;
+    for (unsigned int i = 0; i < beaconLights; ++i) {
+        float values[5];
+        for (int v = 0; v < 5; ++v) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            values[v] = (state >> 8) * (1.0f / 16777216.0f);
+        }
+        float angle = glm::two_pi<float>() * values[0];
+        float radius = AsteroidBelt::INNER_RADIUS + values[1] * (AsteroidBelt::OUTER_RADIUS - AsteroidBelt::INNER_RADIUS);
+        PointLight beacon;
+        beacon.position = glm::vec3(cos(angle) * radius, (values[2] - 0.5f) * 0.4f, sin(angle) * radius);
+        beacon.ambient = glm::vec3(0.0f);
+        beacon.diffuse = glm::vec3(values[3], values[4], 1.0f - values[3]) * 0.6f;
+        beacon.specular = glm::vec3(0.0f);
+        beacon.constant = 1.0f;
+        beacon.linear = 0.0f;
+        beacon.quadratic = 150.0f;
+        lights.pointLights.push_back(beacon);
     }
-    // Orbit camera around the planet
-    float yawRad = glm::radians(orbitYaw);
-    float pitchRad = glm::radians(glm::clamp(orbitPitch, -89.0f, 89.0f));
-    float r = orbitDistance + planets[idx].size * 4.0f;
-    glm::vec3 offset;
-    offset.x = r * cos(pitchRad) * sin(yawRad);
-    offset.y = r * sin(pitchRad);
-    offset.z = r * cos(pitchRad) * cos(yawRad);
-    camera.Position = pos + offset;
-    camera.Front = glm::normalize(pos - camera.Position);
-    camera.Up = glm::vec3(0.0f, 1.0f, 0.0f);
+
+    lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+    lights.dirLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.dirLight.diffuse = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.dirLight.specular = glm::vec3(0.0f, 0.0f, 0.0f);
+
+    // the flashlight's position/direction are the camera's (Camera block)
+    lights.spotLight.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.spotLight.diffuse = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.spotLight.specular = glm::vec3(0.0f, 0.0f, 0.0f);
+    lights.spotLight.constant = 1.0f;
+    lights.spotLight.linear = 0.09f;
+    lights.spotLight.quadratic = 0.032f;
+    lights.spotLight.cutOff = glm::cos(glm::radians(12.5f));
+    lights.spotLight.outerCutOff = glm::cos(glm::radians(15.0f));
+
+    lights.version++;
 }
 
-// Sphere generation: position, normal, texcoord (8 floats per vertex)
-void createSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, float radius, unsigned int sectorCount, unsigned int stackCount)
+// Samplers and material constants of a program built from 6.multiple_lights.fs
+void configureMaterial(const ShaderProgram& shader)
 {
-    float x, y, z, xy;
-    float nx, ny, nz, lengthInv = 1.0f / radius;
-    float s, t;
+    UniformBuffers::bindProgram(shader.ID);
+    shader.use();
+    shader.setInt("material.diffuse", 0);
+    shader.setInt("material.specular", 0); // use same texture for specular
+    shader.setFloat("material.shininess", 1.0f);
+    shader.setInt("vtPageTable", 1);
+    shader.setInt("vtTileCache", 2);
+    shader.setInt("bodyTextures", 3);
+    shader.setInt("pointLightData", 4);
+    shader.setInt("clusterGrid", 5);
+    shader.setInt("clusterLights", 6);
+}
 
-    float sectorStep = 2 * M_PI / sectorCount;
-    float stackStep = M_PI / stackCount;
-    float sectorAngle, stackAngle;
+// Every material program of one pass, with the lit variant for the bodies and
+// the belt and the unlit one for the emissive bodies. They are only started
+// here; configureMaterialPass() once ShaderVariants::finish() has linked them.
+MaterialPass buildMaterialPass(ShaderVariants& variants, const std::vector<std::string>& lit, const std::vector<std::string>& unlit, std::string& error)
+{
+    MaterialPass pass;
+    pass.lighting = variants.get("6.multiple_lights.vs", "6.multiple_lights.fs", lit, error);
+    pass.emissive = variants.get("6.multiple_lights.vs", "6.multiple_lights.fs", unlit, error);
+    pass.body = variants.get("6.multiple_lights_bodies.vs", "6.multiple_lights.fs", lit, error);
+    std::vector<std::string> impostor(lit);
+    impostor.push_back("IMPOSTOR");
+    const std::vector<std::string>* belt[2] = { &lit, &impostor };
+    for (int i = 0; i < 2; ++i) {
+        pass.asteroid[i] = variants.get("6.multiple_lights_instanced.vs", "6.multiple_lights.fs", *belt[i], error);
+        pass.asteroidOrbit[i] = variants.get("6.asteroid_orbit.vs", "6.multiple_lights.fs", *belt[i], error);
+        pass.asteroidParticle[i] = variants.get("6.asteroid_particles.vs", "6.multiple_lights.fs", *belt[i], error);
+    }
+    return pass;
+}
 
-    for (unsigned int i = 0; i <= stackCount; ++i)
-    {
-        stackAngle = M_PI / 2 - i * stackStep;
-        xy = radius * cosf(stackAngle);
-        y = radius * sinf(stackAngle);
+// Texture units and uniform locations of a pass's linked programs
+void configureMaterialPass(MaterialPass& pass)
+{
+    const ShaderProgram* programs[] = { &pass.lighting, &pass.emissive, &pass.body, &pass.asteroid[0], &pass.asteroidOrbit[0],
+        &pass.asteroidParticle[0], &pass.asteroid[1], &pass.asteroidOrbit[1], &pass.asteroidParticle[1] };
+    for (const ShaderProgram* shader : programs)
+        configureMaterial(*shader);
+    for (int i = 0; i < 2; ++i) {
+        UniformCache orbit(pass.asteroidOrbit[i].ID);
+        pass.asteroidOrbitSpans[i] = orbit["timeSpans"];
+        pass.asteroidOrbitOffset[i] = orbit["timeOffset"];
+        pass.asteroidParticleAlpha[i] = UniformCache(pass.asteroidParticle[i].ID)["alpha"];
+    }
+    UniformCache lighting(pass.lighting.ID);
+    pass.lightingModel = lighting["model"];
+    pass.lightingNormalMatrix = lighting["normalMatrix"];
+    pass.lightingUseVirtualTexture = lighting["useVirtualTexture"];
+    pass.lightingVtLayout = lighting["vtLayout"];
+    pass.emissiveModel = UniformCache(pass.emissive.ID)["model"];
+}
 
-        for (unsigned int j = 0; j <= sectorCount; ++j)
-        {
-            sectorAngle = j * sectorStep;
-            x = xy * cosf(sectorAngle);
-            z = xy * sinf(sectorAngle);
+// The cheapest variant of 6.multiple_lights.fs that is still exact for these lights
+std::vector<std::string> lightingVariant(const LightSetup& lights)
+{
+    std::vector<std::string> defines;
+    if (!isLit(lights.dirLight))
+        defines.push_back("NO_DIR");
+    if (!isLit(lights.spotLight))
+        defines.push_back("NO_SPOT");
+    if (!LightClusters::used(lights))
+        defines.push_back("N_LIGHTS " + std::to_string(lights.pointLights.size()));
+    return defines;
+}
 
-            nx = x * lengthInv;
-            ny = y * lengthInv;
-            nz = z * lengthInv;
-            s = 1.0f - (float)j / sectorCount;
-            t = 1.0f - (float)i / stackCount;
+// (Re)start the selected motion model from the circular orbits at the given time
+void startMotion(double time, AsteroidBelt& belt, GpuNBody& gpuBelt)
+{
+    if (motionModel == MOTION_NBODY) {
+        belt.setMode(BELT_CPU_ORBIT); // rocks go where the simulation puts them
+        startNBody(time, &belt);
+    }
+    else if (motionModel == MOTION_GPU_NBODY) {
+        startNBody(time, NULL); // the rocks live on the GPU
+        gpuBelt.seed(belt.elements, AsteroidBelt::orbitTime(time), nbody);
+    }
+}
 
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-            vertices.push_back(nx);
-            vertices.push_back(ny);
-            vertices.push_back(nz);
-            vertices.push_back(s);
-            vertices.push_back(t);
+// Seed the N-body mode from the circular orbits at the given time. A body without
+// a catalog mass gets the GM its moons' orbits imply (the median of w^2 r^3), and
+// every body starts at the circular speed around its parent, so orbits the
+// catalog gives non-Keplerian speeds for come out slightly elliptical.
+// The belt's rocks are added after the bodies when belt is given.
+void startNBody(double time, const AsteroidBelt* belt)
+{
+    const float ASTEROID_GM = 1.0e-9f;  // the largest rock; the rest scale with volume
+    size_t n = bodies.count();
+    bodies.update(time);
+
+    std::vector<std::vector<float> > implied(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (bodies.parent[i] >= 0 && bodies.orbitRadius[i] > 0.0f && bodies.orbitSpeed[i] != 0.0f) {
+            float r = bodies.orbitRadius[i];
+            implied[bodies.parent[i]].push_back(bodies.orbitSpeed[i] * bodies.orbitSpeed[i] * r * r * r);
         }
     }
+    std::vector<float> gm(bodies.mass);
+    for (size_t i = 0; i < n; ++i) {
+        if (gm[i] > 0.0f)
+            continue;
+        if (implied[i].empty()) {
+            gm[i] = NBodySystem::LEAF_GM;
+            continue;
+        }
+        std::nth_element(implied[i].begin(), implied[i].begin() + implied[i].size() / 2, implied[i].end());
+        gm[i] = implied[i][implied[i].size() / 2];
+    }
 
-    unsigned int k1, k2;
-    for (unsigned int i = 0; i < stackCount; ++i)
-    {
-        k1 = i * (sectorCount + 1);
-        k2 = k1 + sectorCount + 1;
-
-        for (unsigned int j = 0; j < sectorCount; ++j, ++k1, ++k2)
-        {
-            if (i != 0)
-            {
-                indices.push_back(k1);
-                indices.push_back(k2);
-                indices.push_back(k1 + 1);
-            }
-            if (i != (stackCount - 1))
-            {
-                indices.push_back(k1 + 1);
-                indices.push_back(k2);
-                indices.push_back(k2 + 1);
-            }
+    nbody.clear();
+    std::vector<glm::vec3> velocity(n, glm::vec3(0.0f));
+    for (size_t i = 0; i < n; ++i) {
+        int parent = bodies.parent[i];
+        if (parent >= 0 && bodies.orbitRadius[i] > 0.0f) {
+            float angle = bodies.orbitAngle[i];
+            float direction = bodies.orbitSpeed[i] < 0.0f ? -1.0f : 1.0f;
+            float speed = sqrt(gm[parent] / bodies.orbitRadius[i]) * direction;
+            velocity[i] = velocity[parent] + glm::vec3(-sin(angle), 0.0f, cos(angle)) * speed;
+        }
+        else if (parent >= 0) {
+            velocity[i] = velocity[parent];
         }
+        nbody.add(bodies.worldPosition[i], velocity[i], gm[i]);
+    }
+    BeltTime beltTime = AsteroidBelt::orbitTime(time);
+    for (size_t i = 0; belt && i < belt->elements.size(); ++i) {
+        const AsteroidElements& e = belt->elements[i];
+        float volume = e.scale / AsteroidBelt::MAX_SCALE;
+        nbody.add(AsteroidBelt::positionAt(e, beltTime), AsteroidBelt::velocityAt(e, beltTime), ASTEROID_GM * volume * volume * volume);
     }
+    nbody.start(jobs);
 }
 
-unsigned int loadTexture(const char* path)
+// Camera follow logic
+void updateCameraFollow()
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    int idx = followedPlanetIdx;
+    glm::dvec3 pos = bodies.position[idx];
+    // Orbit camera around the planet
+    float yawRad = glm::radians(orbitYaw);
+    float pitchRad = glm::radians(glm::clamp(orbitPitch, -89.0f, 89.0f));
+    float r = orbitDistance + bodies.size[idx] * 4.0f;
+    glm::vec3 offset;
+    offset.x = r * cos(pitchRad) * sin(yawRad);
+    offset.y = r * sin(pitchRad);
+    offset.z = r * cos(pitchRad) * cos(yawRad);
+    cameraOrigin = pos + glm::dvec3(offset);
+    camera.Position = glm::vec3(cameraOrigin);
+    camera.Front = glm::normalize(-offset);
+    camera.Up = glm::vec3(0.0f, 1.0f, 0.0f);
+}
 
-    int width, height, nrComponents;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+// --bake-textures: every texture of the catalog plus the belt's, and every
+// virtualTexture as tiles, next to its source
+int bakeTextures()
+{
+    if (catalogPath.empty())
+        catalogPath = FileSystem::getPath("resources/catalogs/solar_system.json");
+    Catalog catalog;
+    std::string error;
+    if (!loadCatalog(catalogPath, catalog, error))
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-        else
-            format = GL_RGB;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-        stbi_image_free(data);
-        std::cout << "Loaded " << path << " with " << nrComponents << " channels" << std::endl;
+        std::cout << "Failed to load catalog " << catalogPath << ": " << error << std::endl;
+        return -1;
     }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+    std::vector<std::string> textures(1, "asteroid.jpg");
+    for (size_t i = 0; i < catalog.bodies.size(); ++i) {
+        const std::string& texture = catalog.bodies[i].texture;
+        if (!texture.empty() && std::find(textures.begin(), textures.end(), texture) == textures.end())
+            textures.push_back(texture);
     }
-
-    return textureID;
+    int failed = 0;
+    for (size_t i = 0; i < textures.size(); ++i) {
+        std::string source = FileSystem::getPath("resources/textures/" + textures[i]);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!texture_bake::bakeTexture(source, jobs, error)) {
+            std::cout << "Failed to bake " << source << ": " << error << std::endl;
+            ++failed;
+            continue;
+        }
+        std::cout << "Baked " << texture_bake::bakedPath(source) << " (" << texture_bake::fileBytes(texture_bake::bakedPath(source)) / 1024 << " KB) in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+    }
+    // high resolution maps become virtual texture tiles instead
+    for (size_t i = 0; i < catalog.bodies.size(); ++i) {
+        if (catalog.bodies[i].virtualTexture.empty())
+            continue;
+        std::string source = FileSystem::getPath("resources/textures/" + catalog.bodies[i].virtualTexture);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!texture_bake::bakeVirtualTexture(source, jobs, error)) {
+            std::cout << "Failed to bake " << source << ": " << error << std::endl;
+            ++failed;
+            continue;
+        }
+        std::cout << "Baked " << texture_bake::virtualTexturePath(source) << " (" << texture_bake::fileBytes(texture_bake::virtualTexturePath(source)) / (1024 * 1024) << " MB) in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+    }
+    return failed ? -1 : 0;
 }
 
 void processInput(GLFWwindow* window)
@@ -556,6 +1270,61 @@ void processInput(GLFWwindow* window)
     }
 }
 
+// Command line: --asteroids <n> --belt static|orbit|cpu --motion circular|nbody|gpu --gpu-cull --time-scale <x> --threads <n> --bench-normals --bench-kernel --bake-textures --catalog <file> --trace <file> --benchmark <file> --seed <n> --lights <n> --render forward|prepass|deferred --impostors <px> --depth standard|reversed --target-ms <ms>
+void parseArguments(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--asteroids") == 0 && i + 1 < argc)
+            asteroidCount = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+        else if (std::strcmp(argv[i], "--belt") == 0 && i + 1 < argc)
+        {
+            const char* mode = argv[++i];
+            beltMode = std::strcmp(mode, "static") == 0 ? BELT_STATIC : std::strcmp(mode, "cpu") == 0 ? BELT_CPU_ORBIT : BELT_GPU_ORBIT;
+        }
+        else if (std::strcmp(argv[i], "--motion") == 0 && i + 1 < argc)
+        {
+            const char* motion = argv[++i];
+            motionModel = std::strcmp(motion, "nbody") == 0 ? MOTION_NBODY : std::strcmp(motion, "gpu") == 0 ? MOTION_GPU_NBODY : MOTION_CIRCULAR;
+        }
+        else if (std::strcmp(argv[i], "--gpu-cull") == 0)
+            gpuCull = true;
+        else if (std::strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc)
+            initialTimeScale = std::strtod(argv[++i], NULL);
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            workerThreads = static_cast<int>(std::strtoul(argv[++i], NULL, 10));
+        else if (std::strcmp(argv[i], "--bench-normals") == 0)
+            benchNormals = true;
+        else if (std::strcmp(argv[i], "--bench-kernel") == 0)
+            benchKernel = true;
+        else if (std::strcmp(argv[i], "--bake-textures") == 0)
+            bakeTexturesOnly = true;
+        else if (std::strcmp(argv[i], "--catalog") == 0 && i + 1 < argc)
+            catalogPath = argv[++i];
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (std::strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+            benchmarkPath = argv[++i];
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            beltSeed = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+        else if (std::strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            beaconLights = static_cast<unsigned int>(std::strtoul(argv[++i], NULL, 10));
+        else if (std::strcmp(argv[i], "--render") == 0 && i + 1 < argc)
+        {
+            const char* path = argv[++i];
+            renderPath = std::strcmp(path, "prepass") == 0 ? RENDER_PREPASS : std::strcmp(path, "deferred") == 0 ? RENDER_DEFERRED : RENDER_FORWARD;
+        }
+        else if (std::strcmp(argv[i], "--impostors") == 0 && i + 1 < argc)
+            impostorRadius = std::strtof(argv[++i], NULL);
+        else if (std::strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+            reversedDepth = std::strcmp(argv[++i], "reversed") == 0;
+        else if (std::strcmp(argv[i], "--target-ms") == 0 && i + 1 < argc)
+            targetFrameMs = std::strtof(argv[++i], NULL);
+        else
+            std::cout << "Ignoring unknown argument: " << argv[i] << std::endl;
+    }
+}
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
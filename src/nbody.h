@@ -0,0 +1,271 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// How bodies and asteroids move
+enum MotionModel { MOTION_CIRCULAR, MOTION_NBODY, MOTION_GPU_NBODY };
+
+// Self-gravitating particles integrated with kick-drift-kick leapfrog.
+// Accelerations come from a Barnes-Hut octree rebuilt every step: cells that
+// look smaller than theta from a particle are taken as one point mass at their
+// centre of mass, so a step costs O(N log N) instead of O(N^2).
+// Masses are GM in scene units (units^3 / s^2), the same as AsteroidBelt::SUN_GM.
+class NBodySystem
+{
+public:
+    static constexpr float SOFTENING = 0.01f;   // scene units, keeps close passes finite
+    static constexpr unsigned int LEAF_SIZE = 8; // particles per leaf before it splits
+    static constexpr unsigned int MAX_DEPTH = 32;
+    static constexpr float LEAF_GM = 1.0e-6f;    // bodies nothing orbits: nearly test particles
+
+    float theta = 0.5f; // opening angle, 0 is direct summation
+
+    std::vector<glm::vec3> position;
+    std::vector<glm::vec3> previousPosition; // at the start of the last step, for interpolation
+    std::vector<glm::vec3> velocity;
+    std::vector<glm::vec3> acceleration;
+    std::vector<float> mass;
+
+    size_t count() const
+    {
+        return position.size();
+    }
+
+    void clear()
+    {
+        position.clear();
+        previousPosition.clear();
+        velocity.clear();
+        acceleration.clear();
+        mass.clear();
+    }
+
+    size_t add(const glm::vec3& p, const glm::vec3& v, float m)
+    {
+        position.push_back(p);
+        previousPosition.push_back(p);
+        velocity.push_back(v);
+        acceleration.push_back(glm::vec3(0.0f));
+        mass.push_back(m);
+        return position.size() - 1;
+    }
+
+    // call after adding every particle: removes the net momentum so the system
+    // does not drift away, then computes the first accelerations
+    void start(JobSystem& jobs)
+    {
+        glm::vec3 momentum(0.0f);
+        float totalMass = 0.0f;
+        for (size_t i = 0; i < count(); ++i)
+        {
+            momentum += velocity[i] * mass[i];
+            totalMass += mass[i];
+        }
+        if (totalMass > 0.0f)
+        {
+            glm::vec3 drift = momentum / totalMass;
+            for (size_t i = 0; i < count(); ++i)
+                velocity[i] -= drift;
+        }
+        buildTree();
+        jobs.parallelFor(count(), 1024, [this](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k)
+                acceleration[order[k]] = accelerationAt(order[k]);
+        });
+    }
+
+    // one leapfrog step: half kick, drift, new forces, half kick
+    void step(float dt, JobSystem& jobs)
+    {
+        float halfDt = 0.5f * dt;
+        jobs.parallelFor(count(), 4096, [this, dt, halfDt](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                previousPosition[i] = position[i];
+                velocity[i] += acceleration[i] * halfDt;
+                position[i] += velocity[i] * dt;
+            }
+        });
+        buildTree();
+        // walk particles in tree order: neighbours open the same cells
+        jobs.parallelFor(count(), 1024, [this, halfDt](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k)
+            {
+                unsigned int i = order[k];
+                acceleration[i] = accelerationAt(i);
+                velocity[i] += acceleration[i] * halfDt;
+            }
+        });
+    }
+
+    // positions alpha of the way through the last step, for particles [first, first + n)
+    void interpolate(float alpha, size_t first, size_t n, glm::vec3* out, JobSystem& jobs) const
+    {
+        jobs.parallelFor(n, 16384, [this, alpha, first, out](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                out[i] = glm::mix(previousPosition[first + i], position[first + i], alpha);
+        });
+    }
+
+private:
+    struct Node {
+        glm::vec3 center;
+        float halfSize;
+        glm::vec3 centerOfMass;
+        float mass;
+        int firstChild; // 8 consecutive nodes, -1 for a leaf
+        unsigned int begin, end; // particles in order[begin, end)
+    };
+
+    std::vector<Node> nodes;
+    std::vector<unsigned int> order;   // particle indices grouped by node
+    std::vector<unsigned int> scratch;
+    std::vector<glm::vec3> sortedPosition; // position[order[k]], so leaves read contiguous memory
+    std::vector<float> sortedMass;
+
+    void buildTree()
+    {
+        nodes.clear();
+        order.resize(count());
+        scratch.resize(count());
+        if (count() == 0)
+            return;
+        glm::vec3 lo = position[0], hi = position[0];
+        for (size_t i = 0; i < count(); ++i)
+        {
+            order[i] = static_cast<unsigned int>(i);
+            lo = glm::min(lo, position[i]);
+            hi = glm::max(hi, position[i]);
+        }
+        glm::vec3 extent = hi - lo;
+        float halfSize = 0.5f * std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f)) * 1.001f;
+        nodes.push_back(Node());
+        buildNode(0, 0.5f * (lo + hi), halfSize, 0, static_cast<unsigned int>(count()), 0);
+
+        sortedPosition.resize(count());
+        sortedMass.resize(count());
+        for (size_t k = 0; k < count(); ++k)
+        {
+            sortedPosition[k] = position[order[k]];
+            sortedMass[k] = mass[order[k]];
+        }
+    }
+
+    void buildNode(int index, const glm::vec3& center, float halfSize, unsigned int begin, unsigned int end, unsigned int depth)
+    {
+        int firstChild = -1;
+        if (end - begin > LEAF_SIZE && depth < MAX_DEPTH)
+        {
+            // counting sort of the range by octant
+            unsigned int counts[8] = { 0 };
+            for (unsigned int k = begin; k < end; ++k)
+                ++counts[octant(position[order[k]], center)];
+            unsigned int offsets[8];
+            unsigned int offset = begin;
+            for (int o = 0; o < 8; ++o)
+            {
+                offsets[o] = offset;
+                offset += counts[o];
+            }
+            for (unsigned int k = begin; k < end; ++k)
+                scratch[offsets[octant(position[order[k]], center)]++] = order[k];
+            std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+            firstChild = static_cast<int>(nodes.size());
+            nodes.resize(nodes.size() + 8);
+            float childHalf = 0.5f * halfSize;
+            unsigned int childBegin = begin;
+            for (int o = 0; o < 8; ++o)
+            {
+                glm::vec3 childCenter = center + childHalf * glm::vec3(o & 1 ? 1.0f : -1.0f, o & 2 ? 1.0f : -1.0f, o & 4 ? 1.0f : -1.0f);
+                buildNode(firstChild + o, childCenter, childHalf, childBegin, childBegin + counts[o], depth + 1);
+                childBegin += counts[o];
+            }
+        }
+
+        // mass and centre of mass, from the children or the particles
+        float m = 0.0f;
+        glm::vec3 weighted(0.0f);
+        if (firstChild >= 0)
+        {
+            for (int o = 0; o < 8; ++o)
+            {
+                m += nodes[firstChild + o].mass;
+                weighted += nodes[firstChild + o].centerOfMass * nodes[firstChild + o].mass;
+            }
+        }
+        else
+        {
+            for (unsigned int k = begin; k < end; ++k)
+            {
+                m += mass[order[k]];
+                weighted += position[order[k]] * mass[order[k]];
+            }
+        }
+        Node& node = nodes[index];
+        node.center = center;
+        node.halfSize = halfSize;
+        node.mass = m;
+        node.centerOfMass = m > 0.0f ? weighted / m : center;
+        node.firstChild = firstChild;
+        node.begin = begin;
+        node.end = end;
+    }
+
+    static int octant(const glm::vec3& p, const glm::vec3& center)
+    {
+        return (p.x >= center.x ? 1 : 0) | (p.y >= center.y ? 2 : 0) | (p.z >= center.z ? 4 : 0);
+    }
+
+    static glm::vec3 pull(const glm::vec3& d, float m)
+    {
+        float r2 = glm::dot(d, d) + SOFTENING * SOFTENING;
+        return d * (m / (r2 * std::sqrt(r2)));
+    }
+
+    glm::vec3 accelerationAt(size_t i) const
+    {
+        const glm::vec3 p = position[i];
+        glm::vec3 a(0.0f);
+        int stack[MAX_DEPTH * 8 + 8];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node& node = nodes[stack[--top]];
+            if (node.firstChild < 0)
+            {
+                for (unsigned int k = node.begin; k < node.end; ++k)
+                {
+                    if (order[k] != i)
+                        a += pull(sortedPosition[k] - p, sortedMass[k]);
+                }
+                continue;
+            }
+            glm::vec3 d = node.centerOfMass - p;
+            glm::vec3 fromCenter = glm::abs(p - node.center);
+            bool inside = fromCenter.x <= node.halfSize && fromCenter.y <= node.halfSize && fromCenter.z <= node.halfSize;
+            float size = 2.0f * node.halfSize;
+            if (!inside && size * size < theta * theta * glm::dot(d, d))
+                a += pull(d, node.mass);
+            else
+            {
+                for (int o = 0; o < 8; ++o)
+                {
+                    if (nodes[node.firstChild + o].mass > 0.0f)
+                        stack[top++] = node.firstChild + o;
+                }
+            }
+        }
+        return a;
+    }
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef ORBIT_KERNEL_H
+#define ORBIT_KERNEL_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Batched orbit kernels for the body store, 8 bodies per iteration.
+// The instruction set is picked at compile time: AVX2 (one 8-wide vector),
+// SSE2 or NEON (two 4-wide vectors), otherwise the scalar reference loops.
+// All paths compute
+//   angle       = time * orbitSpeed
+//   offset      = (cos(angle), 0, sin(angle)) * orbitRadius
+//   model       = translate(worldPosition) * rotateY(time * selfRotateSpeed) * scale(size)
+//   normal      = mat3(rotateY(time * selfRotateSpeed))
+// with the sim time in double and each product reduced to [0, 2pi) in double
+// (wrappedAngle) before the float trigonometry, so an hour at 1000x places
+// the bodies as precisely as the first second does.
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define ORBIT_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ORBIT_KERNEL_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define ORBIT_KERNEL_NEON
+#endif
+
+namespace orbit_kernel {
+
+// Cody-Waite split of pi/2 and Cephes minimax polynomials on [-pi/4, pi/4]
+const float PIO2_HI = 1.5703125f;
+const float PIO2_MID = 4.837512969970703125e-4f;
+const float PIO2_LO = 7.54978995489188216e-8f;
+const float TWO_OVER_PI = 0.636619772367581343f;
+const float SIN_C1 = -1.6666654611e-1f;
+const float SIN_C2 = 8.3321608736e-3f;
+const float SIN_C3 = -1.9515295891e-4f;
+const float COS_C1 = 4.166664568298827e-2f;
+const float COS_C2 = -1.388731625493765e-3f;
+const float COS_C3 = 2.443315711809948e-5f;
+// the float reduction keeps about 1e-7 up to here; beyond it the error grows
+// with the argument (0.03 at 1e6) and past 2^31 quadrants the conversion to
+// int overflows, so vectors with a larger lane go to the scalar loops instead
+// (the kernels' wrapped angles never are, but a NaN or infinite time is)
+const float MAX_REDUCED_ARGUMENT = 8192.0f;
+
+#if defined(ORBIT_KERNEL_AVX2)
+struct Batch {
+    static const int WIDTH = 8;
+    typedef __m256 F;
+    typedef __m256i I;
+    static F load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, F v) { _mm256_storeu_ps(p, v); }
+    static F set(float v) { return _mm256_set1_ps(v); }
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F madd(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }  // a * b + c
+    static F nmadd(F a, F b, F c) { return _mm256_fnmadd_ps(a, b, c); } // c - a * b
+    static F neg(F a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+    static I roundToInt(F a) { return _mm256_cvtps_epi32(a); }
+    static F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+    // true if |a| <= limit in every lane (false for NaN)
+    static bool allWithin(F a, float limit)
+    {
+        F magnitude = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+        return _mm256_movemask_ps(_mm256_cmp_ps(magnitude, _mm256_set1_ps(limit), _CMP_LE_OQ)) == 0xFF;
+    }
+    // lanes where bit is set in q take a, the others b
+    static F selectBit(I q, int bit, F a, F b)
+    {
+        I mask = _mm256_cmpeq_epi32(_mm256_and_si256(q, _mm256_set1_epi32(bit)), _mm256_set1_epi32(bit));
+        return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask));
+    }
+};
+#elif defined(ORBIT_KERNEL_SSE2)
+struct Batch {
+    static const int WIDTH = 4;
+    typedef __m128 F;
+    typedef __m128i I;
+    static F load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, F v) { _mm_storeu_ps(p, v); }
+    static F set(float v) { return _mm_set1_ps(v); }
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F madd(F a, F b, F c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static F nmadd(F a, F b, F c) { return _mm_sub_ps(c, _mm_mul_ps(a, b)); }
+    static F neg(F a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    static I roundToInt(F a) { return _mm_cvtps_epi32(a); }
+    static F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+    static bool allWithin(F a, float limit)
+    {
+        return _mm_movemask_ps(_mm_cmple_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), a), _mm_set1_ps(limit))) == 0xF;
+    }
+    static F selectBit(I q, int bit, F a, F b)
+    {
+        F mask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(bit)), _mm_set1_epi32(bit)));
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+};
+#elif defined(ORBIT_KERNEL_NEON)
+struct Batch {
+    static const int WIDTH = 4;
+    typedef float32x4_t F;
+    typedef int32x4_t I;
+    static F load(const float* p) { return vld1q_f32(p); }
+    static void store(float* p, F v) { vst1q_f32(p, v); }
+    static F set(float v) { return vdupq_n_f32(v); }
+    static F add(F a, F b) { return vaddq_f32(a, b); }
+    static F mul(F a, F b) { return vmulq_f32(a, b); }
+    static F madd(F a, F b, F c) { return vfmaq_f32(c, a, b); }
+    static F nmadd(F a, F b, F c) { return vfmsq_f32(c, a, b); }
+    static F neg(F a) { return vnegq_f32(a); }
+    static I roundToInt(F a) { return vcvtnq_s32_f32(a); }
+    static F toFloat(I a) { return vcvtq_f32_s32(a); }
+    static bool allWithin(F a, float limit)
+    {
+        return vminvq_u32(vcaleq_f32(a, vdupq_n_f32(limit))) != 0;
+    }
+    static F selectBit(I q, int bit, F a, F b)
+    {
+        uint32x4_t mask = vtstq_s32(q, vdupq_n_s32(bit));
+        return vbslq_f32(mask, a, b);
+    }
+};
+#endif
+
+#if defined(ORBIT_KERNEL_AVX2) || defined(ORBIT_KERNEL_SSE2) || defined(ORBIT_KERNEL_NEON)
+#define ORBIT_KERNEL_SIMD
+
+// sin and cos of a whole vector: reduce by multiples of pi/2, evaluate both
+// polynomials, then swap/negate per quadrant. Only for |x| <= MAX_REDUCED_ARGUMENT.
+inline void sincos(Batch::F x, Batch::F& s, Batch::F& c)
+{
+    Batch::I q = Batch::roundToInt(Batch::mul(x, Batch::set(TWO_OVER_PI)));
+    Batch::F j = Batch::toFloat(q);
+    Batch::F r = Batch::nmadd(j, Batch::set(PIO2_HI), x);
+    r = Batch::nmadd(j, Batch::set(PIO2_MID), r);
+    r = Batch::nmadd(j, Batch::set(PIO2_LO), r);
+    Batch::F r2 = Batch::mul(r, r);
+
+    Batch::F ps = Batch::madd(r2, Batch::set(SIN_C3), Batch::set(SIN_C2));
+    ps = Batch::madd(ps, r2, Batch::set(SIN_C1));
+    ps = Batch::madd(Batch::mul(ps, r2), r, r);
+
+    Batch::F pc = Batch::madd(r2, Batch::set(COS_C3), Batch::set(COS_C2));
+    pc = Batch::madd(pc, r2, Batch::set(COS_C1));
+    pc = Batch::madd(Batch::mul(pc, r2), r2, Batch::nmadd(r2, Batch::set(0.5f), Batch::set(1.0f)));
+
+    // quadrant 1: (c, -s), 2: (-s, -c), 3: (-c, s)
+    Batch::F sinV = Batch::selectBit(q, 1, pc, ps);
+    Batch::F cosV = Batch::selectBit(q, 1, Batch::neg(ps), pc);
+    s = Batch::selectBit(q, 2, Batch::neg(sinV), sinV);
+    c = Batch::selectBit(q, 2, Batch::neg(cosV), cosV);
+}
+#endif
+
+// time * speed modulo 2 pi, in double
+inline float wrappedAngle(double time, float speed)
+{
+    const double TWO_PI = 6.283185307179586476925;
+    double angle = time * speed;
+    return static_cast<float>(angle - std::floor(angle / TWO_PI) * TWO_PI);
+}
+
+inline const char* instructionSet()
+{
+#if defined(ORBIT_KERNEL_AVX2)
+    return "AVX2";
+#elif defined(ORBIT_KERNEL_SSE2)
+    return "SSE2";
+#elif defined(ORBIT_KERNEL_NEON)
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
+
+// scalar references, also used for the tail of the batched loops
+inline void orbitOffsetsScalar(const float* orbitRadius, const float* orbitSpeed, double time,
+    float* angle, float* offsetX, float* offsetZ, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        float a = wrappedAngle(time, orbitSpeed[i]);
+        angle[i] = a;
+        offsetX[i] = cosf(a) * orbitRadius[i];
+        offsetZ[i] = sinf(a) * orbitRadius[i];
+    }
+}
+
+inline void writeMatrices(float c, float s, float scale, const glm::vec3& position, glm::mat4& model, glm::mat3& normal)
+{
+    model[0] = glm::vec4(c * scale, 0.0f, -s * scale, 0.0f);
+    model[1] = glm::vec4(0.0f, scale, 0.0f, 0.0f);
+    model[2] = glm::vec4(s * scale, 0.0f, c * scale, 0.0f);
+    model[3] = glm::vec4(position, 1.0f);
+    normal[0] = glm::vec3(c, 0.0f, -s);
+    normal[1] = glm::vec3(0.0f, 1.0f, 0.0f);
+    normal[2] = glm::vec3(s, 0.0f, c);
+}
+
+inline void modelMatricesScalar(const float* selfRotateSpeed, const float* size, const glm::vec3* worldPosition,
+    double time, glm::mat4* model, glm::mat3* normal, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        float spin = wrappedAngle(time, selfRotateSpeed[i]);
+        writeMatrices(cosf(spin), sinf(spin), size[i], worldPosition[i], model[i], normal[i]);
+    }
+}
+
+// orbit angle and parent-relative offset (y = 0) of bodies [0, count)
+inline void orbitOffsets(const float* orbitRadius, const float* orbitSpeed, double time,
+    float* angle, float* offsetX, float* offsetZ, size_t count)
+{
+    size_t i = 0;
+#ifdef ORBIT_KERNEL_SIMD
+    for (; i + 8 <= count; i += 8)
+    {
+        for (int k = 0; k < 8; ++k)
+            angle[i + k] = wrappedAngle(time, orbitSpeed[i + k]);
+        for (int k = 0; k < 8; k += Batch::WIDTH)
+        {
+            Batch::F a = Batch::load(angle + i + k);
+            if (!Batch::allWithin(a, MAX_REDUCED_ARGUMENT))
+            {
+                orbitOffsetsScalar(orbitRadius, orbitSpeed, time, angle, offsetX, offsetZ, i + k, i + k + Batch::WIDTH);
+                continue;
+            }
+            Batch::F r = Batch::load(orbitRadius + i + k);
+            Batch::F s, c;
+            sincos(a, s, c);
+            Batch::store(offsetX + i + k, Batch::mul(c, r));
+            Batch::store(offsetZ + i + k, Batch::mul(s, r));
+        }
+    }
+#endif
+    orbitOffsetsScalar(orbitRadius, orbitSpeed, time, angle, offsetX, offsetZ, i, count);
+}
+
+// packed model and normal matrices of bodies [0, count) from their world positions
+inline void modelMatrices(const float* selfRotateSpeed, const float* size, const glm::vec3* worldPosition,
+    double time, glm::mat4* model, glm::mat3* normal, size_t count)
+{
+    size_t i = 0;
+#ifdef ORBIT_KERNEL_SIMD
+    float spinAngle[8], cosSpin[8], sinSpin[8];
+    for (; i + 8 <= count; i += 8)
+    {
+        for (int k = 0; k < 8; ++k)
+            spinAngle[k] = wrappedAngle(time, selfRotateSpeed[i + k]);
+        for (int k = 0; k < 8; k += Batch::WIDTH)
+        {
+            Batch::F spin = Batch::load(spinAngle + k);
+            if (!Batch::allWithin(spin, MAX_REDUCED_ARGUMENT))
+            {
+                for (int lane = k; lane < k + Batch::WIDTH; ++lane)
+                {
+                    cosSpin[lane] = cosf(spinAngle[lane]);
+                    sinSpin[lane] = sinf(spinAngle[lane]);
+                }
+                continue;
+            }
+            Batch::F s, c;
+            sincos(spin, s, c);
+            Batch::store(cosSpin + k, c);
+            Batch::store(sinSpin + k, s);
+        }
+        // scatter the lanes into the AoS matrices the renderer uploads
+        for (int k = 0; k < 8; ++k)
+            writeMatrices(cosSpin[k], sinSpin[k], size[i + k], worldPosition[i + k], model[i + k], normal[i + k]);
+    }
+#endif
+    modelMatricesScalar(selfRotateSpeed, size, worldPosition, time, model, normal, i, count);
+}
+
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// overlay colour of scope i is PROFILER_COLORS[i % 8]
+const float PROFILER_COLORS[8][3] = {
+    { 0.9f, 0.3f, 0.3f }, { 0.3f, 0.8f, 0.3f }, { 0.3f, 0.5f, 1.0f }, { 0.9f, 0.8f, 0.2f },
+    { 0.8f, 0.3f, 0.9f }, { 0.2f, 0.8f, 0.8f }, { 1.0f, 0.6f, 0.2f }, { 0.7f, 0.7f, 0.7f } };
+const char* const PROFILER_COLOR_NAMES[8] = { "red", "green", "blue", "yellow", "purple", "cyan", "orange", "grey" };
+
+// Per-frame CPU and GPU timings of named scopes (update, planets, belt, ...),
+// kept for the last HISTORY frames. A scope costs two clock reads, plus a
+// GL_TIME_ELAPSED query for the outermost scopes (elapsed queries cannot
+// nest). Queries rotate through QUERY_FRAMES sets and are only read once the
+// driver reports them available, so collecting never stalls the pipeline;
+// GPU times show up a few frames after their CPU times, and a result that is
+// still not ready when its set comes round again is dropped.
+class Profiler
+{
+public:
+    static const unsigned int MAX_SCOPES = 16;   // distinct scope names
+    static const unsigned int HISTORY = 256;     // frames in the ring buffer
+    static const unsigned int QUERY_FRAMES = 4;  // GPU query sets in flight
+    static const unsigned int GRAPH_FRAMES = 120; // columns of the overlay
+
+    struct Sample {
+        double start = 0.0; // ms since setup(), CPU
+        float cpu = 0.0f;   // ms
+        float gpu = -1.0f;  // ms, -1 until (or unless) the query result arrives
+        int depth = -1;     // -1: scope not entered that frame
+    };
+
+    struct Frame {
+        double start = 0.0;
+        float cpu = 0.0f;
+        Sample samples[MAX_SCOPES];
+    };
+
+    bool overlay = false; // toggled with F3
+
+    void setup()
+    {
+        origin = std::chrono::steady_clock::now();
+        glGenQueries(QUERY_FRAMES * MAX_SCOPES, &queries[0][0]);
+    }
+
+    // scope id for a name; names are compared by pointer first, so string
+    // literals cost one comparison per registered scope
+    unsigned int scope(const char* name)
+    {
+        for (unsigned int i = 0; i < scopeCount; ++i)
+        {
+            if (names[i] == name || std::strcmp(names[i], name) == 0)
+                return i;
+        }
+        if (scopeCount == MAX_SCOPES)
+            return MAX_SCOPES - 1; // shared by the overflow
+        names[scopeCount] = name;
+        return scopeCount++;
+    }
+
+    void beginFrame()
+    {
+        collectQueries();
+        Frame& frame = history[frameIndex % HISTORY];
+        frame = Frame();
+        frame.start = now();
+    }
+
+    void endFrame()
+    {
+        Frame& frame = history[frameIndex % HISTORY];
+        frame.cpu = static_cast<float>(now() - frame.start);
+        ++frameIndex;
+    }
+
+    void begin(unsigned int id)
+    {
+        Sample& s = history[frameIndex % HISTORY].samples[id];
+        if (s.depth < 0)
+        {
+            s.depth = depth;
+            s.start = now();
+        }
+        starts[depth < static_cast<int>(MAX_SCOPES) ? depth : MAX_SCOPES - 1] = now();
+        if (gpuScope < 0 && !pending[frameIndex % QUERY_FRAMES][id])
+        {
+            glBeginQuery(GL_TIME_ELAPSED, queries[frameIndex % QUERY_FRAMES][id]);
+            pending[frameIndex % QUERY_FRAMES][id] = true;
+            gpuScope = static_cast<int>(id);
+        }
+        ++depth;
+    }
+
+    void end(unsigned int id)
+    {
+        --depth;
+        Sample& s = history[frameIndex % HISTORY].samples[id];
+        s.cpu += static_cast<float>(now() - starts[depth < static_cast<int>(MAX_SCOPES) ? depth : MAX_SCOPES - 1]);
+        if (gpuScope == static_cast<int>(id))
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            gpuScope = -1;
+        }
+    }
+
+    // frames currently held in the ring buffer
+    unsigned int storedFrames() const
+    {
+        return frameIndex < HISTORY ? frameIndex : HISTORY;
+    }
+
+    // mean CPU and GPU ms of a scope over the last frames that have a result
+    void average(unsigned int id, unsigned int frames, float& cpu, float& gpu) const
+    {
+        double cpuSum = 0.0, gpuSum = 0.0;
+        unsigned int cpuCount = 0, gpuCount = 0;
+        for (unsigned int f = 1; f <= std::min(frames, storedFrames()); ++f)
+        {
+            const Sample& s = history[(frameIndex - f) % HISTORY].samples[id];
+            if (s.depth < 0)
+                continue;
+            cpuSum += s.cpu;
+            ++cpuCount;
+            if (s.gpu >= 0.0f)
+            {
+                gpuSum += s.gpu;
+                ++gpuCount;
+            }
+        }
+        cpu = cpuCount ? static_cast<float>(cpuSum / cpuCount) : 0.0f;
+        gpu = gpuCount ? static_cast<float>(gpuSum / gpuCount) : -1.0f;
+    }
+
+    // GPU ms of the outermost scopes of the newest frame whose results have
+    // all arrived, -1 if none of the last few has one for every scope
+    float lastGpuFrame() const
+    {
+        for (unsigned int f = 1; f <= std::min(2 * QUERY_FRAMES, storedFrames()); ++f)
+        {
+            const Frame& frame = history[(frameIndex - f) % HISTORY];
+            float total = 0.0f;
+            bool complete = true;
+            for (unsigned int i = 0; i < scopeCount && complete; ++i)
+            {
+                const Sample& s = frame.samples[i];
+                if (s.depth != 0)
+                    continue;
+                complete = s.gpu >= 0.0f;
+                total += s.gpu;
+            }
+            if (complete)
+                return total;
+        }
+        return -1.0f;
+    }
+
+    // one line per scope, averaged over a second at 60 Hz; also the colour key of the overlay
+    void printSummary() const
+    {
+        std::cout << "Profile (ms, CPU / GPU, mean of 60 frames):";
+        for (unsigned int i = 0; i < scopeCount; ++i)
+        {
+            float cpu, gpu;
+            average(i, 60, cpu, gpu);
+            std::cout << " " << names[i] << " [" << PROFILER_COLOR_NAMES[i % 8] << "] " << cpu << " / ";
+            if (gpu >= 0.0f)
+                std::cout << gpu;
+            else
+                std::cout << "-";
+        }
+        std::cout << std::endl;
+    }
+
+    // Stacked bars of the outermost scopes for the last GRAPH_FRAMES frames,
+    // CPU above GPU, drawn with scissored clears (no shader, no state beyond
+    // the scissor and clear colour, which are restored). The line marks 16.7 ms.
+    void drawOverlay(int viewportWidth, int viewportHeight) const
+    {
+        if (!overlay)
+            return;
+        const int barWidth = 3, graphHeight = 120, margin = 10;
+        const float pixelsPerMs = graphHeight / 33.3f;
+        GLfloat clearColor[4];
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+        glEnable(GL_SCISSOR_TEST);
+        int left = viewportWidth - margin - static_cast<int>(GRAPH_FRAMES) * barWidth;
+        for (int graph = 0; graph < 2; ++graph)
+        {
+            int bottom = viewportHeight - margin - (graph + 1) * (graphHeight + margin);
+            fill(left, bottom, static_cast<int>(GRAPH_FRAMES) * barWidth, graphHeight, 0.0f, 0.0f, 0.0f);
+            // GPU results lag by up to QUERY_FRAMES frames; skip those columns
+            unsigned int newest = graph == 0 ? 1 : QUERY_FRAMES + 1;
+            for (unsigned int c = 0; c < GRAPH_FRAMES && newest + c <= storedFrames(); ++c)
+            {
+                const Frame& frame = history[(frameIndex - newest - c) % HISTORY];
+                int x = left + static_cast<int>(GRAPH_FRAMES - 1 - c) * barWidth, y = bottom;
+                for (unsigned int i = 0; i < scopeCount; ++i)
+                {
+                    const Sample& s = frame.samples[i];
+                    float ms = graph == 0 ? s.cpu : s.gpu;
+                    if (s.depth != 0 || ms <= 0.0f)
+                        continue;
+                    int h = std::min(static_cast<int>(ms * pixelsPerMs + 0.5f), bottom + graphHeight - y);
+                    const float* rgb = PROFILER_COLORS[i % 8];
+                    fill(x, y, barWidth - 1, h, rgb[0], rgb[1], rgb[2]);
+                    y += h;
+                }
+            }
+            fill(left, bottom + static_cast<int>(16.7f * pixelsPerMs), static_cast<int>(GRAPH_FRAMES) * barWidth, 1, 1.0f, 1.0f, 1.0f);
+        }
+        glDisable(GL_SCISSOR_TEST);
+        glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    }
+
+    // The ring buffer as Chrome trace events (chrome://tracing, Perfetto): CPU
+    // scopes on thread 1, GPU scopes on thread 2. Elapsed queries have no start
+    // time, so a GPU event is placed at its scope's CPU start.
+    bool writeChromeTrace(const std::string& path) const
+    {
+        std::ofstream file(path.c_str());
+        if (!file)
+            return false;
+        file << "{\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+        unsigned int frames = storedFrames();
+        for (unsigned int f = frames; f > 0; --f)
+        {
+            const Frame& frame = history[(frameIndex - f) % HISTORY];
+            writeEvent(file, "frame", frame.start, frame.cpu, 1);
+            for (unsigned int i = 0; i < scopeCount; ++i)
+            {
+                const Sample& s = frame.samples[i];
+                if (s.depth < 0)
+                    continue;
+                writeEvent(file, names[i], s.start, s.cpu, 1);
+                if (s.gpu >= 0.0f)
+                    writeEvent(file, names[i], s.start, s.gpu, 2);
+            }
+        }
+        file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        return static_cast<bool>(file);
+    }
+
+    void release()
+    {
+        glDeleteQueries(QUERY_FRAMES * MAX_SCOPES, &queries[0][0]);
+    }
+
+private:
+    std::chrono::steady_clock::time_point origin;
+    const char* names[MAX_SCOPES] = {};
+    unsigned int scopeCount = 0;
+    Frame history[HISTORY];
+    unsigned int frameIndex = 0;
+    double starts[MAX_SCOPES] = {}; // CPU start of the open scope at each depth
+    int depth = 0;
+    int gpuScope = -1; // scope whose elapsed query is open
+    unsigned int queries[QUERY_FRAMES][MAX_SCOPES] = {};
+    bool pending[QUERY_FRAMES][MAX_SCOPES] = {};
+
+    double now() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    // results of the query set this frame is about to reuse, from QUERY_FRAMES frames ago
+    void collectQueries()
+    {
+        unsigned int set = frameIndex % QUERY_FRAMES;
+        Frame* frame = frameIndex >= QUERY_FRAMES ? &history[(frameIndex - QUERY_FRAMES) % HISTORY] : NULL;
+        for (unsigned int i = 0; i < scopeCount; ++i)
+        {
+            if (!pending[set][i])
+                continue;
+            pending[set][i] = false;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[set][i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available || !frame)
+                continue;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(queries[set][i], GL_QUERY_RESULT, &elapsed);
+            frame->samples[i].gpu = static_cast<float>(elapsed / 1.0e6);
+        }
+    }
+
+    static void fill(int x, int y, int width, int height, float r, float g, float b)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        glScissor(x, y, width, height);
+        glClearColor(r, g, b, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    static void writeEvent(std::ofstream& file, const char* name, double startMs, float durationMs, int thread)
+    {
+        file << ",\n{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread
+            << ",\"ts\":" << static_cast<long long>(startMs * 1000.0) << ",\"dur\":" << static_cast<long long>(durationMs * 1000.0) << "}";
+    }
+};
+
+// Times the enclosing block as one profiler scope:
+//   { ProfileScope scope(profiler, "planets"); ... }
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler& profiler, const char* name)
+        : profiler(profiler), id(profiler.scope(name))
+    {
+        profiler.begin(id);
+    }
+
+    ~ProfileScope()
+    {
+        profiler.end(id);
+    }
+
+private:
+    Profiler& profiler;
+    unsigned int id;
+};
+
+#endif
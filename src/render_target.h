@@ -0,0 +1,85 @@
+#ifndef RENDER_TARGET_H
+#define RENDER_TARGET_H
+
+#include <glad/glad.h>
+
+// Offscreen colour and depth buffers the scene is drawn into when it does not
+// go straight to the window: the benchmark draws in a hidden window,
+// reversed-Z needs a float depth buffer the default framebuffer lacks, and
+// dynamic resolution (FramePacer in frame_pacing.h) draws into the lower left
+// part only. The storage follows the window's size, so a smaller scene size
+// never reallocates; present() stretches the part drawn over the window.
+class RenderTarget
+{
+public:
+    unsigned int FBO = 0;
+    unsigned int color = 0;
+    unsigned int depth = 0;
+    int width = 0;  // of the storage
+    int height = 0;
+    GLenum depthFormat = GL_DEPTH_COMPONENT24; // DepthMode::depthFormat(), set before the first resize()
+
+    // (re)create the storage when the size changes; false if the framebuffer is incomplete
+    bool resize(int w, int h)
+    {
+        if (FBO && w == width && h == height)
+            return true;
+        width = w;
+        height = h;
+        if (!FBO)
+        {
+            glGenFramebuffers(1, &FBO);
+            glGenRenderbuffers(1, &color);
+            glGenRenderbuffers(1, &depth);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        GLint previous = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+        return complete;
+    }
+
+    // draw into the lower left w x h (at most the storage size) from here on
+    void bind(int w, int h)
+    {
+        usedWidth = w < width ? w : width;
+        usedHeight = h < height ? h : height;
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, usedWidth, usedHeight);
+    }
+
+    // stretch what was drawn since bind() over the window, which is bound afterwards
+    void present(int windowWidth, int windowHeight) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, usedWidth, usedHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+            usedWidth == windowWidth && usedHeight == windowHeight ? GL_NEAREST : GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
+    }
+
+    void release()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteRenderbuffers(1, &color);
+        glDeleteRenderbuffers(1, &depth);
+        FBO = color = depth = 0;
+        width = height = 0;
+    }
+
+private:
+    int usedWidth = 0;
+    int usedHeight = 0;
+};
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef SCENE_BENCHMARK_H
+#define SCENE_BENCHMARK_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "asteroid_belt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// One frame of the benchmark script: the settings of its run and where the
+// camera is. follow >= 0 orbits that body through updateCameraFollow() at
+// orbitYaw; follow < 0 is a free camera at position looking along front.
+struct BenchmarkShot {
+    unsigned int run;
+    unsigned int asteroids;
+    float pixelError;
+    std::string segment;
+    int follow;
+    float orbitYaw;
+    glm::vec3 position;
+    glm::vec3 front;
+};
+
+// Frame time percentiles of one segment of one run
+struct BenchmarkResult {
+    unsigned int asteroids;
+    float pixelError;
+    std::string segment;
+    size_t frames;
+    double mean, p50, p95, p99, max; // ms
+};
+
+// --benchmark: a fixed camera script replayed once per combination of belt
+// size and sphere LOD pixel error. Each run starts from sim time 0 with the
+// seeded belt, and every frame advances the simulation by FRAME_SECONDS
+// whatever the real frame took, so every run renders exactly the same
+// frames. The script orbits each body in turn, then flies around the middle
+// of the belt. Frame times are CPU wall time up to a glFinish, so they
+// include the GPU work, and the first WARMUP_FRAMES of a run are not counted.
+class SceneBenchmark
+{
+public:
+    static constexpr float FRAME_SECONDS = 1.0f / 60.0f;
+    static const unsigned int FRAMES_PER_BODY = 90;
+    static const unsigned int BELT_FRAMES = 360;
+    static const unsigned int WARMUP_FRAMES = 30;
+
+    std::vector<unsigned int> asteroidCounts = { 2000, 20000, 200000 };
+    std::vector<float> pixelErrors = { 4.0f, 8.0f, 16.0f };
+
+    // script the runs for the given bodies (index 0, the root, is skipped
+    // when there are others to orbit)
+    void start(const std::string& outputPath, const std::vector<std::string>& bodyNames)
+    {
+        path = outputPath;
+        shots.clear();
+        unsigned int run = 0;
+        for (size_t a = 0; a < asteroidCounts.size(); ++a)
+        {
+            for (size_t p = 0; p < pixelErrors.size(); ++p, ++run)
+            {
+                BenchmarkShot shot;
+                shot.run = run;
+                shot.asteroids = asteroidCounts[a];
+                shot.pixelError = pixelErrors[p];
+                shot.position = glm::vec3(0.0f);
+                shot.front = glm::vec3(0.0f, 0.0f, -1.0f);
+                for (unsigned int f = 0; f < WARMUP_FRAMES; ++f)
+                {
+                    shot.segment = "";
+                    shot.follow = bodyNames.size() > 1 ? 1 : 0;
+                    shot.orbitYaw = 0.0f;
+                    shots.push_back(shot);
+                }
+                for (size_t b = bodyNames.size() > 1 ? 1 : 0; b < bodyNames.size(); ++b)
+                {
+                    for (unsigned int f = 0; f < FRAMES_PER_BODY; ++f)
+                    {
+                        shot.segment = "orbit " + bodyNames[b];
+                        shot.follow = static_cast<int>(b);
+                        shot.orbitYaw = 360.0f * f / FRAMES_PER_BODY;
+                        shots.push_back(shot);
+                    }
+                }
+                // one lap through the belt, slightly above its plane, looking ahead along the orbit
+                float radius = 0.5f * (AsteroidBelt::INNER_RADIUS + AsteroidBelt::OUTER_RADIUS);
+                for (unsigned int f = 0; f < BELT_FRAMES; ++f)
+                {
+                    float angle = glm::two_pi<float>() * f / BELT_FRAMES;
+                    shot.segment = "belt flythrough";
+                    shot.follow = -1;
+                    shot.position = glm::vec3(cos(angle) * radius, 0.15f, sin(angle) * radius);
+                    shot.front = glm::normalize(glm::vec3(-sin(angle), -0.05f, cos(angle)));
+                    shots.push_back(shot);
+                }
+            }
+        }
+        next = 0;
+        times.assign(shots.size(), 0.0);
+    }
+
+    bool active() const
+    {
+        return next < shots.size();
+    }
+
+    // the frame to render now; valid while active()
+    const BenchmarkShot& shot() const
+    {
+        return shots[next];
+    }
+
+    // true on the first frame of a run: reset the scene to its settings
+    bool runStarts() const
+    {
+        return next == 0 || shots[next].run != shots[next - 1].run;
+    }
+
+    // the frame time of shot(), then move on to the next frame
+    void record(double milliseconds)
+    {
+        times[next++] = milliseconds;
+    }
+
+    // percentiles per (run, segment) and per run over every counted frame
+    std::vector<BenchmarkResult> results() const
+    {
+        std::vector<BenchmarkResult> out;
+        size_t begin = 0;
+        while (begin < shots.size())
+        {
+            size_t runEnd = begin;
+            while (runEnd < shots.size() && shots[runEnd].run == shots[begin].run)
+                ++runEnd;
+            std::vector<double> all;
+            size_t segmentBegin = begin;
+            while (segmentBegin < runEnd)
+            {
+                size_t segmentEnd = segmentBegin;
+                while (segmentEnd < runEnd && shots[segmentEnd].segment == shots[segmentBegin].segment)
+                    ++segmentEnd;
+                if (!shots[segmentBegin].segment.empty())
+                {
+                    std::vector<double> segment(times.begin() + segmentBegin, times.begin() + segmentEnd);
+                    all.insert(all.end(), segment.begin(), segment.end());
+                    out.push_back(summarize(shots[segmentBegin], shots[segmentBegin].segment, segment));
+                }
+                segmentBegin = segmentEnd;
+            }
+            out.push_back(summarize(shots[begin], "all", all));
+            begin = runEnd;
+        }
+        return out;
+    }
+
+    // CSV when the output path ends in .csv, JSON otherwise
+    bool write(const std::string& renderer, std::string& error) const
+    {
+        std::ofstream file(path.c_str());
+        if (!file)
+        {
+            error = "cannot create " + path;
+            return false;
+        }
+        std::vector<BenchmarkResult> rows = results();
+        bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+        if (csv)
+        {
+            file << "asteroids,pixel_error,segment,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+            for (size_t i = 0; i < rows.size(); ++i)
+            {
+                const BenchmarkResult& r = rows[i];
+                file << r.asteroids << "," << r.pixelError << ",\"" << r.segment << "\"," << r.frames << ","
+                    << r.mean << "," << r.p50 << "," << r.p95 << "," << r.p99 << "," << r.max << "\n";
+            }
+        }
+        else
+        {
+            file << "{\n  \"renderer\": \"" << renderer << "\",\n  \"frameSeconds\": " << FRAME_SECONDS << ",\n  \"results\": [";
+            for (size_t i = 0; i < rows.size(); ++i)
+            {
+                const BenchmarkResult& r = rows[i];
+                file << (i ? ",\n" : "\n") << "    { \"asteroids\": " << r.asteroids << ", \"pixelError\": " << r.pixelError
+                    << ", \"segment\": \"" << r.segment << "\", \"frames\": " << r.frames << ", \"meanMs\": " << r.mean
+                    << ", \"p50Ms\": " << r.p50 << ", \"p95Ms\": " << r.p95 << ", \"p99Ms\": " << r.p99 << ", \"maxMs\": " << r.max << " }";
+            }
+            file << "\n  ]\n}\n";
+        }
+        if (!file)
+        {
+            error = "cannot write " + path;
+            return false;
+        }
+        return true;
+    }
+
+    const std::string& outputPath() const
+    {
+        return path;
+    }
+
+private:
+    std::string path;
+    std::vector<BenchmarkShot> shots;
+    std::vector<double> times;
+    size_t next = 0;
+
+    // nearest-rank percentile of sorted values
+    static double percentile(const std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty())
+            return 0.0;
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+        return sorted[std::min(std::max(rank, static_cast<size_t>(1)), sorted.size()) - 1];
+    }
+
+    static BenchmarkResult summarize(const BenchmarkShot& shot, const std::string& segment, std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        BenchmarkResult r;
+        r.asteroids = shot.asteroids;
+        r.pixelError = shot.pixelError;
+        r.segment = segment;
+        r.frames = values.size();
+        r.mean = 0.0;
+        for (size_t i = 0; i < values.size(); ++i)
+            r.mean += values[i];
+        r.mean = values.empty() ? 0.0 : r.mean / values.size();
+        r.p50 = percentile(values, 50.0);
+        r.p95 = percentile(values, 95.0);
+        r.p99 = percentile(values, 99.0);
+        r.max = values.empty() ? 0.0 : values.back();
+        return r;
+    }
+};
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A linked program, used like learnopengl's Shader
+struct ShaderProgram {
+    unsigned int ID = 0;
+
+    void use() const
+    {
+        glUseProgram(ID);
+    }
+    void setInt(const std::string& name, int value) const
+    {
+        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    }
+    void setFloat(const std::string& name, float value) const
+    {
+        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    }
+};
+
+// Permutations of the vertex/fragment shader files: each variant is the same
+// source with its #defines inserted after the #version line, compiled once and
+// shared by everyone asking for the same files and defines. Linked programs
+// are also kept on disk where the driver supports program binaries (4.1), keyed
+// by a hash of the driver strings and the final sources, so a later start links
+// from the binary instead of compiling. An edited shader file or a new driver
+// changes the key and the stale binary is simply never asked for again.
+// get() only starts the compile and link of a new variant and finish()
+// collects them all, so no status query stalls on one program while the
+// rest wait unsubmitted: with KHR_parallel_shader_compile the driver builds
+// them on its own threads meanwhile, and the caller can do other startup
+// work between the two.
+class ShaderVariants
+{
+public:
+    unsigned int compiled = 0;   // variants built from source
+    unsigned int fromBinary = 0; // variants loaded from the binary cache
+    bool parallel = false;       // the driver compiles on its own threads
+
+    // read the binary cache, if any, and the driver strings it is keyed on
+    void setup(const std::string& cacheFile)
+    {
+        cachePath = cacheFile;
+        driver = string(GL_VENDOR) + "\n" + string(GL_RENDERER) + "\n" + string(GL_VERSION) + "\n";
+        parallel = GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+        if (GLAD_GL_KHR_parallel_shader_compile)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu); // as many as the driver likes
+        else if (GLAD_GL_ARB_parallel_shader_compile)
+            glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+        GLint formats = 0;
+        if (GLAD_GL_VERSION_4_1)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        binaries = formats > 0;
+        if (!binaries)
+            return;
+        std::ifstream file(cachePath.c_str(), std::ios::binary);
+        uint32_t header[2] = { 0, 0 };
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != CACHE_MAGIC || header[1] != CACHE_VERSION)
+            return;
+        for (;;)
+        {
+            uint64_t key;
+            uint32_t format, size;
+            if (!file.read(reinterpret_cast<char*>(&key), sizeof(key)) ||
+                !file.read(reinterpret_cast<char*>(&format), sizeof(format)) ||
+                !file.read(reinterpret_cast<char*>(&size), sizeof(size)))
+                break;
+            CachedBinary& entry = cache[key];
+            entry.format = format;
+            entry.data.resize(size);
+            if (size && !file.read(&entry.data[0], size))
+            {
+                cache.erase(key);
+                break;
+            }
+        }
+    }
+
+    // the program for these files and defines ("NAME" or "NAME value"),
+    // usable once finish() has run; 0 with the reason in error if its files
+    // cannot be read
+    ShaderProgram get(const char* vertexPath, const char* fragmentPath, const std::vector<std::string>& defines, std::string& error)
+    {
+        ShaderProgram shader;
+        std::string name = std::string(vertexPath) + " + " + fragmentPath;
+        std::string variant = name;
+        for (size_t i = 0; i < defines.size(); ++i)
+            variant += " " + defines[i];
+        std::map<std::string, unsigned int>::const_iterator built = programs.find(variant);
+        if (built != programs.end())
+        {
+            shader.ID = built->second;
+            return shader;
+        }
+
+        std::string vertexSource, fragmentSource;
+        if (!readFile(vertexPath, vertexSource, error) || !readFile(fragmentPath, fragmentSource, error))
+            return shader;
+        vertexSource = inject(vertexSource, defines);
+        fragmentSource = inject(fragmentSource, defines);
+        uint64_t key = hash(driver + vertexSource + "\n//\n" + fragmentSource);
+
+        shader.ID = glCreateProgram();
+        std::map<uint64_t, CachedBinary>::const_iterator cached = cache.find(key);
+        if (cached != cache.end())
+        {
+            glProgramBinary(shader.ID, cached->second.format, cached->second.data.data(), static_cast<GLsizei>(cached->second.data.size()));
+            GLint linked = 0;
+            glGetProgramiv(shader.ID, GL_LINK_STATUS, &linked);
+            if (linked)
+            {
+                ++fromBinary;
+                programs[variant] = shader.ID;
+                return shader;
+            }
+            cache.erase(key); // the driver refused it, build from source and store a fresh one
+        }
+
+        PendingProgram pending;
+        pending.name = name;
+        pending.key = key;
+        pending.vertex = compile(GL_VERTEX_SHADER, vertexSource);
+        pending.fragment = compile(GL_FRAGMENT_SHADER, fragmentSource);
+        pending.program = shader.ID;
+        glAttachShader(shader.ID, pending.vertex);
+        glAttachShader(shader.ID, pending.fragment);
+        if (binaries)
+            glProgramParameteri(shader.ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(shader.ID);
+        programs[variant] = shader.ID;
+        building.push_back(pending);
+        return shader;
+    }
+
+    // wait for the variants get() started and check them, keeping the
+    // binaries of the new ones; the driver's log of one that did not build
+    // goes to error, and its program stays unlinked (drawing nothing)
+    void finish(std::string& error)
+    {
+        for (size_t i = 0; i < building.size(); ++i)
+        {
+            PendingProgram& pending = building[i];
+            GLint linked = 0;
+            glGetProgramiv(pending.program, GL_LINK_STATUS, &linked);
+            if (!linked)
+                error = pending.name + ": " + buildLog(pending);
+            glDetachShader(pending.program, pending.vertex);
+            glDetachShader(pending.program, pending.fragment);
+            glDeleteShader(pending.vertex);
+            glDeleteShader(pending.fragment);
+            if (!linked)
+                continue;
+            ++compiled;
+            if (!binaries)
+                continue;
+            GLint length = 0;
+            glGetProgramiv(pending.program, GL_PROGRAM_BINARY_LENGTH, &length);
+            if (length > 0)
+            {
+                CachedBinary& entry = cache[pending.key];
+                entry.data.resize(length);
+                GLenum format = 0;
+                glGetProgramBinary(pending.program, length, NULL, &format, &entry.data[0]);
+                entry.format = format;
+                dirty = true;
+            }
+        }
+        building.clear();
+    }
+
+    // true once every variant get() started has finished building (always,
+    // without parallel compiles: finish() may then block)
+    bool ready() const
+    {
+        if (!parallel)
+            return true;
+        for (size_t i = 0; i < building.size(); ++i)
+        {
+            GLint done = GL_FALSE;
+            glGetProgramiv(building[i].program, GL_COMPLETION_STATUS_KHR, &done);
+            if (!done)
+                return false;
+        }
+        return true;
+    }
+
+    // write the binary cache if a variant was built from source since setup()
+    void save()
+    {
+        if (!dirty)
+            return;
+        std::ofstream file(cachePath.c_str(), std::ios::binary);
+        uint32_t header[2] = { CACHE_MAGIC, CACHE_VERSION };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        for (std::map<uint64_t, CachedBinary>::const_iterator it = cache.begin(); it != cache.end(); ++it)
+        {
+            uint32_t format = it->second.format;
+            uint32_t size = static_cast<uint32_t>(it->second.data.size());
+            file.write(reinterpret_cast<const char*>(&it->first), sizeof(it->first));
+            file.write(reinterpret_cast<const char*>(&format), sizeof(format));
+            file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            file.write(it->second.data.data(), size);
+        }
+        if (file)
+            dirty = false;
+        else
+            std::cout << "Failed to write shader cache " << cachePath << std::endl;
+    }
+
+    void release()
+    {
+        for (std::map<std::string, unsigned int>::const_iterator it = programs.begin(); it != programs.end(); ++it)
+            glDeleteProgram(it->second);
+        programs.clear();
+        cache.clear();
+    }
+
+private:
+    static const uint32_t CACHE_MAGIC = 0x42505353; // "SSPB"
+    static const uint32_t CACHE_VERSION = 1;
+
+    struct CachedBinary {
+        uint32_t format;
+        std::vector<char> data;
+    };
+
+    // a variant built from source whose link get() has started
+    struct PendingProgram {
+        std::string name;
+        uint64_t key;
+        unsigned int program;
+        unsigned int vertex;
+        unsigned int fragment;
+    };
+
+    std::string cachePath;
+    std::string driver;
+    bool binaries = false;
+    bool dirty = false;
+    std::map<std::string, unsigned int> programs; // variant name -> program
+    std::map<uint64_t, CachedBinary> cache;
+    std::vector<PendingProgram> building; // started by get(), checked by finish()
+
+    static std::string string(GLenum name)
+    {
+        const GLubyte* value = glGetString(name);
+        return value ? reinterpret_cast<const char*>(value) : "";
+    }
+
+    static bool readFile(const char* path, std::string& source, std::string& error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = std::string("cannot open ") + path;
+            return false;
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        source = stream.str();
+        return true;
+    }
+
+    // the defines go right after the #version line, which must stay first
+    static std::string inject(const std::string& source, const std::vector<std::string>& defines)
+    {
+        size_t lineEnd = source.find('\n');
+        if (lineEnd == std::string::npos || defines.empty())
+            return source;
+        std::string lines;
+        for (size_t i = 0; i < defines.size(); ++i)
+            lines += "#define " + defines[i] + "\n";
+        return source.substr(0, lineEnd + 1) + lines + source.substr(lineEnd + 1);
+    }
+
+    // the status is only asked for by finish(), after every link has been issued
+    static unsigned int compile(GLenum type, const std::string& source)
+    {
+        const char* code = source.c_str();
+        unsigned int shader = glCreateShader(type);
+        glShaderSource(shader, 1, &code, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    // the compile log of the first stage that failed, else the link log
+    static std::string buildLog(const PendingProgram& pending)
+    {
+        char infoLog[1024];
+        unsigned int stages[2] = { pending.vertex, pending.fragment };
+        for (int i = 0; i < 2; ++i)
+        {
+            int success = 0;
+            glGetShaderiv(stages[i], GL_COMPILE_STATUS, &success);
+            if (!success)
+            {
+                glGetShaderInfoLog(stages[i], sizeof(infoLog), NULL, infoLog);
+                return std::string(i == 0 ? "vertex shader: " : "fragment shader: ") + infoLog;
+            }
+        }
+        glGetProgramInfoLog(pending.program, sizeof(infoLog), NULL, infoLog);
+        return infoLog;
+    }
+
+    // FNV-1a
+    static uint64_t hash(const std::string& text)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            h ^= static_cast<unsigned char>(text[i]);
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <algorithm>
+
+// Fixed-step simulation clock, decoupled from the display. Every frame the
+// real time since the last one, times the time scale, goes into an
+// accumulator that is drained in whole steps of STEP sim seconds; the left
+// over fraction becomes alpha, the render position between the last two steps.
+// A slow frame runs more steps, but only for STEP_BUDGET of real time: with
+// the integrating motion models a step is expensive, and at high time scales
+// more steps a frame would make the frames longer and the backlog larger
+// still. What is not run carries over, up to MAX_BACKLOG; beyond that the
+// simulation drops time and runs slower than the time scale asks, as fast as
+// the machine can step it, instead of freezing the window.
+class SimClock
+{
+public:
+    static constexpr double STEP = 1.0 / 120.0;       // sim seconds per step
+    static constexpr unsigned int MAX_STEPS_PER_FRAME = 4096;
+    static constexpr double MAX_BACKLOG = MAX_STEPS_PER_FRAME * STEP; // sim seconds carried between frames
+    static constexpr double STEP_BUDGET = 0.008;    // real seconds of stepping per frame, after the first step
+    static constexpr double MIN_TIME_SCALE = 1.0 / 64.0;
+    static constexpr double MAX_TIME_SCALE = 1000.0;
+
+    double timeScale = 1.0;
+    bool paused = false;
+
+    // add a frame of real time; returns how many steps to run before
+    // rendering, of which the caller may stop short once STEP_BUDGET is spent
+    unsigned int advance(double realSeconds)
+    {
+        if (!paused)
+            accumulator += std::max(realSeconds, 0.0) * timeScale;
+        accumulator = std::min(accumulator, MAX_BACKLOG);
+        unsigned int steps = static_cast<unsigned int>(std::min(accumulator / STEP, (double)MAX_STEPS_PER_FRAME));
+        pendingSteps = steps;
+        return steps;
+    }
+
+    // call once after each step advance() asked for
+    void finishStep()
+    {
+        if (pendingSteps == 0)
+            return;
+        --pendingSteps;
+        accumulator -= STEP;
+        simTime += STEP;
+    }
+
+    // sim time at the end of the last finished step
+    double time() const
+    {
+        return simTime;
+    }
+
+    // how far the frame is between the last step and the next one, in [0, 1)
+    double alpha() const
+    {
+        return std::min(std::max(accumulator / STEP, 0.0), 1.0);
+    }
+
+    // sim time to render: alpha of the way from the previous step to the last
+    // one, the same instant interpolated step state shows
+    double renderTime() const
+    {
+        return simTime - (1.0 - alpha()) * STEP;
+    }
+
+    // start over at the given sim time with nothing accumulated (benchmark runs)
+    void reset(double time)
+    {
+        simTime = time;
+        accumulator = 0.0;
+        pendingSteps = 0;
+    }
+
+    void setTimeScale(double scale)
+    {
+        timeScale = std::min(std::max(scale, MIN_TIME_SCALE), MAX_TIME_SCALE);
+    }
+
+private:
+    double simTime = 0.0;
+    double accumulator = 0.0;
+    unsigned int pendingSteps = 0;
+};
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef SPHERE_LOD_H
+#define SPHERE_LOD_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "vertex_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sphere generation: position, normal, texcoord (8 floats per vertex).
+// Indices are relative to the first vertex this call appends.
+inline void createSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, float radius, unsigned int sectorCount, unsigned int stackCount)
+{
+    float x, y, z, xy;
+    float nx, ny, nz, lengthInv = 1.0f / radius;
+    float s, t;
+
+    vertices.reserve(vertices.size() + (stackCount + 1) * (sectorCount + 1) * 8);
+    indices.reserve(indices.size() + (stackCount - 1) * sectorCount * 6);
+
+    float sectorStep = glm::two_pi<float>() / sectorCount;
+    float stackStep = glm::pi<float>() / stackCount;
+    float sectorAngle, stackAngle;
+
+    for (unsigned int i = 0; i <= stackCount; ++i)
+    {
+        stackAngle = glm::half_pi<float>() - i * stackStep;
+        xy = radius * cosf(stackAngle);
+        y = radius * sinf(stackAngle);
+
+        for (unsigned int j = 0; j <= sectorCount; ++j)
+        {
+            sectorAngle = j * sectorStep;
+            x = xy * cosf(sectorAngle);
+            z = xy * sinf(sectorAngle);
+
+            nx = x * lengthInv;
+            ny = y * lengthInv;
+            nz = z * lengthInv;
+            s = 1.0f - (float)j / sectorCount;
+            t = 1.0f - (float)i / stackCount;
+
+            vertices.push_back(x);
+            vertices.push_back(y);
+            vertices.push_back(z);
+            vertices.push_back(nx);
+            vertices.push_back(ny);
+            vertices.push_back(nz);
+            vertices.push_back(s);
+            vertices.push_back(t);
+        }
+    }
+
+    unsigned int k1, k2;
+    for (unsigned int i = 0; i < stackCount; ++i)
+    {
+        k1 = i * (sectorCount + 1);
+        k2 = k1 + sectorCount + 1;
+
+        for (unsigned int j = 0; j < sectorCount; ++j, ++k1, ++k2)
+        {
+            if (i != 0)
+            {
+                indices.push_back(k1);
+                indices.push_back(k2);
+                indices.push_back(k1 + 1);
+            }
+            if (i != (stackCount - 1))
+            {
+                indices.push_back(k1 + 1);
+                indices.push_back(k2);
+                indices.push_back(k2 + 1);
+            }
+        }
+    }
+}
+
+// One tessellation inside the shared sphere buffers
+struct SphereLODLevel {
+    unsigned int sectorCount;
+    unsigned int stackCount;
+    unsigned int firstIndex; // offset into the shared EBO, in indices
+    unsigned int indexCount;
+    int baseVertex;          // added to every index of this level
+    float cacheMissRatio;    // vertices transformed per triangle through a 16-entry FIFO cache
+};
+
+// Packed vertex of the shared sphere buffers (16 bytes instead of 8 floats).
+// A unit sphere's position fits SNORM16; the normal is 2_10_10_10 SNORM and
+// the texcoord UNORM16, all normalized by the attribute fetch, so the vertex
+// shaders still read plain vec3/vec2 attributes.
+struct SphereVertex {
+    int16_t position[4]; // xyz, w padding
+    uint32_t normal;     // GL_INT_2_10_10_10_REV
+    uint16_t texCoord[2];
+};
+
+static_assert(sizeof(SphereVertex) == 16, "SphereVertex must stay tightly packed");
+
+// Unit spheres at several tessellations packed into one VBO/EBO, so every
+// level can be drawn from the same VAO. Levels are picked per body from the
+// projected screen-space radius.
+class SphereLOD
+{
+public:
+    static const unsigned int LEVEL_COUNT = 5;
+    // pseudo level below the coarsest mesh: one quad per sphere, ray traced by
+    // the IMPOSTOR shader variants (instanced draws only)
+    static const unsigned int IMPOSTOR = LEVEL_COUNT;
+    // every level has fewer than 65536 vertices and draws with its baseVertex
+    static const GLenum INDEX_TYPE = GL_UNSIGNED_SHORT;
+    typedef uint16_t Index;
+
+    SphereLODLevel levels[LEVEL_COUNT];
+    unsigned int VBO = 0;
+    unsigned int EBO = 0;
+    // target on-screen length of one sector edge at the equator, in pixels
+    float pixelError = 8.0f;
+    // spheres with a smaller radius on screen, in pixels, are drawn as impostors; 0 = never
+    float impostorRadius = 4.0f;
+
+    // generate() then upload()
+    void build()
+    {
+        generate();
+        upload();
+    }
+
+    // generate 8/16/32/64/128-sector spheres, reorder each for the vertex
+    // cache and pack them; no GL calls, so it can run on a worker while the
+    // context is still being created
+    void generate()
+    {
+        vertices.clear();
+        indices.clear();
+        std::vector<float> levelVertices;
+        std::vector<unsigned int> levelIndices;
+        unsigned int sectors = 8;
+        for (unsigned int i = 0; i < LEVEL_COUNT; ++i, sectors *= 2)
+        {
+            SphereLODLevel& level = levels[i];
+            level.sectorCount = sectors;
+            level.stackCount = sectors / 2;
+            level.firstIndex = static_cast<unsigned int>(indices.size());
+            level.baseVertex = static_cast<int>(vertices.size());
+            levelVertices.clear();
+            levelIndices.clear();
+            createSphere(levelVertices, levelIndices, 1.0f, level.sectorCount, level.stackCount);
+            size_t levelVertexCount = levelVertices.size() / 8;
+            vertex_cache::optimizeTriangles(levelIndices, levelVertexCount);
+            vertex_cache::optimizeFetch(levelVertices, levelIndices, 8);
+            level.cacheMissRatio = vertex_cache::averageCacheMissRatio(levelIndices, levelVertexCount, 16);
+            for (size_t v = 0; v < levelVertexCount; ++v)
+                vertices.push_back(pack(&levelVertices[v * 8]));
+            indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+            level.indexCount = static_cast<unsigned int>(levelIndices.size());
+        }
+    }
+
+    // the meshes generate() made into VBO/EBO, on the GL thread
+    void upload()
+    {
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(SphereVertex), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(Index), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        std::vector<SphereVertex>().swap(vertices);
+        std::vector<Index>().swap(indices);
+    }
+
+    // position, normal and texcoord (attributes 0, 1, 2) of the packed mesh
+    // on the bound VAO
+    static void setupAttributes(unsigned int meshVBO, unsigned int meshEBO)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshEBO);
+        glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(SphereVertex), (void*)offsetof(SphereVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(SphereVertex), (void*)offsetof(SphereVertex, normal));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SphereVertex), (void*)offsetof(SphereVertex, texCoord));
+        glEnableVertexAttribArray(2);
+    }
+
+    // radius in pixels of a sphere of the given world radius seen from the given distance
+    static float projectedRadius(float worldRadius, float distance, float fovY, float viewportHeight)
+    {
+        if (distance <= worldRadius)
+            return viewportHeight;
+        return worldRadius / (distance * tanf(fovY * 0.5f)) * (viewportHeight * 0.5f);
+    }
+
+    // coarsest level whose sector edges stay below pixelError on screen
+    unsigned int select(float screenRadius) const
+    {
+        float sectorsNeeded = glm::two_pi<float>() * screenRadius / pixelError;
+        for (unsigned int i = 0; i < LEVEL_COUNT; ++i)
+        {
+            if (static_cast<float>(levels[i].sectorCount) >= sectorsNeeded)
+                return i;
+        }
+        return LEVEL_COUNT - 1;
+    }
+
+    unsigned int select(float worldRadius, float distance, float fovY, float viewportHeight) const
+    {
+        return select(projectedRadius(worldRadius, distance, fovY, viewportHeight));
+    }
+
+    // select(), or IMPOSTOR when the sphere is below impostorRadius on screen
+    unsigned int selectOrImpostor(float worldRadius, float distance, float fovY, float viewportHeight) const
+    {
+        float screenRadius = projectedRadius(worldRadius, distance, fovY, viewportHeight);
+        return screenRadius < impostorRadius ? IMPOSTOR : select(screenRadius);
+    }
+
+    // the caller binds a VAO built on VBO/EBO
+    void draw(unsigned int level) const
+    {
+        const SphereLODLevel& l = levels[level];
+        glDrawElementsBaseVertex(GL_TRIANGLES, l.indexCount, INDEX_TYPE,
+            (void*)(l.firstIndex * sizeof(Index)), l.baseVertex);
+    }
+
+    void drawInstanced(unsigned int level, unsigned int instanceCount) const
+    {
+        if (level == IMPOSTOR)
+        {
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+            return;
+        }
+        const SphereLODLevel& l = levels[level];
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, l.indexCount, INDEX_TYPE,
+            (void*)(l.firstIndex * sizeof(Index)), instanceCount, l.baseVertex);
+    }
+
+    void release()
+    {
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        VBO = EBO = 0;
+    }
+
+private:
+    static int16_t snorm16(float value)
+    {
+        return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+    }
+
+    static uint32_t snorm10(float value)
+    {
+        return static_cast<uint32_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 511.0f)) & 0x3ffu;
+    }
+
+    static uint16_t unorm16(float value)
+    {
+        return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+    }
+
+    // one createSphere vertex (position, normal, texcoord floats)
+    static SphereVertex pack(const float* v)
+    {
+        SphereVertex packed;
+        packed.position[0] = snorm16(v[0]);
+        packed.position[1] = snorm16(v[1]);
+        packed.position[2] = snorm16(v[2]);
+        packed.position[3] = 0;
+        packed.normal = snorm10(v[3]) | (snorm10(v[4]) << 10) | (snorm10(v[5]) << 20);
+        packed.texCoord[0] = unorm16(v[6]);
+        packed.texCoord[1] = unorm16(v[7]);
+        return packed;
+    }
+
+    // from generate() until upload()
+    std::vector<SphereVertex> vertices;
+    std::vector<Index> indices;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef STARTUP_TIMER_H
+#define STARTUP_TIMER_H
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Wall-clock time of the phases of a cold start, from program entry to the
+// first frame on screen. phase() closes the phase running since the previous
+// call (or construction) under the given name; report() prints them on one
+// line with the total against BUDGET_MS, so a new asset or catalog entry
+// that slows the launch shows up in the log of the run that added it.
+class StartupTimer
+{
+public:
+    static constexpr double BUDGET_MS = 300.0;
+
+    StartupTimer()
+        : start(std::chrono::steady_clock::now()), last(start)
+    {
+    }
+
+    void phase(const std::string& name)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        phases.push_back(std::make_pair(name, std::chrono::duration<double, std::milli>(now - last).count()));
+        last = now;
+    }
+
+    // ms from construction to the last phase()
+    double total() const
+    {
+        return std::chrono::duration<double, std::milli>(last - start).count();
+    }
+
+    void report() const
+    {
+        std::cout << "Startup " << static_cast<int>(total() + 0.5) << " ms (";
+        for (size_t i = 0; i < phases.size(); ++i)
+            std::cout << (i ? ", " : "") << phases[i].first << " " << static_cast<int>(phases[i].second + 0.5);
+        std::cout << ")";
+        if (total() > BUDGET_MS)
+            std::cout << ", over the " << BUDGET_MS << " ms budget";
+        std::cout << std::endl;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point last;
+    std::vector<std::pair<std::string, double> > phases;
+};
+
+#endif
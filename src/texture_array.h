@@ -0,0 +1,141 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <vector>
+
+// Every body texture as one layer of a GL_TEXTURE_2D_ARRAY, so the bodies can
+// be drawn together with a layer index per instance instead of a bind per
+// body. Layers share one size, and the source textures arrive at their own
+// sizes and formats (BC1/BC3 included, which cannot be render targets), so a
+// layer is filled by drawing its source into it with 6.texture_copy.fs rather
+// than copied texel for texel. copy() is called again whenever a source is
+// re-specified, which is how streamed textures replace their placeholders.
+class TextureArray
+{
+public:
+    static const unsigned int LAYER_WIDTH = 2048; // the catalog's equirectangular maps are 2:1
+    static const unsigned int LAYER_HEIGHT = 1024;
+
+    unsigned int texture = 0;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    std::vector<unsigned int> sources; // texture drawn into each layer; 0 samples as black
+
+    // one layer per entry of sources, each filled from its source as it is now;
+    // false if the driver cannot hold that many layers
+    bool setup(const std::vector<unsigned int>& layerSources, unsigned int copyProgram)
+    {
+        GLint maxLayers = 0, maxSize = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (layerSources.empty() || layerSources.size() > static_cast<size_t>(maxLayers))
+            return false;
+        sources = layerSources;
+        program = copyProgram;
+        width = std::min(LAYER_WIDTH, static_cast<unsigned int>(maxSize));
+        height = std::min(LAYER_HEIGHT, static_cast<unsigned int>(maxSize));
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        unsigned int levels = 1;
+        while ((std::max(width, height) >> levels) > 0)
+            ++levels;
+        for (unsigned int l = 0; l < levels; ++l)
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGBA8, std::max(width >> l, 1u), std::max(height >> l, 1u),
+                static_cast<GLsizei>(sources.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(1, &FBO);
+        glGenVertexArrays(1, &VAO); // core profile draws need one, even without attributes
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "source"), 0);
+        for (size_t i = 0; i < sources.size(); ++i)
+            copy(static_cast<unsigned int>(i));
+        finish();
+        return true;
+    }
+
+    // redraw every layer whose source is among the given (re-specified) textures
+    void refresh(const std::vector<unsigned int>& changed)
+    {
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            if (sources[i] && std::find(changed.begin(), changed.end(), sources[i]) != changed.end())
+                copy(static_cast<unsigned int>(i));
+        }
+        finish();
+    }
+
+    int layerOf(unsigned int source) const
+    {
+        std::vector<unsigned int>::const_iterator it = std::find(sources.begin(), sources.end(), source);
+        return it == sources.end() ? -1 : static_cast<int>(it - sources.begin());
+    }
+
+    // leaves unit 0 active
+    void bind(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void release()
+    {
+        glDeleteTextures(1, &texture);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &VAO);
+        texture = FBO = VAO = 0;
+        sources.clear();
+    }
+
+private:
+    unsigned int program = 0;
+    unsigned int FBO = 0;
+    unsigned int VAO = 0;
+    bool dirty = false;
+
+    // draw the layer's source over level 0 of the layer; binds unit 0
+    void copy(unsigned int layer)
+    {
+        GLint viewport[4], framebuffer;
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, static_cast<GLint>(layer));
+        glViewport(0, 0, width, height);
+        glDisable(GL_DEPTH_TEST);
+        glUseProgram(program);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, sources[layer]);
+        glBindVertexArray(VAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if (depthTest)
+            glEnable(GL_DEPTH_TEST);
+        dirty = true;
+    }
+
+    // rebuild the mip chain once for however many layers were redrawn
+    void finish()
+    {
+        if (!dirty)
+            return;
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        dirty = false;
+    }
+};
+
+#endif
@@ -0,0 +1,455 @@
+#ifndef TEXTURE_BAKE_H
+#define TEXTURE_BAKE_H
+
+#include <stb_image.h>
+
+#include "job_system.h"
+#include "ktx2.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Offline texture baking: decode once with stb, build the mip chain with a box
+// filter and encode every level to BC1 (opaque) or BC3 (with alpha), stored in
+// a KTX2 file the loader uploads without decoding anything. BC1 is 4 bits per
+// texel, a sixth of the RGB8 upload it replaces.
+namespace texture_bake {
+
+// the loader compares this with the source file to spot stale bakes: the
+// FNV-1a hash of its contents, as ShaderVariants hashes shader sources
+const char* const SOURCE_HASH_KEY = "SolarSystem3D.sourceHash";
+
+// virtual texture tiles (.vt): BC1 tiles of VT_TILE_SIZE texels whose
+// VT_TILE_BORDER ring repeats the neighbouring tiles, so bilinear filtering
+// inside the payload never reads another tile of the cache
+const unsigned int VT_TILE_SIZE = 128;
+const unsigned int VT_TILE_BORDER = 4;
+const unsigned int VT_TILE_PAYLOAD = VT_TILE_SIZE - 2 * VT_TILE_BORDER;
+const unsigned int VT_TILE_BYTES = (VT_TILE_SIZE / 4) * (VT_TILE_SIZE / 4) * 8;
+const unsigned int VT_HEADER_BYTES = 32;
+const unsigned char VT_MAGIC[4] = { 'S', 'S', 'V', 'T' };
+
+// texture.jpg -> texture.ktx2, where the loader looks first
+inline std::string bakedPath(const std::string& source)
+{
+    size_t dot = source.find_last_of('.');
+    size_t slash = source.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return source + ".ktx2";
+    return source.substr(0, dot) + ".ktx2";
+}
+
+// earth_16k.jpg -> earth_16k.vt
+inline std::string virtualTexturePath(const std::string& source)
+{
+    std::string ktx2 = bakedPath(source);
+    return ktx2.substr(0, ktx2.size() - 5) + ".vt";
+}
+
+inline long long fileBytes(const std::string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    return file ? static_cast<long long>(file.tellg()) : -1;
+}
+
+// FNV-1a of a file's bytes, as a decimal string; empty if it cannot be read
+inline std::string fileHash(const std::string& path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        return std::string();
+    uint64_t h = 14695981039346656037ull;
+    char buffer[65536];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0)
+    {
+        for (std::streamsize i = 0; i < file.gcount(); ++i)
+        {
+            h ^= static_cast<unsigned char>(buffer[i]);
+            h *= 1099511628211ull;
+        }
+    }
+    return std::to_string(h);
+}
+
+inline unsigned int pack565(const int c[3])
+{
+    return ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+}
+
+inline void unpack565(unsigned int v, int c[3])
+{
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (r << 3) | (r >> 2);
+    c[1] = (g << 2) | (g >> 4);
+    c[2] = (b << 3) | (b >> 2);
+}
+
+// 4x4 RGBA texels -> 8 byte BC1 colour block. Endpoints span the bounding box
+// along the block's main diagonal, inset by 1/16 so the extremes land on the
+// interpolated colours; always 4-colour mode, so BC3 can reuse it.
+inline void encodeColorBlock(const unsigned char* texels, unsigned char* out)
+{
+    int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 }, mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            lo[c] = std::min(lo[c], (int)texels[4 * i + c]);
+            hi[c] = std::max(hi[c], (int)texels[4 * i + c]);
+            mean[c] += texels[4 * i + c];
+        }
+    }
+    // red and blue run against green: flip them onto the other diagonal
+    int covRG = 0, covBG = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        int g = 16 * texels[4 * i + 1] - mean[1];
+        covRG += (16 * texels[4 * i] - mean[0]) * g;
+        covBG += (16 * texels[4 * i + 2] - mean[2]) * g;
+    }
+    if (covRG < 0)
+        std::swap(lo[0], hi[0]);
+    if (covBG < 0)
+        std::swap(lo[2], hi[2]);
+    int e0[3], e1[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        int inset = (hi[c] - lo[c]) / 16;
+        e0[c] = std::min(std::max(hi[c] - inset, 0), 255);
+        e1[c] = std::min(std::max(lo[c] + inset, 0), 255);
+    }
+
+    unsigned int c0 = pack565(e0), c1 = pack565(e1);
+    if (c0 < c1)
+        std::swap(c0, c1);
+    unsigned int indices = 0;
+    if (c0 != c1)
+    {
+        int palette[4][3];
+        unpack565(c0, palette[0]);
+        unpack565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; ++p)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; ++c)
+                {
+                    int d = texels[4 * i + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= static_cast<unsigned int>(best) << (2 * i);
+        }
+    }
+    out[0] = c0 & 255;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 255;
+    out[3] = c1 >> 8;
+    for (int b = 0; b < 4; ++b)
+        out[4 + b] = (indices >> (8 * b)) & 255;
+}
+
+// 4x4 alphas -> 8 byte BC3 alpha block between the block's min and max, 8 levels
+inline void encodeAlphaBlock(const unsigned char* texels, unsigned char* out)
+{
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; ++i)
+    {
+        a0 = std::max(a0, (int)texels[4 * i + 3]);
+        a1 = std::min(a1, (int)texels[4 * i + 3]);
+    }
+    unsigned long long indices = 0;
+    if (a0 != a1)
+    {
+        // index 0 = a0, 1 = a1, 2..7 step from a0 towards a1
+        for (int i = 0; i < 16; ++i)
+        {
+            int t = ((a0 - texels[4 * i + 3]) * 14 + (a0 - a1)) / (2 * (a0 - a1)); // 0..7 from a0
+            int index = t == 0 ? 0 : t == 7 ? 1 : t + 1;
+            indices |= static_cast<unsigned long long>(index) << (3 * i);
+        }
+    }
+    out[0] = static_cast<unsigned char>(a0);
+    out[1] = static_cast<unsigned char>(a1);
+    for (int b = 0; b < 6; ++b)
+        out[2 + b] = (indices >> (8 * b)) & 255;
+}
+
+// encode one RGBA8 level, block rows spread over the job system
+inline void encodeLevel(const std::vector<unsigned char>& rgba, unsigned int width, unsigned int height, bool alpha,
+    std::vector<unsigned char>& out, JobSystem& jobs)
+{
+    unsigned int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    unsigned int blockBytes = alpha ? 16 : 8;
+    out.resize(static_cast<size_t>(blocksX) * blocksY * blockBytes);
+    const unsigned char* in = rgba.data();
+    unsigned char* dst = out.data();
+    jobs.parallelFor(blocksY, 8, [=](size_t begin, size_t end) {
+        unsigned char texels[64];
+        for (size_t by = begin; by < end; ++by)
+        {
+            for (unsigned int bx = 0; bx < blocksX; ++bx)
+            {
+                // edge blocks repeat the last row / column
+                for (unsigned int y = 0; y < 4; ++y)
+                {
+                    unsigned int sy = std::min(static_cast<unsigned int>(by) * 4 + y, height - 1);
+                    for (unsigned int x = 0; x < 4; ++x)
+                    {
+                        unsigned int sx = std::min(bx * 4 + x, width - 1);
+                        const unsigned char* p = in + (static_cast<size_t>(sy) * width + sx) * 4;
+                        std::copy(p, p + 4, texels + (y * 4 + x) * 4);
+                    }
+                }
+                unsigned char* block = dst + (by * blocksX + bx) * blockBytes;
+                if (alpha)
+                {
+                    encodeAlphaBlock(texels, block);
+                    block += 8;
+                }
+                encodeColorBlock(texels, block);
+            }
+        }
+    });
+}
+
+// next mip level: 2x2 box filter, an odd last row / column folds into its neighbour
+inline void downsample(const std::vector<unsigned char>& in, unsigned int width, unsigned int height,
+    std::vector<unsigned char>& out, JobSystem& jobs)
+{
+    unsigned int w = std::max(width / 2, 1u), h = std::max(height / 2, 1u);
+    out.resize(static_cast<size_t>(w) * h * 4);
+    const unsigned char* src = in.data();
+    unsigned char* dst = out.data();
+    jobs.parallelFor(h, 64, [=](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y)
+        {
+            unsigned int y0 = std::min(static_cast<unsigned int>(y) * 2, height - 1), y1 = std::min(y0 + 1, height - 1);
+            for (unsigned int x = 0; x < w; ++x)
+            {
+                unsigned int x0 = std::min(x * 2, width - 1), x1 = std::min(x0 + 1, width - 1);
+                for (unsigned int c = 0; c < 4; ++c)
+                {
+                    unsigned int sum = src[(static_cast<size_t>(y0) * width + x0) * 4 + c] + src[(static_cast<size_t>(y0) * width + x1) * 4 + c]
+                        + src[(static_cast<size_t>(y1) * width + x0) * 4 + c] + src[(static_cast<size_t>(y1) * width + x1) * 4 + c];
+                    dst[(y * w + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+                }
+            }
+        }
+    });
+}
+
+// compress an RGBA8 image and its mip chain, down to 1x1
+inline void compressImage(const unsigned char* rgba, unsigned int width, unsigned int height, Ktx2Image& image, JobSystem& jobs)
+{
+    bool alpha = false;
+    for (size_t i = 0; i < static_cast<size_t>(width) * height && !alpha; ++i)
+        alpha = rgba[4 * i + 3] != 255;
+    image.vkFormat = alpha ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    image.width = width;
+    image.height = height;
+    image.levels.clear();
+
+    std::vector<unsigned char> level(rgba, rgba + static_cast<size_t>(width) * height * 4), next;
+    unsigned int w = width, h = height;
+    for (;;)
+    {
+        image.levels.push_back(std::vector<unsigned char>());
+        encodeLevel(level, w, h, alpha, image.levels.back(), jobs);
+        if (w == 1 && h == 1)
+            break;
+        downsample(level, w, h, next, jobs);
+        level.swap(next);
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+}
+
+// the bake of source, if there is one that is current: false with an empty
+// reason when nothing was baked, with the reason when a bake exists but is
+// stale or unreadable
+inline bool loadBaked(const std::string& source, Ktx2Image& image, std::string& reason)
+{
+    reason.clear();
+    std::string path = bakedPath(source);
+    if (fileBytes(path) < 0)
+        return false;
+    // the levels are only read once the key/value data shows the bake is current
+    if (!readKtx2KeyValues(path, image.keyValues, reason))
+        return false;
+    const std::string* sourceHash = image.value(SOURCE_HASH_KEY);
+    std::string hash = fileHash(source);
+    if (!hash.empty() && (!sourceHash || *sourceHash != hash))
+    {
+        reason = "older than " + source + ", run --bake-textures";
+        return false;
+    }
+    return readKtx2(path, image, reason);
+}
+
+// source image -> KTX2 next to it; flipped like TextureStreamer flips for GL
+inline bool bakeTexture(const std::string& source, JobSystem& jobs, std::string& error)
+{
+    int width, height, nrComponents;
+    stbi_set_flip_vertically_on_load(true);
+    unsigned char* data = stbi_load(source.c_str(), &width, &height, &nrComponents, 4);
+    if (!data)
+    {
+        error = "cannot decode " + source;
+        return false;
+    }
+    Ktx2Image image;
+    compressImage(data, static_cast<unsigned int>(width), static_cast<unsigned int>(height), image, jobs);
+    stbi_image_free(data);
+    image.keyValues.push_back(std::make_pair(std::string("KTXwriter"), std::string("SolarSystem3D texture bake")));
+    image.keyValues.push_back(std::make_pair(std::string(SOURCE_HASH_KEY), fileHash(source)));
+    return writeKtx2(bakedPath(source), image, error);
+}
+
+// bilinear resize of an RGBA8 image, wrapping in x (longitude) and clamping in
+// y; halving lands every sample between four texels, a 2x2 box filter
+inline void resample(const std::vector<unsigned char>& in, unsigned int width, unsigned int height,
+    std::vector<unsigned char>& out, unsigned int outWidth, unsigned int outHeight, JobSystem& jobs)
+{
+    out.resize(static_cast<size_t>(outWidth) * outHeight * 4);
+    const unsigned char* src = in.data();
+    unsigned char* dst = out.data();
+    float sx = static_cast<float>(width) / outWidth, sy = static_cast<float>(height) / outHeight;
+    jobs.parallelFor(outHeight, 16, [=](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y)
+        {
+            float fy = std::min(std::max((y + 0.5f) * sy - 0.5f, 0.0f), static_cast<float>(height - 1));
+            unsigned int y0 = static_cast<unsigned int>(fy), y1 = std::min(y0 + 1, height - 1);
+            float ty = fy - y0;
+            for (unsigned int x = 0; x < outWidth; ++x)
+            {
+                float fx = (x + 0.5f) * sx - 0.5f;
+                if (fx < 0.0f)
+                    fx += width;
+                unsigned int x0 = static_cast<unsigned int>(fx) % width, x1 = (x0 + 1) % width;
+                float tx = fx - std::floor(fx);
+                for (unsigned int c = 0; c < 4; ++c)
+                {
+                    float top = src[(static_cast<size_t>(y0) * width + x0) * 4 + c] * (1.0f - tx) + src[(static_cast<size_t>(y0) * width + x1) * 4 + c] * tx;
+                    float bottom = src[(static_cast<size_t>(y1) * width + x0) * 4 + c] * (1.0f - tx) + src[(static_cast<size_t>(y1) * width + x1) * 4 + c] * tx;
+                    dst[(y * outWidth + x) * 4 + c] = static_cast<unsigned char>(top * (1.0f - ty) + bottom * ty + 0.5f);
+                }
+            }
+        }
+    });
+}
+
+// Equirectangular image -> tiled virtual texture next to it (.vt). The image
+// is resized to a power-of-two number of tiles per side, and every level down
+// to a single tile is cut into bordered tiles and compressed to BC1. Layout:
+// 32 byte header (magic, version, tiles x and y at level 0, level count, tile
+// size, border, format), then the tiles of level 0, 1, ... row by row, each
+// VT_TILE_BYTES, so any tile is one seek away.
+inline bool bakeVirtualTexture(const std::string& source, JobSystem& jobs, std::string& error)
+{
+    int width, height, nrComponents;
+    stbi_set_flip_vertically_on_load(true);
+    unsigned char* data = stbi_load(source.c_str(), &width, &height, &nrComponents, 4);
+    if (!data)
+    {
+        error = "cannot decode " + source;
+        return false;
+    }
+    // nearest power of two of tiles, in log space
+    unsigned int tilesX = 1, tilesY = 1;
+    while (tilesX * VT_TILE_PAYLOAD * 1.41421356f < static_cast<float>(width))
+        tilesX *= 2;
+    while (tilesY * VT_TILE_PAYLOAD * 1.41421356f < static_cast<float>(height))
+        tilesY *= 2;
+    unsigned int levelCount = 1;
+    while ((tilesX >> (levelCount - 1)) > 1 || (tilesY >> (levelCount - 1)) > 1)
+        ++levelCount;
+
+    std::ofstream file(virtualTexturePath(source).c_str(), std::ios::binary);
+    if (!file)
+    {
+        stbi_image_free(data);
+        error = "cannot create " + virtualTexturePath(source);
+        return false;
+    }
+    std::vector<unsigned char> header(VT_MAGIC, VT_MAGIC + 4);
+    ktx2_detail::put32(header, 1);
+    ktx2_detail::put32(header, tilesX);
+    ktx2_detail::put32(header, tilesY);
+    ktx2_detail::put32(header, levelCount);
+    ktx2_detail::put32(header, VT_TILE_SIZE);
+    ktx2_detail::put32(header, VT_TILE_BORDER);
+    ktx2_detail::put32(header, VK_FORMAT_BC1_RGB_UNORM_BLOCK);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+    std::vector<unsigned char> level(data, data + static_cast<size_t>(width) * height * 4), next;
+    stbi_image_free(data);
+    unsigned int w = static_cast<unsigned int>(width), h = static_cast<unsigned int>(height);
+    std::vector<unsigned char> tiles;
+    for (unsigned int l = 0; l < levelCount; ++l)
+    {
+        unsigned int levelTilesX = std::max(tilesX >> l, 1u), levelTilesY = std::max(tilesY >> l, 1u);
+        resample(level, w, h, next, levelTilesX * VT_TILE_PAYLOAD, levelTilesY * VT_TILE_PAYLOAD, jobs);
+        level.swap(next);
+        w = levelTilesX * VT_TILE_PAYLOAD;
+        h = levelTilesY * VT_TILE_PAYLOAD;
+
+        tiles.resize(static_cast<size_t>(levelTilesX) * levelTilesY * VT_TILE_BYTES);
+        const unsigned char* in = level.data();
+        unsigned char* out = tiles.data();
+        unsigned int lw = w, lh = h;
+        jobs.parallelFor(static_cast<size_t>(levelTilesX) * levelTilesY, 4, [=](size_t begin, size_t end) {
+            unsigned char texels[64];
+            for (size_t t = begin; t < end; ++t)
+            {
+                int originX = static_cast<int>(t % levelTilesX * VT_TILE_PAYLOAD) - static_cast<int>(VT_TILE_BORDER);
+                int originY = static_cast<int>(t / levelTilesX * VT_TILE_PAYLOAD) - static_cast<int>(VT_TILE_BORDER);
+                unsigned char* block = out + t * VT_TILE_BYTES;
+                for (unsigned int by = 0; by < VT_TILE_SIZE / 4; ++by)
+                {
+                    for (unsigned int bx = 0; bx < VT_TILE_SIZE / 4; ++bx, block += 8)
+                    {
+                        for (unsigned int y = 0; y < 4; ++y)
+                        {
+                            int sy = std::min(std::max(originY + static_cast<int>(by * 4 + y), 0), static_cast<int>(lh) - 1);
+                            for (unsigned int x = 0; x < 4; ++x)
+                            {
+                                int sx = (originX + static_cast<int>(bx * 4 + x) + static_cast<int>(lw)) % static_cast<int>(lw);
+                                const unsigned char* p = in + (static_cast<size_t>(sy) * lw + sx) * 4;
+                                std::copy(p, p + 4, texels + (y * 4 + x) * 4);
+                            }
+                        }
+                        encodeColorBlock(texels, block);
+                    }
+                }
+            }
+        });
+        file.write(reinterpret_cast<const char*>(tiles.data()), tiles.size());
+    }
+    if (!file)
+    {
+        error = "cannot write " + virtualTexturePath(source);
+        return false;
+    }
+    return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+#include "ktx2.h"
+#include "texture_bake.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Textures loaded behind the first frames. request() returns a texture name at
+// once, holding a 1x1 texel of the placeholder colour; loader threads read the
+// baked KTX2 or decode the source, and the GL thread's update() re-specifies
+// the same texture from a pixel buffer object when the data is ready, so the
+// caller never swaps handles. Each texture moves through
+//   decoding (loader) -> decoded -> copying into a mapped PBO (loader) -> copied
+//   -> uploaded from the PBO (GL thread)
+// and update() maps at most UPLOAD_BYTES_PER_FRAME per frame, so a burst of
+// finished decodes spreads over several frames instead of stalling one.
+class TextureStreamer
+{
+public:
+    static const size_t UPLOAD_BYTES_PER_FRAME = 64u << 20;
+
+    // loader threads for disk reads and decodes, kept apart from the frame's jobs
+    void start(unsigned int threads)
+    {
+        loaders.start(threads > 0 ? threads : 1);
+        // stb keeps the flip in a global; set once here, read by every loader
+        stbi_set_flip_vertically_on_load(true);
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    // texture for path, filled with color until the image arrives; requests for
+    // the same path share one texture (and the first request's colour)
+    unsigned int request(const std::string& path, const glm::vec3& color)
+    {
+        std::unordered_map<std::string, unsigned int>::iterator it = byPath.find(path);
+        if (it != byPath.end())
+            return it->second;
+
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        unsigned char texel[3];
+        for (int c = 0; c < 3; ++c)
+            texel[c] = static_cast<unsigned char>(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, texel);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        byPath[path] = textureID;
+
+        requests.push_back(std::unique_ptr<Request>(new Request()));
+        Request* r = requests.back().get();
+        r->path = path;
+        r->texture = textureID;
+        r->allowCompressed = compressedTexturesSupported();
+        loaders.run(counter, [r]() { decode(*r); });
+        return textureID;
+    }
+
+    // GL thread, once per frame: start PBO copies for finished decodes and
+    // upload the finished copies
+    void update()
+    {
+        arrived.clear();
+        size_t budget = UPLOAD_BYTES_PER_FRAME;
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            Request& r = *requests[i];
+            int state = r.state.load(std::memory_order_acquire);
+            if (state == DECODED && (r.bytes <= budget || budget == UPLOAD_BYTES_PER_FRAME))
+            {
+                budget -= std::min(budget, r.bytes);
+                beginCopy(r);
+            }
+            else if (state == COPIED)
+                finishUpload(r);
+            else if (state == FAILED)
+            {
+                std::cout << "Texture failed to load at path: " << r.path << " (" << r.error << "), keeping its placeholder colour" << std::endl;
+                r.state.store(DONE);
+                ++finished;
+            }
+        }
+        if (finished == requests.size() && !reported && !requests.empty())
+        {
+            reported = true;
+            std::cout << "Streamed " << uploaded << " textures (" << baked << " baked, " << uploadedBytes / (1024 * 1024) << " MB) in "
+                << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count() << " ms" << std::endl;
+        }
+    }
+
+    // textures re-specified with their image by the last update(), for copies
+    // of them such as the layers of a TextureArray
+    const std::vector<unsigned int>& arrivedTextures() const
+    {
+        return arrived;
+    }
+
+    // every request has reached its texture or failed
+    bool idle() const
+    {
+        return finished == requests.size();
+    }
+
+    // waits for loaders still running; textures stay owned by the caller
+    void release()
+    {
+        loaders.wait(counter);
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            Request& r = *requests[i];
+            if (r.pbo)
+            {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r.pbo);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                glDeleteBuffers(1, &r.pbo);
+            }
+            if (r.pixels)
+                stbi_image_free(r.pixels);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        requests.clear();
+        byPath.clear();
+        loaders.stop();
+    }
+
+private:
+    enum State { DECODING, DECODED, COPYING, COPIED, FAILED, DONE };
+
+    struct Request {
+        std::string path;
+        unsigned int texture = 0;
+        bool allowCompressed = false;
+        std::atomic<int> state{ DECODING };
+        std::string error;
+        // decoded data: either a baked image or stb's pixels
+        bool compressed = false;
+        Ktx2Image image;
+        unsigned char* pixels = NULL;
+        int width = 0, height = 0;
+        GLenum format = GL_RGB;
+        size_t bytes = 0;
+        unsigned int pbo = 0;
+        void* mapped = NULL;
+    };
+
+    JobSystem loaders;
+    JobSystem::Counter counter;
+    std::vector<std::unique_ptr<Request> > requests;
+    std::unordered_map<std::string, unsigned int> byPath;
+    std::vector<unsigned int> arrived;
+    std::chrono::steady_clock::time_point startTime;
+    size_t finished = 0;
+    size_t uploaded = 0;
+    size_t baked = 0;
+    size_t uploadedBytes = 0;
+    bool reported = false;
+
+    // loader thread
+    static void decode(Request& r)
+    {
+        std::string reason;
+        if (r.allowCompressed && texture_bake::loadBaked(r.path, r.image, reason))
+        {
+            r.compressed = true;
+            for (size_t l = 0; l < r.image.levels.size(); ++l)
+                r.bytes += r.image.levels[l].size();
+        }
+        else
+        {
+            r.error = reason; // a stale or unreadable bake, reported with the upload
+            int nrComponents;
+            r.pixels = stbi_load(r.path.c_str(), &r.width, &r.height, &nrComponents, 0);
+            if (!r.pixels)
+            {
+                r.error = reason.empty() ? "cannot decode" : reason;
+                r.state.store(FAILED, std::memory_order_release);
+                return;
+            }
+            r.format = nrComponents == 1 ? GL_RED : nrComponents == 2 ? GL_RG : nrComponents == 4 ? GL_RGBA : GL_RGB;
+            r.bytes = static_cast<size_t>(r.width) * r.height * nrComponents;
+        }
+        r.state.store(DECODED, std::memory_order_release);
+    }
+
+    // GL thread: map a PBO for the request and let a loader fill it
+    void beginCopy(Request& r)
+    {
+        glGenBuffers(1, &r.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r.pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, r.bytes, NULL, GL_STREAM_DRAW);
+        r.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, r.bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!r.mapped)
+        {
+            // no mapping: upload straight from client memory
+            glDeleteBuffers(1, &r.pbo);
+            r.pbo = 0;
+            finishUpload(r);
+            return;
+        }
+        r.state.store(COPYING);
+        Request* request = &r;
+        loaders.run(counter, [request]() {
+            Request& q = *request;
+            unsigned char* out = static_cast<unsigned char*>(q.mapped);
+            if (q.compressed)
+            {
+                for (size_t l = 0; l < q.image.levels.size(); ++l)
+                {
+                    std::memcpy(out, q.image.levels[l].data(), q.image.levels[l].size());
+                    out += q.image.levels[l].size();
+                    std::vector<unsigned char>().swap(q.image.levels[l]);
+                }
+            }
+            else
+            {
+                std::memcpy(out, q.pixels, q.bytes);
+                stbi_image_free(q.pixels);
+                q.pixels = NULL;
+            }
+            q.state.store(COPIED, std::memory_order_release);
+        });
+    }
+
+    // GL thread: re-specify the placeholder texture from the PBO (or, without
+    // one, from the decoded data)
+    void finishUpload(Request& r)
+    {
+        const unsigned char* base = NULL;
+        if (r.pbo)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, r.pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            r.mapped = NULL;
+        }
+        glBindTexture(GL_TEXTURE_2D, r.texture);
+        if (r.compressed)
+        {
+            GLenum format = ktx2GLFormat(r.image.vkFormat);
+            size_t offset = 0;
+            uint32_t levelWidth = r.image.width, levelHeight = r.image.height;
+            for (size_t l = 0; l < r.image.levels.size(); ++l, levelWidth = std::max(levelWidth / 2, 1u), levelHeight = std::max(levelHeight / 2, 1u))
+            {
+                GLsizei w = static_cast<GLsizei>(levelWidth), h = static_cast<GLsizei>(levelHeight);
+                GLsizei size = static_cast<GLsizei>(((w + 3) / 4) * ((h + 3) / 4) * r.image.blockBytes());
+                const unsigned char* data = r.pbo ? base + offset : r.image.levels[l].data();
+                glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(l), format, w, h, 0, size, data);
+                offset += size;
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(r.image.levels.size()) - 1);
+            ++baked;
+        }
+        else
+        {
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, r.format, r.width, r.height, 0, r.format, GL_UNSIGNED_BYTE, r.pbo ? base : r.pixels);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            if (!r.error.empty())
+                std::cout << "Ignoring " << texture_bake::bakedPath(r.path) << ": " << r.error << std::endl;
+        }
+        if (r.pbo)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &r.pbo); // the driver keeps it until the upload is done
+            r.pbo = 0;
+        }
+        if (r.pixels)
+        {
+            stbi_image_free(r.pixels);
+            r.pixels = NULL;
+        }
+        r.image.levels.clear();
+        uploadedBytes += r.bytes;
+        arrived.push_back(r.texture);
+        ++uploaded;
+        ++finished;
+        r.state.store(DONE);
+    }
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef UNIFORM_BUFFERS_H
+#define UNIFORM_BUFFERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "dynamic_buffer.h"
+#include "lighting.h"
+
+#include <cstring>
+
+// fixed uniform block binding points shared by every program
+const unsigned int CAMERA_BLOCK_BINDING = 0;
+const unsigned int LIGHTS_BLOCK_BINDING = 1;
+
+// std140 layout of the Camera block
+struct CameraBlock {
+    glm::mat4 projection;
+    glm::mat4 view;
+    glm::vec3 viewPos;
+    float padding0;
+    glm::vec3 viewFront;
+    float padding1;
+    glm::vec4 clusterParams; // LightClusters::params
+    glm::vec4 renderOrigin;  // xyz: the world position render space is relative to
+};
+
+// std140 layout of the Lights block, with isLit() of the two lights
+struct LightsBlock {
+    DirLight dirLight;
+    SpotLight spotLight;
+    int dirLightOn;
+    int spotLightOn;
+    int padding[2];
+};
+
+static_assert(sizeof(CameraBlock) == 192, "CameraBlock must match std140 layout");
+static_assert(sizeof(LightsBlock) == 144, "LightsBlock must match std140 layout");
+
+// Camera and light state in uniform buffer objects bound at fixed binding
+// points, so one update per frame feeds every program that declares the blocks.
+// The camera changes every frame, so it goes through a mapped ring and each
+// frame binds its own segment.
+class UniformBuffers
+{
+public:
+    DynamicBuffer camera;
+    unsigned int lightsUBO = 0;
+
+    void setup()
+    {
+        camera.setup(GL_UNIFORM_BUFFER, sizeof(CameraBlock));
+        glGenBuffers(1, &lightsUBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, lightsUBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsBlock), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, camera.buffer, 0, sizeof(CameraBlock)); // until the first updateCamera()
+        glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTS_BLOCK_BINDING, lightsUBO);
+    }
+
+    // GLSL 330 has no layout(binding), so route each program's blocks here once after linking
+    static void bindProgram(unsigned int program)
+    {
+        unsigned int cameraIndex = glGetUniformBlockIndex(program, "Camera");
+        if (cameraIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, cameraIndex, CAMERA_BLOCK_BINDING);
+        unsigned int lightsIndex = glGetUniformBlockIndex(program, "Lights");
+        if (lightsIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, lightsIndex, LIGHTS_BLOCK_BINDING);
+    }
+
+    // view, projection and position in render space (BodyStore::rebase())
+    void updateCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position, const glm::vec3& front,
+        const glm::vec4& clusterParams, const glm::vec3& renderOrigin)
+    {
+        CameraBlock* block = static_cast<CameraBlock*>(camera.begin(sizeof(CameraBlock)));
+        if (!block)
+            return;
+        block->projection = projection;
+        block->view = view;
+        block->viewPos = position;
+        block->padding0 = 0.0f;
+        block->viewFront = front;
+        block->padding1 = 0.0f;
+        block->clusterParams = clusterParams;
+        block->renderOrigin = glm::vec4(renderOrigin, 0.0f);
+        camera.end();
+        glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, camera.buffer, camera.offset(), sizeof(CameraBlock));
+    }
+
+    // re-upload the Lights block only when the setup changed since the last call
+    void updateLights(const LightSetup& lights)
+    {
+        if (uploadedLightsVersion == lights.version)
+            return;
+        uploadedLightsVersion = lights.version;
+
+        LightsBlock block;
+        std::memset(static_cast<void*>(&block), 0, sizeof(block));
+        block.dirLight = lights.dirLight;
+        block.spotLight = lights.spotLight;
+        block.dirLightOn = isLit(lights.dirLight) ? 1 : 0;
+        block.spotLightOn = isLit(lights.spotLight) ? 1 : 0;
+        glBindBuffer(GL_UNIFORM_BUFFER, lightsUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightsBlock), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void release()
+    {
+        camera.release();
+        glDeleteBuffers(1, &lightsUBO);
+        lightsUBO = 0;
+    }
+
+private:
+    unsigned int uploadedLightsVersion = 0;
+};
+
+#endif
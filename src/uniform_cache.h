@@ -0,0 +1,101 @@
+#ifndef UNIFORM_CACHE_H
+#define UNIFORM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Uniform name -> location table for one linked program, filled once from the
+// program's active uniform list so the render loop never calls
+// glGetUniformLocation or builds name strings.
+class UniformCache
+{
+public:
+    UniformCache() {}
+    explicit UniformCache(unsigned int program)
+    {
+        build(program);
+    }
+
+    void build(unsigned int program)
+    {
+        locations.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> buffer(maxLength > 0 ? maxLength : 1);
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint size = 0;
+            GLenum type = 0;
+            GLsizei length = 0;
+            glGetActiveUniform(program, i, maxLength, &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            GLint location = glGetUniformLocation(program, name.c_str());
+            if (location < 0)
+                continue; // member of a uniform block
+            locations[name] = location;
+
+            // arrays of basic types are listed once as "name[0]"; register every element too
+            if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = name.substr(0, name.size() - 3);
+                locations[base] = location;
+                for (GLint e = 1; e < size; ++e)
+                {
+                    std::string element = base + "[" + std::to_string(e) + "]";
+                    locations[element] = glGetUniformLocation(program, element.c_str());
+                }
+            }
+        }
+    }
+
+    // -1 (ignored by glUniform*) when the uniform is not active in the program
+    int operator[](const std::string& name) const
+    {
+        std::unordered_map<std::string, int>::const_iterator it = locations.find(name);
+        return it == locations.end() ? -1 : it->second;
+    }
+
+    static void set(int location, int value)
+    {
+        glUniform1i(location, value);
+    }
+    static void set(int location, unsigned int value)
+    {
+        glUniform1ui(location, value);
+    }
+    static void set(int location, float value)
+    {
+        glUniform1f(location, value);
+    }
+    static void set(int location, const glm::vec2& value)
+    {
+        glUniform2fv(location, 1, &value[0]);
+    }
+    static void set(int location, const glm::vec3& value)
+    {
+        glUniform3fv(location, 1, &value[0]);
+    }
+    static void set(int location, const glm::vec4& value)
+    {
+        glUniform4fv(location, 1, &value[0]);
+    }
+    static void set(int location, const glm::mat3& mat)
+    {
+        glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+    static void set(int location, const glm::mat4& mat)
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+private:
+    std::unordered_map<std::string, int> locations;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Triangle and vertex reordering for the post-transform vertex cache, after
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation". Triangles are
+// emitted greedily by the score of their vertices in a simulated LRU cache
+// (recently used vertices and vertices with few triangles left score high),
+// then vertices are renumbered in the order the new index list first uses
+// them, so the vertex fetch walks the buffer forwards too.
+namespace vertex_cache {
+
+const int CACHE_SIZE = 32; // simulated entries; the score does not depend much on the real size
+
+inline float vertexScore(int cachePosition, unsigned int trianglesLeft)
+{
+    if (trianglesLeft == 0)
+        return -1.0f;
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // the last triangle's vertices score the same, so strips are not favoured
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - (cachePosition - 3) / static_cast<float>(CACHE_SIZE - 3), 1.5f);
+    }
+    return score + 2.0f / std::sqrt(static_cast<float>(trianglesLeft));
+}
+
+// reorder a triangle list over vertexCount vertices in place
+inline void optimizeTriangles(std::vector<unsigned int>& indices, size_t vertexCount)
+{
+    const size_t triangleCount = indices.size() / 3;
+    std::vector<unsigned int> trianglesLeft(vertexCount, 0);
+    for (size_t i = 0; i < indices.size(); ++i)
+        ++trianglesLeft[indices[i]];
+    // the triangles of every vertex, back to back
+    std::vector<size_t> firstTriangle(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; ++v)
+        firstTriangle[v + 1] = firstTriangle[v] + trianglesLeft[v];
+    std::vector<size_t> vertexTriangles(indices.size());
+    std::vector<size_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        vertexTriangles[fill[indices[i]]++] = i / 3;
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        score[v] = vertexScore(-1, trianglesLeft[v]);
+    std::vector<char> emitted(triangleCount, 0);
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+    std::vector<unsigned int> cache, nextCache;
+    size_t scan = 0; // no triangle before this one is left, for restarts
+    size_t best = triangleCount;
+    while (result.size() < indices.size())
+    {
+        if (best == triangleCount)
+        {
+            // nothing in the cache touches a triangle that is left: take the best of the rest
+            while (emitted[scan])
+                ++scan;
+            best = scan;
+            for (size_t t = scan + 1; t < triangleCount; ++t)
+            {
+                if (!emitted[t] && triangleScore[t] > triangleScore[best])
+                    best = t;
+            }
+        }
+        emitted[best] = 1;
+        nextCache.clear();
+        for (int c = 0; c < 3; ++c)
+        {
+            unsigned int v = indices[best * 3 + c];
+            result.push_back(v);
+            nextCache.push_back(v);
+            --trianglesLeft[v];
+            // drop the triangle from the vertex's list
+            size_t begin = firstTriangle[v], end = begin + trianglesLeft[v];
+            for (size_t k = begin; k <= end; ++k)
+            {
+                if (vertexTriangles[k] == best)
+                {
+                    vertexTriangles[k] = vertexTriangles[end];
+                    break;
+                }
+            }
+        }
+        for (size_t c = 0; c < cache.size(); ++c)
+        {
+            unsigned int v = cache[c];
+            if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+                nextCache.push_back(v);
+        }
+        for (size_t c = CACHE_SIZE; c < nextCache.size(); ++c)
+        {
+            cachePosition[nextCache[c]] = -1; // pushed out
+            score[nextCache[c]] = vertexScore(-1, trianglesLeft[nextCache[c]]);
+        }
+        if (nextCache.size() > static_cast<size_t>(CACHE_SIZE))
+            nextCache.resize(CACHE_SIZE);
+        cache.swap(nextCache);
+
+        // rescore what is cached, and pick the best triangle around it
+        for (size_t c = 0; c < cache.size(); ++c)
+        {
+            cachePosition[cache[c]] = static_cast<int>(c);
+            score[cache[c]] = vertexScore(static_cast<int>(c), trianglesLeft[cache[c]]);
+        }
+        best = triangleCount;
+        float bestScore = -1.0f;
+        for (size_t c = 0; c < cache.size(); ++c)
+        {
+            unsigned int v = cache[c];
+            for (size_t k = firstTriangle[v]; k < firstTriangle[v] + trianglesLeft[v]; ++k)
+            {
+                size_t t = vertexTriangles[k];
+                triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+    }
+    indices.swap(result);
+}
+
+// renumber the vertices (stride floats each) in first-use order of the
+// index list; unused vertices go last
+inline void optimizeFetch(std::vector<float>& vertices, std::vector<unsigned int>& indices, size_t stride)
+{
+    const size_t vertexCount = vertices.size() / stride;
+    const unsigned int unused = static_cast<unsigned int>(-1);
+    std::vector<unsigned int> remap(vertexCount, unused);
+    unsigned int next = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        if (remap[indices[i]] == unused)
+            remap[indices[i]] = next++;
+        indices[i] = remap[indices[i]];
+    }
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        if (remap[v] == unused)
+            remap[v] = next++;
+    }
+    std::vector<float> reordered(vertices.size());
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        for (size_t k = 0; k < stride; ++k)
+            reordered[remap[v] * stride + k] = vertices[v * stride + k];
+    }
+    vertices.swap(reordered);
+}
+
+// average vertices transformed per triangle through a FIFO cache of the
+// given size (ACMR; 0.5 is the ideal for a large closed mesh, 3 the worst)
+inline float averageCacheMissRatio(const std::vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize)
+{
+    if (indices.empty())
+        return 0.0f;
+    std::vector<size_t> insertedAt(vertexCount, 0); // insertion stamp, 0 = never cached
+    size_t stamp = 0, misses = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        size_t at = insertedAt[indices[i]];
+        if (at == 0 || stamp - at >= cacheSize)
+        {
+            ++misses;
+            insertedAt[indices[i]] = ++stamp;
+        }
+    }
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+} // namespace vertex_cache
+
+#endif
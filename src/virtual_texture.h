@@ -0,0 +1,460 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+#include "ktx2.h"
+#include "texture_bake.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Key of one tile: level in the top byte, then y and x in 12 bits each. The
+// feedback pass writes the same three numbers per pixel.
+inline uint32_t virtualPageKey(unsigned int level, unsigned int x, unsigned int y)
+{
+    return (level << 24) | (y << 12) | x;
+}
+
+// Tiled virtual texture for planet maps too large to be resident (16k-32k).
+// The .vt file written by texture_bake::bakeVirtualTexture holds a pyramid of
+// bordered BC1 tiles; only tiles the feedback pass saw are read, on a loader
+// thread, into a fixed cache texture of CACHE_TILES x CACHE_TILES slots that
+// evicts the least recently seen tile. A page table texture with one mip
+// level per tile level maps every tile to its cache slot, or to the slot of
+// the nearest resident coarser tile, so the lookup in 6.multiple_lights.fs
+// always finds something; the single tile of the last level never leaves.
+class VirtualTexture
+{
+public:
+    static const unsigned int CACHE_TILES = 32;          // 4096^2 texels, 8 MB of BC1
+    static const unsigned int MAX_UPLOADS_PER_FRAME = 16;
+    static const unsigned int MAX_IN_FLIGHT = 64;
+
+    unsigned int pageTable = 0; // RGBA8: cache slot x, y, mapped level, 255
+    unsigned int tileCache = 0;
+    unsigned int tilesX = 0;    // at level 0
+    unsigned int tilesY = 0;
+    unsigned int levelCount = 0;
+
+    bool open(const std::string& vtPath, std::string& error)
+    {
+        if (!compressedTexturesSupported())
+        {
+            error = "no S3TC support";
+            return false;
+        }
+        path = vtPath;
+        file.open(path.c_str(), std::ios::binary);
+        unsigned char header[texture_bake::VT_HEADER_BYTES];
+        if (!file || !file.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, texture_bake::VT_MAGIC, 4) != 0)
+        {
+            error = "cannot read " + path;
+            return false;
+        }
+        tilesX = ktx2_detail::get32(header + 8);
+        tilesY = ktx2_detail::get32(header + 12);
+        levelCount = ktx2_detail::get32(header + 16);
+        if (ktx2_detail::get32(header + 4) != 1 || ktx2_detail::get32(header + 20) != texture_bake::VT_TILE_SIZE
+            || ktx2_detail::get32(header + 24) != texture_bake::VT_TILE_BORDER || levelCount == 0 || levelCount > 16
+            || tilesX > 1024 || tilesY > 1024) // the feedback pass packs 10 bits per coordinate
+        {
+            error = path + " has an unsupported layout";
+            return false;
+        }
+        if (tilesX == 0 || tilesY == 0 || levelTilesX(levelCount - 1) != 1 || levelTilesY(levelCount - 1) != 1)
+        {
+            error = path + " does not end in a single tile"; // the pinned fallback of every page
+            return false;
+        }
+        firstTile.resize(levelCount);
+        unsigned int tiles = 0;
+        for (unsigned int l = 0; l < levelCount; ++l)
+        {
+            firstTile[l] = tiles;
+            tiles += levelTilesX(l) * levelTilesY(l);
+        }
+
+        unsigned int cacheSize = CACHE_TILES * texture_bake::VT_TILE_SIZE;
+        glGenTextures(1, &tileCache);
+        glBindTexture(GL_TEXTURE_2D, tileCache);
+        std::vector<unsigned char> clear(static_cast<size_t>(cacheSize / 4) * (cacheSize / 4) * 8, 0);
+        glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, cacheSize, cacheSize, 0, static_cast<GLsizei>(clear.size()), clear.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenTextures(1, &pageTable);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        pages.resize(levelCount);
+        for (unsigned int l = 0; l < levelCount; ++l)
+        {
+            pages[l].assign(static_cast<size_t>(levelTilesX(l)) * levelTilesY(l) * 4, 0);
+            glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8, levelTilesX(l), levelTilesY(l), 0, GL_RGBA, GL_UNSIGNED_BYTE, pages[l].data());
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        slots.assign(CACHE_TILES * CACHE_TILES, Slot());
+
+        // the coarsest tile is read now and pinned, the fallback of every page
+        Tile root;
+        root.key = virtualPageKey(levelCount - 1, 0, 0);
+        if (!readTile(root))
+        {
+            error = "cannot read the tiles of " + path;
+            return false;
+        }
+        unsigned int slot = upload(root, 0);
+        slots[slot].pinned = true;
+        rebuildPageTable();
+        loader.start(1);
+        return true;
+    }
+
+    unsigned int levelTilesX(unsigned int level) const
+    {
+        return std::max(tilesX >> level, 1u);
+    }
+
+    unsigned int levelTilesY(unsigned int level) const
+    {
+        return std::max(tilesY >> level, 1u);
+    }
+
+    // what the shaders need to address the page table: tiles x, y, levels, cache size in tiles
+    glm::vec4 layout() const
+    {
+        return glm::vec4(static_cast<float>(tilesX), static_cast<float>(tilesY), static_cast<float>(levelCount), static_cast<float>(CACHE_TILES));
+    }
+
+    // the tiles the feedback pass saw this frame: mark resident ones as used
+    // and queue the missing ones, with every coarser tile above them first
+    void request(const std::vector<uint32_t>& keys, unsigned int frame)
+    {
+        wanted.clear();
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            unsigned int level = keys[i] >> 24, y = (keys[i] >> 12) & 0xFFF, x = keys[i] & 0xFFF;
+            if (level >= levelCount || x >= levelTilesX(level) || y >= levelTilesY(level))
+                continue;
+            for (; level < levelCount; ++level, x >>= 1, y >>= 1)
+            {
+                uint32_t key = virtualPageKey(level, std::min(x, levelTilesX(level) - 1), std::min(y, levelTilesY(level) - 1));
+                std::unordered_map<uint32_t, unsigned int>::iterator it = resident.find(key);
+                if (it != resident.end())
+                {
+                    if (slots[it->second].lastUsed == frame)
+                        break; // this one and everything above are already marked
+                    slots[it->second].lastUsed = frame;
+                }
+                else if (!inFlight.count(key))
+                    wanted.push_back(key);
+            }
+        }
+        // coarse first: a frame or two of blur instead of holes
+        std::sort(wanted.begin(), wanted.end(), [](uint32_t a, uint32_t b) { return a > b; });
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+        for (size_t i = 0; i < wanted.size() && inFlight.size() < MAX_IN_FLIGHT; ++i)
+        {
+            uint32_t key = wanted[i];
+            inFlight.insert(key);
+            loader.run(counter, [this, key]() {
+                Tile tile;
+                tile.key = key;
+                if (!readTile(tile))
+                    tile.data.clear();
+                std::lock_guard<std::mutex> lock(readyMutex);
+                ready.push_back(tile);
+            });
+        }
+    }
+
+    // GL thread, once per frame: copy finished tiles into cache slots, evicting
+    // the least recently used, and refresh the page table if anything moved
+    void update(unsigned int frame)
+    {
+        std::vector<Tile> arrived;
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            size_t n = std::min<size_t>(ready.size(), MAX_UPLOADS_PER_FRAME);
+            arrived.assign(ready.begin(), ready.begin() + n);
+            ready.erase(ready.begin(), ready.begin() + n);
+        }
+        bool changed = false;
+        for (size_t i = 0; i < arrived.size(); ++i)
+        {
+            inFlight.erase(arrived[i].key);
+            if (arrived[i].data.empty() || resident.count(arrived[i].key))
+                continue;
+            unsigned int slot = freeSlot(frame);
+            if (slot == NO_SLOT)
+                continue; // every slot is on screen; dropped, asked for again next frame
+            upload(arrived[i], slot);
+            slots[slot].lastUsed = frame;
+            changed = true;
+        }
+        if (changed)
+            rebuildPageTable();
+    }
+
+    // page table and cache on the given texture units
+    void bind(unsigned int pageTableUnit, unsigned int cacheUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + pageTableUnit);
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        glActiveTexture(GL_TEXTURE0 + cacheUnit);
+        glBindTexture(GL_TEXTURE_2D, tileCache);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    size_t residentTiles() const
+    {
+        return resident.size();
+    }
+
+    void release()
+    {
+        loader.wait(counter);
+        loader.stop();
+        glDeleteTextures(1, &pageTable);
+        glDeleteTextures(1, &tileCache);
+        pageTable = tileCache = 0;
+        resident.clear();
+        inFlight.clear();
+        ready.clear();
+    }
+
+private:
+    static const unsigned int NO_SLOT = 0xFFFFFFFFu;
+
+    struct Slot {
+        uint32_t key = 0;
+        bool used = false;
+        bool pinned = false;
+        unsigned int lastUsed = 0;
+    };
+
+    struct Tile {
+        uint32_t key = 0;
+        std::vector<unsigned char> data;
+    };
+
+    std::string path;
+    std::ifstream file;
+    std::mutex fileMutex; // the loader's jobs read tiles; open() reads the root tile before it starts
+    std::vector<unsigned int> firstTile; // tile index of each level's first tile in the file
+    std::vector<std::vector<unsigned char> > pages; // CPU copy of each page table level
+    std::vector<Slot> slots;
+    std::unordered_map<uint32_t, unsigned int> resident; // tile key -> slot
+    std::unordered_set<uint32_t> inFlight;
+    std::vector<uint32_t> wanted;
+    JobSystem loader;
+    JobSystem::Counter counter;
+    std::mutex readyMutex;
+    std::vector<Tile> ready;
+
+    bool readTile(Tile& tile)
+    {
+        unsigned int level = tile.key >> 24, y = (tile.key >> 12) & 0xFFF, x = tile.key & 0xFFF;
+        uint64_t index = firstTile[level] + static_cast<uint64_t>(y) * levelTilesX(level) + x;
+        tile.data.resize(texture_bake::VT_TILE_BYTES);
+        std::lock_guard<std::mutex> lock(fileMutex);
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(texture_bake::VT_HEADER_BYTES + index * texture_bake::VT_TILE_BYTES));
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(tile.data.data()), tile.data.size()));
+    }
+
+    // an empty slot, or the least recently used one not seen this frame
+    unsigned int freeSlot(unsigned int frame)
+    {
+        unsigned int best = NO_SLOT;
+        for (unsigned int s = 0; s < slots.size(); ++s)
+        {
+            if (!slots[s].used)
+                return s;
+            if (slots[s].pinned || slots[s].lastUsed == frame)
+                continue;
+            if (best == NO_SLOT || slots[s].lastUsed < slots[best].lastUsed)
+                best = s;
+        }
+        if (best != NO_SLOT)
+            resident.erase(slots[best].key);
+        return best;
+    }
+
+    unsigned int upload(const Tile& tile, unsigned int slot)
+    {
+        glBindTexture(GL_TEXTURE_2D, tileCache);
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, (slot % CACHE_TILES) * texture_bake::VT_TILE_SIZE, (slot / CACHE_TILES) * texture_bake::VT_TILE_SIZE,
+            texture_bake::VT_TILE_SIZE, texture_bake::VT_TILE_SIZE, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(tile.data.size()), tile.data.data());
+        slots[slot].key = tile.key;
+        slots[slot].used = true;
+        resident[tile.key] = slot;
+        return slot;
+    }
+
+    // coarsest level first, so a missing tile can take its parent's entry
+    void rebuildPageTable()
+    {
+        glBindTexture(GL_TEXTURE_2D, pageTable);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (unsigned int l = levelCount; l-- > 0;)
+        {
+            unsigned int w = levelTilesX(l), h = levelTilesY(l);
+            for (unsigned int y = 0; y < h; ++y)
+            {
+                for (unsigned int x = 0; x < w; ++x)
+                {
+                    unsigned char* entry = &pages[l][(static_cast<size_t>(y) * w + x) * 4];
+                    std::unordered_map<uint32_t, unsigned int>::const_iterator it = resident.find(virtualPageKey(l, x, y));
+                    if (it != resident.end())
+                    {
+                        entry[0] = static_cast<unsigned char>(it->second % CACHE_TILES);
+                        entry[1] = static_cast<unsigned char>(it->second / CACHE_TILES);
+                        entry[2] = static_cast<unsigned char>(l);
+                        entry[3] = 255;
+                    }
+                    else if (l + 1 < levelCount)
+                    {
+                        unsigned int px = std::min(x >> 1, levelTilesX(l + 1) - 1), py = std::min(y >> 1, levelTilesY(l + 1) - 1);
+                        std::copy(&pages[l + 1][(static_cast<size_t>(py) * levelTilesX(l + 1) + px) * 4],
+                            &pages[l + 1][(static_cast<size_t>(py) * levelTilesX(l + 1) + px) * 4] + 4, entry);
+                    }
+                }
+            }
+            glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pages[l].data());
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+};
+
+// Low resolution pass that records which tile every visible pixel of a
+// virtual-textured body needs (6.vt_feedback.fs). The result is read back
+// through two PBOs in turn, so the CPU maps last frame's pixels and never
+// waits on this frame's.
+class VirtualTextureFeedback
+{
+public:
+    static const unsigned int DIVISOR = 8; // of the window size per side
+
+    bool setup(unsigned int screenWidth, unsigned int screenHeight)
+    {
+        width = std::max(screenWidth / DIVISOR, 1u);
+        height = std::max(screenHeight / DIVISOR, 1u);
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glGenTextures(1, &colorTexture);
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(2, readBuffers);
+        for (int i = 0; i < 2; ++i)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<size_t>(width) * height * 4, NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return complete;
+    }
+
+    // log2 of the resolution drop, added to the shader's level so it asks for
+    // the tiles the full resolution pass samples
+    float lodBias() const
+    {
+        return -std::log2(static_cast<float>(DIVISOR));
+    }
+
+    void begin()
+    {
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // start this frame's read back and decode the previous one into the tile
+    // keys of each virtual texture (indexed like the shader's vtId - 1)
+    void end(std::vector<std::vector<uint32_t> >& keys)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffers[frame % 2]);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+        glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+
+        for (size_t i = 0; i < keys.size(); ++i)
+            keys[i].clear();
+        if (frame > 0)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffers[(frame + 1) % 2]);
+            const unsigned char* pixels = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<size_t>(width) * height * 4, GL_MAP_READ_BIT));
+            if (pixels)
+            {
+                uint32_t last = 0;
+                for (size_t p = 0; p < static_cast<size_t>(width) * height; ++p)
+                {
+                    const unsigned char* px = pixels + 4 * p;
+                    uint32_t packed = px[0] | (px[1] << 8) | (px[2] << 16) | (static_cast<uint32_t>(px[3]) << 24);
+                    if (packed == last || px[3] == 0 || px[3] > keys.size())
+                        continue; // neighbours mostly share a tile
+                    last = packed;
+                    keys[px[3] - 1].push_back(virtualPageKey(px[2] >> 4, px[0] | ((px[2] & 3) << 8), px[1] | (((px[2] >> 2) & 3) << 8)));
+                }
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            std::sort(keys[i].begin(), keys[i].end());
+            keys[i].erase(std::unique(keys[i].begin(), keys[i].end()), keys[i].end());
+        }
+        ++frame;
+    }
+
+    void release()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteTextures(1, &colorTexture);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        glDeleteBuffers(2, readBuffers);
+        FBO = colorTexture = depthBuffer = 0;
+    }
+
+private:
+    unsigned int FBO = 0;
+    unsigned int colorTexture = 0;
+    unsigned int depthBuffer = 0;
+    unsigned int readBuffers[2] = { 0, 0 };
+    unsigned int width = 0, height = 0;
+    unsigned int frame = 0;
+    GLint savedViewport[4] = { 0, 0, 0, 0 };
+    GLint savedFramebuffer = 0; // the scene's target, the window or an offscreen benchmark target
+};
+
+#endif